@@ -0,0 +1,165 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <algorithm>
+#include "bitimage.h"
+
+namespace{
+
+inline
+int lowestBit(uint64_t word)
+{
+#ifdef __GNUC__
+  return __builtin_ctzll(word);
+#else
+  int b=0;
+  while(!(word&1)){
+    word>>=1;
+    b++;
+  }
+  return b;
+#endif
+}
+
+inline
+int highestBit(uint64_t word)
+{
+#ifdef __GNUC__
+  return 63-__builtin_clzll(word);
+#else
+  int b=0;
+  while(word>>=1)
+    b++;
+  return b;
+#endif
+}
+
+}
+
+BitImage::BitImage()
+:m_words(NULL), m_rows(0), m_cols(0), m_step(0)
+{
+}
+
+BitImage::BitImage(const int rows, const int cols, const bool value)
+:m_words(NULL), m_rows(0), m_cols(0), m_step(0)
+{
+  create(rows, cols, value);
+}
+
+BitImage::BitImage(const cv::Mat mat)
+:m_words(NULL), m_rows(0), m_cols(0), m_step(0)
+{
+  CV_Assert(mat.channels()==1);
+  cv::Mat nonzero;
+  cv::compare(mat, 0, nonzero, cv::CMP_NE);
+
+  create(mat.rows, mat.cols);
+  for(int y=0; y<m_rows; y++){
+    const uchar* p = nonzero.ptr(y);
+    for(int x=0; x<m_cols; x++)
+      if(p[x])
+        set(y, x);
+  }
+}
+
+void BitImage::create(const int rows, const int cols, const bool value)
+{
+  m_rows=rows;
+  m_cols=cols;
+  m_step=(cols+2+63)/64;
+  m_data = new std::vector<uint64_t>((rows+2)*m_step);
+  m_words = &(*m_data)[0];
+  setTo(value);
+}
+
+BitImage BitImage::clone() const
+{
+  BitImage cpy;
+  if(!empty()){
+    cpy.m_rows=m_rows;
+    cpy.m_cols=m_cols;
+    cpy.m_step=m_step;
+    cpy.m_data = new std::vector<uint64_t>(*m_data);
+    cpy.m_words = &(*cpy.m_data)[0];
+  }
+  return cpy;
+}
+
+void BitImage::setTo(const bool value)
+{
+  if(empty())
+    return;
+  std::fill(m_data->begin(), m_data->end(), value? ~(uint64_t)0:0);
+  if(value)
+    clearBorder();
+}
+
+void BitImage::clearBorder()
+{
+  std::fill(m_words, m_words+m_step, 0);
+  std::fill(m_words+(m_rows+1)*m_step, m_words+(m_rows+2)*m_step, 0);
+
+  // Bit 0 is the left border and the bits from m_cols+1 are the right
+  // border and the padding of the last word.
+  const int last=(m_cols+1)>>6, s=(m_cols+1)&63;
+  for(int y=1; y<=m_rows; y++){
+    uint64_t* row = m_words + y*m_step;
+    row[0]&= ~(uint64_t)1;
+    row[last]&= ((uint64_t)1<<s) - 1;
+    for(int k=last+1; k<m_step; k++)
+      row[k]=0;
+  }
+}
+
+int BitImage::findNext(const int y, const int x) const
+{
+  // The borders and the padding are zero, so the bit found is a pixel.
+  const uint64_t* row = m_words + (y+1)*m_step;
+  int k=(x+1)>>6;
+  uint64_t w=row[k] & (~(uint64_t)0<<((x+1)&63));
+  while(w==0){
+    if(++k==m_step)
+      return -1;
+    w=row[k];
+  }
+  return k*64 + lowestBit(w) - 1;
+}
+
+int BitImage::findPrev(const int y, const int x) const
+{
+  const uint64_t* row = m_words + (y+1)*m_step;
+  int k=(x+1)>>6;
+  uint64_t w=row[k] & (~(uint64_t)0>>(63-((x+1)&63)));
+  while(w==0){
+    if(--k<0)
+      return -1;
+    w=row[k];
+  }
+  return k*64 + highestBit(w) - 1;
+}
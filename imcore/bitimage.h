@@ -0,0 +1,220 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#ifndef BITIMAGE_H
+#define BITIMAGE_H
+
+#include <stdint.h>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+/**
+ * Bits of the 8 neighbors of a pixel returned by BitImage::neighbors8.
+ *
+ * The order is the one used by the scanner and the demodulation to visit
+ * the neighbors.
+ */
+enum BitNeighbor{
+  NB_LEFT=1,        // (x-1,y)
+  NB_RIGHT=2,       // (x+1,y)
+  NB_UP=4,          // (x,y-1)
+  NB_DOWN=8,        // (x,y+1)
+  NB_UPLEFT=16,     // (x-1,y-1)
+  NB_UPRIGHT=32,    // (x+1,y-1)
+  NB_DOWNRIGHT=64,  // (x+1,y+1)
+  NB_DOWNLEFT=128   // (x-1,y+1)
+};
+
+/** Displacements of the neighbors in the order of BitNeighbor */
+const int NB_DX[8]={-1, 1, 0, 0, -1, 1, 1, -1};
+const int NB_DY[8]={0, 0, -1, 1, -1, -1, 1, 1};
+
+/**
+ * Binary image packed in 64-bit words.
+ *
+ * It stores the label fields, as the visited pixels and the masks, using
+ * one bit per pixel. The rows are surrounded by a border of one pixel
+ * always set to zero, so the 8 neighbors of any pixel are read with a few
+ * word operations and without bounds checks.
+ *
+ * As cv::Mat, the copies share the same data, use clone to get an
+ * independent copy.
+ *
+ * @author Julio C. Estrada
+ */
+class BitImage
+{
+public:
+  /**
+   * Default constructor, builds an empty image.
+   */
+  BitImage();
+  /**
+   * Builds an image of the given size.
+   *
+   * @param rows the number of rows.
+   * @param cols the number of columns.
+   * @param value the initial value of the pixels.
+   */
+  BitImage(const int rows, const int cols, const bool value=false);
+  /**
+   * Builds the image from a label field.
+   *
+   * @param mat a single channel matrix, the pixels different from zero are
+   * set.
+   */
+  explicit BitImage(const cv::Mat mat);
+
+  /**
+   * Allocates new data for the image.
+   *
+   * @param rows the number of rows.
+   * @param cols the number of columns.
+   * @param value the initial value of the pixels.
+   */
+  void create(const int rows, const int cols, const bool value=false);
+  /**
+   * Returns a copy of the image that does not share the data.
+   */
+  BitImage clone() const;
+  /**
+   * Sets all the pixels to the given value.
+   */
+  void setTo(const bool value);
+
+  int rows() const {return m_rows;}
+  int cols() const {return m_cols;}
+  bool empty() const {return m_words==NULL;}
+
+  /** Returns the pixel (x,y) */
+  bool operator()(const int y, const int x) const;
+  /** Sets the pixel (x,y) to one */
+  void set(const int y, const int x);
+  /** Sets the pixel (x,y) to zero */
+  void reset(const int y, const int x);
+
+  /**
+   * Returns the 8 neighbors of the pixel (x,y) as a BitNeighbor mask.
+   *
+   * The neighbors outside the image are zero.
+   */
+  unsigned int neighbors8(const int y, const int x) const;
+  /**
+   * Returns the neighbors of the pixel (x,y) that are inside the image as
+   * a BitNeighbor mask.
+   */
+  unsigned int inside8(const int y, const int x) const;
+  /**
+   * Returns the first set pixel of the row y from the column x to the
+   * right, or -1 if there is none.
+   */
+  int findNext(const int y, const int x) const;
+  /**
+   * Returns the first set pixel of the row y from the column x to the
+   * left, or -1 if there is none.
+   */
+  int findPrev(const int y, const int x) const;
+
+private:
+  cv::Ptr<std::vector<uint64_t> > m_data;
+  /** The first word of the data */
+  uint64_t* m_words;
+  int m_rows, m_cols;
+  /** The number of words of each row, including the border */
+  int m_step;
+
+  /** Returns the word holding the pixel (x,y) */
+  uint64_t* word(const int y, const int x) const;
+  /** Returns the pixels x-1, x and x+1 of the row y in the lower 3 bits */
+  unsigned int bits3(const int y, const int x) const;
+  /** Clears the border of the image */
+  void clearBorder();
+};
+
+inline
+uint64_t* BitImage::word(const int y, const int x) const
+{
+  return m_words + (y+1)*m_step + ((x+1)>>6);
+}
+
+inline
+bool BitImage::operator()(const int y, const int x) const
+{
+  return (*word(y,x)>>((x+1)&63)) & 1;
+}
+
+inline
+void BitImage::set(const int y, const int x)
+{
+  *word(y,x)|= (uint64_t)1<<((x+1)&63);
+}
+
+inline
+void BitImage::reset(const int y, const int x)
+{
+  *word(y,x)&= ~((uint64_t)1<<((x+1)&63));
+}
+
+inline
+unsigned int BitImage::bits3(const int y, const int x) const
+{
+  // The pixel x-1 is at bit x of the row because of the border.
+  const uint64_t* w = m_words + (y+1)*m_step + (x>>6);
+  const int s = x&63;
+  uint64_t v = w[0]>>s;
+  if(s>61)
+    v|= w[1]<<(64-s);
+  return (unsigned int)(v&7);
+}
+
+inline
+unsigned int BitImage::neighbors8(const int y, const int x) const
+{
+  const unsigned int a=bits3(y-1, x), b=bits3(y, x), c=bits3(y+1, x);
+
+  return (b&1) | ((b>>1)&2) | ((a<<1)&4) | ((c&2)<<2) |
+    ((a&1)<<4) | ((a&4)<<3) | ((c&4)<<4) | ((c&1)<<7);
+}
+
+inline
+unsigned int BitImage::inside8(const int y, const int x) const
+{
+  unsigned int nb = NB_LEFT | NB_RIGHT | NB_UP | NB_DOWN | NB_UPLEFT |
+    NB_UPRIGHT | NB_DOWNRIGHT | NB_DOWNLEFT;
+  if(x==0)
+    nb&= ~(NB_LEFT | NB_UPLEFT | NB_DOWNLEFT);
+  if(x==m_cols-1)
+    nb&= ~(NB_RIGHT | NB_UPRIGHT | NB_DOWNRIGHT);
+  if(y==0)
+    nb&= ~(NB_UP | NB_UPLEFT | NB_UPRIGHT);
+  if(y==m_rows-1)
+    nb&= ~(NB_DOWN | NB_DOWNLEFT | NB_DOWNRIGHT);
+  return nb;
+}
+
+#endif
@@ -0,0 +1,912 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include "convolution.h"
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONV_X86
+#include <immintrin.h>
+#endif
+
+namespace{
+
+/**
+ * Separable convolution at (x,y) truncating the kernel at the borders.
+ *
+ * This is the reference code, it is used for the border pixels and when
+ * the scalar path is selected.
+ */
+template<typename T>
+T convolutionAtXY_scalar(const T *__restrict data,
+                         const T *__restrict kernelx,
+                         const T *__restrict kernely,
+                         const int x, const int y,
+                         const int M, const int N,
+                         const int kM, const int kN)
+{
+  const int LIx = (x-kN)>=0? -kN:-x;
+  const int LSx = (x+kN)<N?  kN:N-x-1;
+  const int LIy = (y-kM)>=0? -kM:-y;
+  const int LSy = (y+kM)<M? kM:M-y-1;
+
+  double sum=0;
+  double f =0;
+  for(int i=LIy; i<=LSy; i++){
+    f=0;
+    for(int j=LIx; j<=LSx; j++)
+      f+= data[(y+i)*N + j+x]*kernelx[kN+j];
+    sum+=f*kernely[kM+i];
+  }
+
+  return sum;
+}
+
+/**
+ * Complex separable filter at (x,y) truncating the kernel at the borders.
+ */
+template<typename T>
+void gaborAtXY_scalar(const T *__restrict data,
+                      const T *__restrict kxr, const T *__restrict kxi,
+                      const T *__restrict kyr, const T *__restrict kyi,
+                      const int x, const int y, const int M, const int N,
+                      const int kM, const int kN, T* re, T* im)
+{
+  const int LIx = (x-kN)>=0? -kN:-x;
+  const int LSx = (x+kN)<N?  kN:N-x-1;
+  const int LIy = (y-kM)>=0? -kM:-y;
+  const int LSy = (y+kM)<M? kM:M-y-1;
+
+  double sumr=0, sumi=0;
+  for(int i=LIy; i<=LSy; i++){
+    double a=0, b=0;
+    for(int j=LIx; j<=LSx; j++){
+      a+= data[(y+i)*N + j+x]*kxr[kN+j];
+      b+= data[(y+i)*N + j+x]*kxi[kN+j];
+    }
+    sumr+= a*kyr[kM+i] - b*kyi[kM+i];
+    sumi+= a*kyi[kM+i] + b*kyr[kM+i];
+  }
+  *re=sumr;
+  *im=sumi;
+}
+
+double ddot_scalar(const double *__restrict a, const double *__restrict b,
+                   const int n)
+{
+  double sum=0;
+  for(int i=0; i<n; i++)
+    sum+= a[i]*b[i];
+  return sum;
+}
+
+float sdot_scalar(const float *__restrict a, const float *__restrict b,
+                  const int n)
+{
+  float sum=0;
+  for(int i=0; i<n; i++)
+    sum+= a[i]*b[i];
+  return sum;
+}
+
+void ddot2_scalar(const double *__restrict a, const double *__restrict br,
+                  const double *__restrict bi, const int n,
+                  double* sr, double* si)
+{
+  double r=0, i=0;
+  for(int k=0; k<n; k++){
+    r+= a[k]*br[k];
+    i+= a[k]*bi[k];
+  }
+  *sr=r;
+  *si=i;
+}
+
+void sdot2_scalar(const float *__restrict a, const float *__restrict br,
+                  const float *__restrict bi, const int n,
+                  float* sr, float* si)
+{
+  float r=0, i=0;
+  for(int k=0; k<n; k++){
+    r+= a[k]*br[k];
+    i+= a[k]*bi[k];
+  }
+  *sr=r;
+  *si=i;
+}
+
+#ifdef CONV_X86
+
+__attribute__((target("sse2")))
+double ddot_sse2(const double *__restrict a, const double *__restrict b,
+                 const int n)
+{
+  __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+  int i=0;
+  for(; i+4<=n; i+=4){
+    acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a+i), _mm_loadu_pd(b+i)));
+    acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a+i+2),
+                                       _mm_loadu_pd(b+i+2)));
+  }
+  acc0 = _mm_add_pd(acc0, acc1);
+  acc0 = _mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0));
+  double sum = _mm_cvtsd_f64(acc0);
+  for(; i<n; i++)
+    sum+= a[i]*b[i];
+  return sum;
+}
+
+__attribute__((target("sse2")))
+float sdot_sse2(const float *__restrict a, const float *__restrict b,
+                const int n)
+{
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+  int i=0;
+  for(; i+8<=n; i+=8){
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a+i+4),
+                                       _mm_loadu_ps(b+i+4)));
+  }
+  acc0 = _mm_add_ps(acc0, acc1);
+  acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+  acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+  float sum = _mm_cvtss_f32(acc0);
+  for(; i<n; i++)
+    sum+= a[i]*b[i];
+  return sum;
+}
+
+__attribute__((target("avx2,fma")))
+double ddot_avx2(const double *__restrict a, const double *__restrict b,
+                 const int n)
+{
+  __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+  int i=0;
+  for(; i+8<=n; i+=8){
+    acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a+i), _mm256_loadu_pd(b+i), acc0);
+    acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a+i+4), _mm256_loadu_pd(b+i+4),
+                           acc1);
+  }
+  if(i+4<=n){
+    acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a+i), _mm256_loadu_pd(b+i), acc0);
+    i+=4;
+  }
+  acc0 = _mm256_add_pd(acc0, acc1);
+  __m128d r = _mm_add_pd(_mm256_castpd256_pd128(acc0),
+                         _mm256_extractf128_pd(acc0, 1));
+  r = _mm_add_sd(r, _mm_unpackhi_pd(r, r));
+  double sum = _mm_cvtsd_f64(r);
+  for(; i<n; i++)
+    sum+= a[i]*b[i];
+  return sum;
+}
+
+__attribute__((target("avx2,fma")))
+float sdot_avx2(const float *__restrict a, const float *__restrict b,
+                const int n)
+{
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+  int i=0;
+  for(; i+16<=n; i+=16){
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+8), _mm256_loadu_ps(b+i+8),
+                           acc1);
+  }
+  if(i+8<=n){
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), acc0);
+    i+=8;
+  }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  __m128 r = _mm_add_ps(_mm256_castps256_ps128(acc0),
+                        _mm256_extractf128_ps(acc0, 1));
+  r = _mm_add_ps(r, _mm_movehl_ps(r, r));
+  r = _mm_add_ss(r, _mm_shuffle_ps(r, r, 1));
+  float sum = _mm_cvtss_f32(r);
+  for(; i<n; i++)
+    sum+= a[i]*b[i];
+  return sum;
+}
+
+__attribute__((target("avx512f")))
+double ddot_avx512(const double *__restrict a, const double *__restrict b,
+                   const int n)
+{
+  __m512d acc = _mm512_setzero_pd();
+  int i=0;
+  for(; i+8<=n; i+=8)
+    acc = _mm512_fmadd_pd(_mm512_loadu_pd(a+i), _mm512_loadu_pd(b+i), acc);
+  if(i<n){
+    const __mmask8 m = (__mmask8)((1u<<(n-i))-1);
+    acc = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, a+i),
+                          _mm512_maskz_loadu_pd(m, b+i), acc);
+  }
+  return _mm512_reduce_add_pd(acc);
+}
+
+__attribute__((target("avx512f")))
+float sdot_avx512(const float *__restrict a, const float *__restrict b,
+                  const int n)
+{
+  __m512 acc = _mm512_setzero_ps();
+  int i=0;
+  for(; i+16<=n; i+=16)
+    acc = _mm512_fmadd_ps(_mm512_loadu_ps(a+i), _mm512_loadu_ps(b+i), acc);
+  if(i<n){
+    const __mmask16 m = (__mmask16)((1u<<(n-i))-1);
+    acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a+i),
+                          _mm512_maskz_loadu_ps(m, b+i), acc);
+  }
+  return _mm512_reduce_add_ps(acc);
+}
+
+/*
+ * The dual dot products load the data once and multiply it by the real
+ * and imaginary parts of the kernel.
+ */
+
+__attribute__((target("sse2")))
+void ddot2_sse2(const double *__restrict a, const double *__restrict br,
+                const double *__restrict bi, const int n,
+                double* sr, double* si)
+{
+  __m128d accr = _mm_setzero_pd(), acci = _mm_setzero_pd();
+  int k=0;
+  for(; k+2<=n; k+=2){
+    const __m128d v = _mm_loadu_pd(a+k);
+    accr = _mm_add_pd(accr, _mm_mul_pd(v, _mm_loadu_pd(br+k)));
+    acci = _mm_add_pd(acci, _mm_mul_pd(v, _mm_loadu_pd(bi+k)));
+  }
+  accr = _mm_add_sd(accr, _mm_unpackhi_pd(accr, accr));
+  acci = _mm_add_sd(acci, _mm_unpackhi_pd(acci, acci));
+  double r = _mm_cvtsd_f64(accr), i = _mm_cvtsd_f64(acci);
+  for(; k<n; k++){
+    r+= a[k]*br[k];
+    i+= a[k]*bi[k];
+  }
+  *sr=r;
+  *si=i;
+}
+
+__attribute__((target("sse2")))
+void sdot2_sse2(const float *__restrict a, const float *__restrict br,
+                const float *__restrict bi, const int n,
+                float* sr, float* si)
+{
+  __m128 accr = _mm_setzero_ps(), acci = _mm_setzero_ps();
+  int k=0;
+  for(; k+4<=n; k+=4){
+    const __m128 v = _mm_loadu_ps(a+k);
+    accr = _mm_add_ps(accr, _mm_mul_ps(v, _mm_loadu_ps(br+k)));
+    acci = _mm_add_ps(acci, _mm_mul_ps(v, _mm_loadu_ps(bi+k)));
+  }
+  accr = _mm_add_ps(accr, _mm_movehl_ps(accr, accr));
+  accr = _mm_add_ss(accr, _mm_shuffle_ps(accr, accr, 1));
+  acci = _mm_add_ps(acci, _mm_movehl_ps(acci, acci));
+  acci = _mm_add_ss(acci, _mm_shuffle_ps(acci, acci, 1));
+  float r = _mm_cvtss_f32(accr), i = _mm_cvtss_f32(acci);
+  for(; k<n; k++){
+    r+= a[k]*br[k];
+    i+= a[k]*bi[k];
+  }
+  *sr=r;
+  *si=i;
+}
+
+__attribute__((target("avx2,fma")))
+void ddot2_avx2(const double *__restrict a, const double *__restrict br,
+                const double *__restrict bi, const int n,
+                double* sr, double* si)
+{
+  __m256d accr = _mm256_setzero_pd(), acci = _mm256_setzero_pd();
+  int k=0;
+  for(; k+4<=n; k+=4){
+    const __m256d v = _mm256_loadu_pd(a+k);
+    accr = _mm256_fmadd_pd(v, _mm256_loadu_pd(br+k), accr);
+    acci = _mm256_fmadd_pd(v, _mm256_loadu_pd(bi+k), acci);
+  }
+  __m128d r2 = _mm_add_pd(_mm256_castpd256_pd128(accr),
+                          _mm256_extractf128_pd(accr, 1));
+  __m128d i2 = _mm_add_pd(_mm256_castpd256_pd128(acci),
+                          _mm256_extractf128_pd(acci, 1));
+  r2 = _mm_add_sd(r2, _mm_unpackhi_pd(r2, r2));
+  i2 = _mm_add_sd(i2, _mm_unpackhi_pd(i2, i2));
+  double r = _mm_cvtsd_f64(r2), i = _mm_cvtsd_f64(i2);
+  for(; k<n; k++){
+    r+= a[k]*br[k];
+    i+= a[k]*bi[k];
+  }
+  *sr=r;
+  *si=i;
+}
+
+__attribute__((target("avx2,fma")))
+void sdot2_avx2(const float *__restrict a, const float *__restrict br,
+                const float *__restrict bi, const int n,
+                float* sr, float* si)
+{
+  __m256 accr = _mm256_setzero_ps(), acci = _mm256_setzero_ps();
+  int k=0;
+  for(; k+8<=n; k+=8){
+    const __m256 v = _mm256_loadu_ps(a+k);
+    accr = _mm256_fmadd_ps(v, _mm256_loadu_ps(br+k), accr);
+    acci = _mm256_fmadd_ps(v, _mm256_loadu_ps(bi+k), acci);
+  }
+  __m128 r4 = _mm_add_ps(_mm256_castps256_ps128(accr),
+                         _mm256_extractf128_ps(accr, 1));
+  __m128 i4 = _mm_add_ps(_mm256_castps256_ps128(acci),
+                         _mm256_extractf128_ps(acci, 1));
+  r4 = _mm_add_ps(r4, _mm_movehl_ps(r4, r4));
+  r4 = _mm_add_ss(r4, _mm_shuffle_ps(r4, r4, 1));
+  i4 = _mm_add_ps(i4, _mm_movehl_ps(i4, i4));
+  i4 = _mm_add_ss(i4, _mm_shuffle_ps(i4, i4, 1));
+  float r = _mm_cvtss_f32(r4), i = _mm_cvtss_f32(i4);
+  for(; k<n; k++){
+    r+= a[k]*br[k];
+    i+= a[k]*bi[k];
+  }
+  *sr=r;
+  *si=i;
+}
+
+__attribute__((target("avx512f")))
+void ddot2_avx512(const double *__restrict a, const double *__restrict br,
+                  const double *__restrict bi, const int n,
+                  double* sr, double* si)
+{
+  __m512d accr = _mm512_setzero_pd(), acci = _mm512_setzero_pd();
+  int k=0;
+  for(; k+8<=n; k+=8){
+    const __m512d v = _mm512_loadu_pd(a+k);
+    accr = _mm512_fmadd_pd(v, _mm512_loadu_pd(br+k), accr);
+    acci = _mm512_fmadd_pd(v, _mm512_loadu_pd(bi+k), acci);
+  }
+  if(k<n){
+    const __mmask8 m = (__mmask8)((1u<<(n-k))-1);
+    const __m512d v = _mm512_maskz_loadu_pd(m, a+k);
+    accr = _mm512_fmadd_pd(v, _mm512_maskz_loadu_pd(m, br+k), accr);
+    acci = _mm512_fmadd_pd(v, _mm512_maskz_loadu_pd(m, bi+k), acci);
+  }
+  *sr = _mm512_reduce_add_pd(accr);
+  *si = _mm512_reduce_add_pd(acci);
+}
+
+__attribute__((target("avx512f")))
+void sdot2_avx512(const float *__restrict a, const float *__restrict br,
+                  const float *__restrict bi, const int n,
+                  float* sr, float* si)
+{
+  __m512 accr = _mm512_setzero_ps(), acci = _mm512_setzero_ps();
+  int k=0;
+  for(; k+16<=n; k+=16){
+    const __m512 v = _mm512_loadu_ps(a+k);
+    accr = _mm512_fmadd_ps(v, _mm512_loadu_ps(br+k), accr);
+    acci = _mm512_fmadd_ps(v, _mm512_loadu_ps(bi+k), acci);
+  }
+  if(k<n){
+    const __mmask16 m = (__mmask16)((1u<<(n-k))-1);
+    const __m512 v = _mm512_maskz_loadu_ps(m, a+k);
+    accr = _mm512_fmadd_ps(v, _mm512_maskz_loadu_ps(m, br+k), accr);
+    acci = _mm512_fmadd_ps(v, _mm512_maskz_loadu_ps(m, bi+k), acci);
+  }
+  *sr = _mm512_reduce_add_ps(accr);
+  *si = _mm512_reduce_add_ps(acci);
+}
+
+/*
+ * The whole image convolutions vectorize along the output pixels of a
+ * row: each vector lane holds a different output pixel, so no horizontal
+ * reduction is needed. They process the interior pixels of row y from
+ * x=kN and return the first column that was not processed.
+ */
+
+__attribute__((target("sse2")))
+int drow_sse2(const double *__restrict data, const double *__restrict kx,
+              const double *__restrict ky, double *__restrict out,
+              const int N, const int kM, const int kN, const int y)
+{
+  int x=kN;
+  for(; x+2<=N-kN; x+=2){
+    __m128d acc = _mm_setzero_pd();
+    for(int i=-kM; i<=kM; i++){
+      const double* row = data + (y+i)*N + x - kN;
+      __m128d racc = _mm_setzero_pd();
+      for(int j=0; j<=2*kN; j++)
+        racc = _mm_add_pd(racc, _mm_mul_pd(_mm_set1_pd(kx[j]),
+                                           _mm_loadu_pd(row+j)));
+      acc = _mm_add_pd(acc, _mm_mul_pd(_mm_set1_pd(ky[kM+i]), racc));
+    }
+    _mm_storeu_pd(out + y*N + x, acc);
+  }
+  return x;
+}
+
+__attribute__((target("sse2")))
+int srow_sse2(const float *__restrict data, const float *__restrict kx,
+              const float *__restrict ky, float *__restrict out,
+              const int N, const int kM, const int kN, const int y)
+{
+  int x=kN;
+  for(; x+4<=N-kN; x+=4){
+    __m128 acc = _mm_setzero_ps();
+    for(int i=-kM; i<=kM; i++){
+      const float* row = data + (y+i)*N + x - kN;
+      __m128 racc = _mm_setzero_ps();
+      for(int j=0; j<=2*kN; j++)
+        racc = _mm_add_ps(racc, _mm_mul_ps(_mm_set1_ps(kx[j]),
+                                           _mm_loadu_ps(row+j)));
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(ky[kM+i]), racc));
+    }
+    _mm_storeu_ps(out + y*N + x, acc);
+  }
+  return x;
+}
+
+__attribute__((target("avx2,fma")))
+int drow_avx2(const double *__restrict data, const double *__restrict kx,
+              const double *__restrict ky, double *__restrict out,
+              const int N, const int kM, const int kN, const int y)
+{
+  int x=kN;
+  for(; x+4<=N-kN; x+=4){
+    __m256d acc = _mm256_setzero_pd();
+    for(int i=-kM; i<=kM; i++){
+      const double* row = data + (y+i)*N + x - kN;
+      __m256d racc = _mm256_setzero_pd();
+      for(int j=0; j<=2*kN; j++)
+        racc = _mm256_fmadd_pd(_mm256_set1_pd(kx[j]),
+                               _mm256_loadu_pd(row+j), racc);
+      acc = _mm256_fmadd_pd(_mm256_set1_pd(ky[kM+i]), racc, acc);
+    }
+    _mm256_storeu_pd(out + y*N + x, acc);
+  }
+  return x;
+}
+
+__attribute__((target("avx2,fma")))
+int srow_avx2(const float *__restrict data, const float *__restrict kx,
+              const float *__restrict ky, float *__restrict out,
+              const int N, const int kM, const int kN, const int y)
+{
+  int x=kN;
+  for(; x+8<=N-kN; x+=8){
+    __m256 acc = _mm256_setzero_ps();
+    for(int i=-kM; i<=kM; i++){
+      const float* row = data + (y+i)*N + x - kN;
+      __m256 racc = _mm256_setzero_ps();
+      for(int j=0; j<=2*kN; j++)
+        racc = _mm256_fmadd_ps(_mm256_set1_ps(kx[j]),
+                               _mm256_loadu_ps(row+j), racc);
+      acc = _mm256_fmadd_ps(_mm256_set1_ps(ky[kM+i]), racc, acc);
+    }
+    _mm256_storeu_ps(out + y*N + x, acc);
+  }
+  return x;
+}
+
+__attribute__((target("avx512f")))
+int drow_avx512(const double *__restrict data, const double *__restrict kx,
+                const double *__restrict ky, double *__restrict out,
+                const int N, const int kM, const int kN, const int y)
+{
+  int x=kN;
+  for(; x+8<=N-kN; x+=8){
+    __m512d acc = _mm512_setzero_pd();
+    for(int i=-kM; i<=kM; i++){
+      const double* row = data + (y+i)*N + x - kN;
+      __m512d racc = _mm512_setzero_pd();
+      for(int j=0; j<=2*kN; j++)
+        racc = _mm512_fmadd_pd(_mm512_set1_pd(kx[j]),
+                               _mm512_loadu_pd(row+j), racc);
+      acc = _mm512_fmadd_pd(_mm512_set1_pd(ky[kM+i]), racc, acc);
+    }
+    _mm512_storeu_pd(out + y*N + x, acc);
+  }
+  return x;
+}
+
+__attribute__((target("avx512f")))
+int srow_avx512(const float *__restrict data, const float *__restrict kx,
+                const float *__restrict ky, float *__restrict out,
+                const int N, const int kM, const int kN, const int y)
+{
+  int x=kN;
+  for(; x+16<=N-kN; x+=16){
+    __m512 acc = _mm512_setzero_ps();
+    for(int i=-kM; i<=kM; i++){
+      const float* row = data + (y+i)*N + x - kN;
+      __m512 racc = _mm512_setzero_ps();
+      for(int j=0; j<=2*kN; j++)
+        racc = _mm512_fmadd_ps(_mm512_set1_ps(kx[j]),
+                               _mm512_loadu_ps(row+j), racc);
+      acc = _mm512_fmadd_ps(_mm512_set1_ps(ky[kM+i]), racc, acc);
+    }
+    _mm512_storeu_ps(out + y*N + x, acc);
+  }
+  return x;
+}
+
+#endif // CONV_X86
+
+typedef double (*DDotFn)(const double*, const double*, const int);
+typedef float (*SDotFn)(const float*, const float*, const int);
+typedef int (*DRowFn)(const double*, const double*, const double*, double*,
+                      const int, const int, const int, const int);
+typedef int (*SRowFn)(const float*, const float*, const float*, float*,
+                      const int, const int, const int, const int);
+typedef void (*DDot2Fn)(const double*, const double*, const double*,
+                        const int, double*, double*);
+typedef void (*SDot2Fn)(const float*, const float*, const float*,
+                        const int, float*, float*);
+
+/** The functions of the selected instruction set */
+struct ConvolutionKernels{
+  int path;
+  DDotFn ddot;
+  SDotFn sdot;
+  DRowFn drow;
+  SRowFn srow;
+  DDot2Fn ddot2;
+  SDot2Fn sdot2;
+};
+
+bool pathSupported(const int path)
+{
+  switch(path){
+  case CONV_SCALAR:
+    return true;
+#ifdef CONV_X86
+  case CONV_SSE2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+  case CONV_AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  case CONV_AVX512:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+#endif
+  default:
+    return false;
+  }
+}
+
+ConvolutionKernels selectKernels(int path)
+{
+  if(path<CONV_SCALAR || path>CONV_AVX512 || !pathSupported(path))
+    path = CONV_AVX512;
+  while(path>CONV_SCALAR && !pathSupported(path))
+    path--;
+
+  ConvolutionKernels k;
+  k.path=CONV_SCALAR;
+  k.ddot=ddot_scalar;
+  k.sdot=sdot_scalar;
+  k.drow=NULL;
+  k.srow=NULL;
+  k.ddot2=ddot2_scalar;
+  k.sdot2=sdot2_scalar;
+#ifdef CONV_X86
+  if(path==CONV_SSE2){
+    k.path=path;
+    k.ddot=ddot_sse2;
+    k.sdot=sdot_sse2;
+    k.drow=drow_sse2;
+    k.srow=srow_sse2;
+    k.ddot2=ddot2_sse2;
+    k.sdot2=sdot2_sse2;
+  }
+  else if(path==CONV_AVX2){
+    k.path=path;
+    k.ddot=ddot_avx2;
+    k.sdot=sdot_avx2;
+    k.drow=drow_avx2;
+    k.srow=srow_avx2;
+    k.ddot2=ddot2_avx2;
+    k.sdot2=sdot2_avx2;
+  }
+  else if(path==CONV_AVX512){
+    k.path=path;
+    k.ddot=ddot_avx512;
+    k.sdot=sdot_avx512;
+    k.drow=drow_avx512;
+    k.srow=srow_avx512;
+    k.ddot2=ddot2_avx512;
+    k.sdot2=sdot2_avx512;
+  }
+#endif
+  return k;
+}
+
+/**
+ * The selected functions, the widest instruction set is selected the first
+ * time they are used. Each call copies them once, so it does not mix the
+ * functions of two selections.
+ */
+ConvolutionKernels& kernels()
+{
+  static ConvolutionKernels k = selectKernels(CONV_AUTO);
+  return k;
+}
+
+template<typename T, typename DotFn>
+inline
+T convolutionAtXY_dispatch(const T *__restrict data,
+                           const T *__restrict kernelx,
+                           const T *__restrict kernely,
+                           const int x, const int y,
+                           const int M, const int N,
+                           const int kM, const int kN, const bool vect,
+                           DotFn dot)
+{
+  if(!vect || x-kN<0 || x+kN>=N || y-kM<0 || y+kM>=M)
+    return convolutionAtXY_scalar(data, kernelx, kernely, x, y, M, N, kM, kN);
+
+  T sum=0;
+  const T* row = data + (y-kM)*N + x - kN;
+  for(int i=0; i<=2*kM; i++, row+=N)
+    sum+= kernely[i]*dot(row, kernelx, 2*kN+1);
+  return sum;
+}
+
+template<typename T, typename Dot2Fn>
+inline
+void gaborAtXY_dispatch(const T *__restrict data,
+                        const T *__restrict kxr, const T *__restrict kxi,
+                        const T *__restrict kyr, const T *__restrict kyi,
+                        const int x, const int y, const int M, const int N,
+                        const int kM, const int kN, T* re, T* im,
+                        const bool vect, Dot2Fn dot2)
+{
+  if(!vect || x-kN<0 || x+kN>=N || y-kM<0 || y+kM>=M){
+    gaborAtXY_scalar(data, kxr, kxi, kyr, kyi, x, y, M, N, kM, kN, re, im);
+    return;
+  }
+
+  T sumr=0, sumi=0, a, b;
+  const T* row = data + (y-kM)*N + x - kN;
+  for(int i=0; i<=2*kM; i++, row+=N){
+    dot2(row, kxr, kxi, 2*kN+1, &a, &b);
+    sumr+= a*kyr[i] - b*kyi[i];
+    sumi+= a*kyi[i] + b*kyr[i];
+  }
+  *re=sumr;
+  *im=sumi;
+}
+
+template<typename T, typename Dot2Fn>
+inline
+void gaborRows_dispatch(const T *__restrict data,
+                        const T *__restrict kxr, const T *__restrict kxi,
+                        T *__restrict rr, T *__restrict ri,
+                        const int y0, const int y1, const int N,
+                        const int kN, const bool vect, Dot2Fn dot2)
+{
+  for(int y=y0; y<y1; y++){
+    const T* row = data + y*N;
+    for(int x=0; x<N; x++){
+      if(vect && x-kN>=0 && x+kN<N){
+        dot2(row + x - kN, kxr, kxi, 2*kN+1, rr + y*N + x, ri + y*N + x);
+        continue;
+      }
+      const int LI = (x-kN)>=0? -kN:-x;
+      const int LS = (x+kN)<N?  kN:N-x-1;
+      double a=0, b=0;
+      for(int j=LI; j<=LS; j++){
+        a+= row[x+j]*kxr[kN+j];
+        b+= row[x+j]*kxi[kN+j];
+      }
+      rr[y*N + x]=a;
+      ri[y*N + x]=b;
+    }
+  }
+}
+
+template<typename T>
+inline
+void gaborCols(const T *__restrict rr, const T *__restrict ri,
+               const T *__restrict kyr, const T *__restrict kyi,
+               T *__restrict fr, T *__restrict fi,
+               const int y0, const int y1, const int M, const int N,
+               const int kM)
+{
+  for(int y=y0; y<y1; y++){
+    T* outr = fr + y*N;
+    T* outi = fi + y*N;
+    for(int x=0; x<N; x++)
+      outr[x]=outi[x]=0;
+
+    const int LI = (y-kM)>=0? -kM:-y;
+    const int LS = (y+kM)<M? kM:M-y-1;
+    for(int i=LI; i<=LS; i++){
+      // Every tap updates the whole output row, the inner loop runs over
+      // contiguous memory.
+      const T a=kyr[kM+i], b=kyi[kM+i];
+      const T* inr = rr + (y+i)*N;
+      const T* ini = ri + (y+i)*N;
+      for(int x=0; x<N; x++){
+        outr[x]+= inr[x]*a - ini[x]*b;
+        outi[x]+= inr[x]*b + ini[x]*a;
+      }
+    }
+  }
+}
+
+template<typename T, typename DotFn, typename RowFn>
+inline
+void convolution_dispatch(const T *__restrict data,
+                          const T *__restrict kernelx,
+                          const T *__restrict kernely,
+                          T *__restrict out,
+                          const int M, const int N,
+                          const int KM, const int KN, const bool vect,
+                          DotFn dot, RowFn row)
+{
+  const int kM=KM/2;
+  const int kN=KN/2;
+  for(int y=0; y<M; y++){
+    int x=0;
+    if(row!=NULL && y-kM>=0 && y+kM<M){
+      // Border pixels at the left, the vectorized interior and the
+      // remaining pixels at the right.
+      for(; x<kN && x<N; x++)
+        out[y*N + x]=convolutionAtXY_dispatch(data, kernelx, kernely, x, y,
+                                              M, N, kM, kN, vect, dot);
+      if(x==kN)
+        x = row(data, kernelx, kernely, out, N, kM, kN, y);
+    }
+    for(; x<N; x++)
+      out[y*N + x]=convolutionAtXY_dispatch(data, kernelx, kernely, x, y,
+                                            M, N, kM, kN, vect, dot);
+  }
+}
+
+}
+
+int setConvolutionPath(const int path)
+{
+  kernels() = selectKernels(path);
+  return kernels().path;
+}
+
+int getConvolutionPath()
+{
+  return kernels().path;
+}
+
+bool convolutionPathSupported(const int path)
+{
+  return pathSupported(path);
+}
+
+double dconvolutionAtXY(const double *__restrict data,
+               const double *__restrict kernelx,
+               const double *__restrict kernely,
+               const int x, const int y,
+               const int M, const int N,
+               const int kM, const int kN)
+{
+  const ConvolutionKernels k = kernels();
+  return convolutionAtXY_dispatch(data, kernelx, kernely, x, y, M, N, kM, kN,
+                                  k.path!=CONV_SCALAR, k.ddot);
+}
+
+void dconvolution(const double *__restrict data,
+         const double *__restrict kernelx,
+         const double *__restrict kernely,
+         double *__restrict out,
+         const int M, const int N,
+         const int KM, const int KN)
+{
+  const ConvolutionKernels k = kernels();
+  convolution_dispatch(data, kernelx, kernely, out, M, N, KM, KN,
+                       k.path!=CONV_SCALAR, k.ddot, k.drow);
+}
+
+float sconvolutionAtXY(const float *__restrict data,
+               const float *__restrict kernelx,
+               const float *__restrict kernely,
+               const int x, const int y,
+               const int M, const int N,
+               const int kM, const int kN)
+{
+  const ConvolutionKernels k = kernels();
+  return convolutionAtXY_dispatch(data, kernelx, kernely, x, y, M, N, kM, kN,
+                                  k.path!=CONV_SCALAR, k.sdot);
+}
+
+void sconvolution(const float *__restrict data,
+           const float *__restrict kernelx,
+           const float *__restrict kernely,
+           float *__restrict out,
+           const int M, const int N,
+           const int KM, const int KN)
+{
+  const ConvolutionKernels k = kernels();
+  convolution_dispatch(data, kernelx, kernely, out, M, N, KM, KN,
+                       k.path!=CONV_SCALAR, k.sdot, k.srow);
+}
+
+void dgaborAtXY(const double *__restrict data,
+                const double *__restrict kxr, const double *__restrict kxi,
+                const double *__restrict kyr, const double *__restrict kyi,
+                const int x, const int y, const int M, const int N,
+                const int kM, const int kN, double* re, double* im)
+{
+  const ConvolutionKernels k = kernels();
+  gaborAtXY_dispatch(data, kxr, kxi, kyr, kyi, x, y, M, N, kM, kN, re, im,
+                     k.path!=CONV_SCALAR, k.ddot2);
+}
+
+void sgaborAtXY(const float *__restrict data,
+                const float *__restrict kxr, const float *__restrict kxi,
+                const float *__restrict kyr, const float *__restrict kyi,
+                const int x, const int y, const int M, const int N,
+                const int kM, const int kN, float* re, float* im)
+{
+  const ConvolutionKernels k = kernels();
+  gaborAtXY_dispatch(data, kxr, kxi, kyr, kyi, x, y, M, N, kM, kN, re, im,
+                     k.path!=CONV_SCALAR, k.sdot2);
+}
+
+void dgaborRows(const double *__restrict data,
+                const double *__restrict kxr, const double *__restrict kxi,
+                double *__restrict rr, double *__restrict ri,
+                const int y0, const int y1, const int N, const int kN)
+{
+  const ConvolutionKernels k = kernels();
+  gaborRows_dispatch(data, kxr, kxi, rr, ri, y0, y1, N, kN,
+                     k.path!=CONV_SCALAR, k.ddot2);
+}
+
+void sgaborRows(const float *__restrict data,
+                const float *__restrict kxr, const float *__restrict kxi,
+                float *__restrict rr, float *__restrict ri,
+                const int y0, const int y1, const int N, const int kN)
+{
+  const ConvolutionKernels k = kernels();
+  gaborRows_dispatch(data, kxr, kxi, rr, ri, y0, y1, N, kN,
+                     k.path!=CONV_SCALAR, k.sdot2);
+}
+
+void dgaborCols(const double *__restrict rr, const double *__restrict ri,
+                const double *__restrict kyr, const double *__restrict kyi,
+                double *__restrict fr, double *__restrict fi,
+                const int y0, const int y1, const int M, const int N,
+                const int kM)
+{
+  gaborCols(rr, ri, kyr, kyi, fr, fi, y0, y1, M, N, kM);
+}
+
+void sgaborCols(const float *__restrict rr, const float *__restrict ri,
+                const float *__restrict kyr, const float *__restrict kyi,
+                float *__restrict fr, float *__restrict fi,
+                const int y0, const int y1, const int M, const int N,
+                const int kM)
+{
+  gaborCols(rr, ri, kyr, kyi, fr, fi, y0, y1, M, N, kM);
+}
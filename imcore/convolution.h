@@ -0,0 +1,257 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#ifndef CONVOLUTION_H
+#define CONVOLUTION_H
+
+/**
+ * Instruction sets used by the separable convolutions.
+ *
+ * The convolutions select at run time the widest instruction set
+ * supported by the processor. The border pixels, where the kernel does
+ * not fit completely into the data, are always processed by the scalar
+ * code.
+ */
+enum ConvolutionPath{
+  CONV_AUTO=0,
+  CONV_SCALAR,
+  CONV_SSE2,
+  CONV_AVX2,
+  CONV_AVX512
+};
+
+/**
+ * Selects the instruction set used by the convolutions.
+ *
+ * If the processor does not support the requested instruction set, the
+ * widest supported one is used instead.
+ *
+ * The selection is global and it is not thread safe. Call this function
+ * before the filtering starts, never while a convolution runs in another
+ * thread. Each convolution reads the selection once when it starts.
+ *
+ * @param path one of ConvolutionPath, CONV_AUTO selects the widest
+ * instruction set supported.
+ * @return the instruction set actually selected.
+ */
+int setConvolutionPath(const int path);
+/**
+ * Returns the instruction set used by the convolutions.
+ */
+int getConvolutionPath();
+/**
+ * Tells if the processor supports the given instruction set.
+ *
+ * @param path one of ConvolutionPath.
+ */
+bool convolutionPathSupported(const int path);
+
+/**
+ * Separable convolution at pixel (x,y) (double precision).
+ *
+ * The kernel is truncated at the borders of the data.
+ *
+ * @param data the data matrix in continuous memory.
+ * @param kernelx the kernel along the x-direction (columns).
+ * @param kernely the kernel along the y-direction (rows).
+ * @param x the x-position.
+ * @param y the y-position.
+ * @param M the number of rows of the data.
+ * @param N the number of columns of the data.
+ * @param kM the half size of kernely.
+ * @param kN the half size of kernelx.
+ * @return the convolution at (x,y).
+ */
+double dconvolutionAtXY(const double *__restrict data,
+               const double *__restrict kernelx,
+               const double *__restrict kernely,
+               const int x, const int y,
+               const int M, const int N,
+               const int kM, const int kN);
+
+/**
+ * Separable convolution of the whole data (double precision).
+ *
+ * @param data the data matrix in continuous memory.
+ * @param kernelx the kernel along the x-direction (columns).
+ * @param kernely the kernel along the y-direction (rows).
+ * @param out [output] the result, of the same size of the data.
+ * @param M the number of rows of the data.
+ * @param N the number of columns of the data.
+ * @param KM the size of kernely.
+ * @param KN the size of kernelx.
+ */
+void dconvolution(const double *__restrict data,
+           const double *__restrict kernelx,
+           const double *__restrict kernely,
+           double *__restrict out,
+           const int M, const int N,
+           const int KM, const int KN);
+
+/**
+ * Separable convolution at pixel (x,y) (single precision).
+ *
+ * @see dconvolutionAtXY
+ */
+float sconvolutionAtXY(const float *__restrict data,
+               const float *__restrict kernelx,
+               const float *__restrict kernely,
+               const int x, const int y,
+               const int M, const int N,
+               const int kM, const int kN);
+
+/**
+ * Separable convolution of the whole data (single precision).
+ *
+ * @see dconvolution
+ */
+void sconvolution(const float *__restrict data,
+           const float *__restrict kernelx,
+           const float *__restrict kernely,
+           float *__restrict out,
+           const int M, const int N,
+           const int KM, const int KN);
+
+/**
+ * Complex separable filter at pixel (x,y) (double precision).
+ *
+ * It applies the complex kernel (kxr + i kxi)(kyr + i kyi) reading the
+ * neighborhood of (x,y) only once: each row is multiplied by the real
+ * and imaginary parts of the x-kernel at the same time, and the results
+ * are combined with the y-kernel. It gives the same result as the four
+ * real convolutions
+ * \f[
+ * re = k_{xr}k_{yr} - k_{xi}k_{yi}, \quad im = k_{xr}k_{yi} + k_{xi}k_{yr}.
+ * \f]
+ * The kernel is truncated at the borders of the data.
+ *
+ * @param data the data matrix in continuous memory.
+ * @param kxr the real part of the kernel along the x-direction.
+ * @param kxi the imaginary part of the kernel along the x-direction.
+ * @param kyr the real part of the kernel along the y-direction.
+ * @param kyi the imaginary part of the kernel along the y-direction.
+ * @param x the x-position.
+ * @param y the y-position.
+ * @param M the number of rows of the data.
+ * @param N the number of columns of the data.
+ * @param kM the half size of the y-kernel.
+ * @param kN the half size of the x-kernel.
+ * @param re [output] the real part of the result.
+ * @param im [output] the imaginary part of the result.
+ */
+void dgaborAtXY(const double *__restrict data,
+                const double *__restrict kxr, const double *__restrict kxi,
+                const double *__restrict kyr, const double *__restrict kyi,
+                const int x, const int y, const int M, const int N,
+                const int kM, const int kN, double* re, double* im);
+
+/**
+ * Complex separable filter at pixel (x,y) (single precision).
+ *
+ * @see dgaborAtXY
+ */
+void sgaborAtXY(const float *__restrict data,
+                const float *__restrict kxr, const float *__restrict kxi,
+                const float *__restrict kyr, const float *__restrict kyi,
+                const int x, const int y, const int M, const int N,
+                const int kM, const int kN, float* re, float* im);
+
+/**
+ * Horizontal pass of the complex separable filter (double precision).
+ *
+ * It filters the rows y0 to y1-1 of the data with the complex kernel
+ * kxr + i kxi, truncated at the borders. Together with dgaborCols it
+ * computes the same result as dgaborAtXY for the whole image, but with a
+ * cost proportional to the sum of the kernel sizes instead of their
+ * product. The rows are independent, so different row ranges can be
+ * filtered by different threads.
+ *
+ * @param data the data matrix in continuous memory.
+ * @param kxr the real part of the kernel along the x-direction.
+ * @param kxi the imaginary part of the kernel along the x-direction.
+ * @param rr [output] the real part of the row filtering, of the same size
+ * of the data.
+ * @param ri [output] the imaginary part of the row filtering.
+ * @param y0 the first row to filter.
+ * @param y1 one past the last row to filter.
+ * @param N the number of columns of the data.
+ * @param kN the half size of the x-kernel.
+ */
+void dgaborRows(const double *__restrict data,
+                const double *__restrict kxr, const double *__restrict kxi,
+                double *__restrict rr, double *__restrict ri,
+                const int y0, const int y1, const int N, const int kN);
+
+/**
+ * Vertical pass of the complex separable filter (double precision).
+ *
+ * It computes the output rows y0 to y1-1 filtering the columns of the
+ * complex result of dgaborRows with the kernel kyr + i kyi, truncated at
+ * the borders. It needs all the rows of rr and ri within kM rows of the
+ * output rows.
+ *
+ * @param rr the real part of the row filtering.
+ * @param ri the imaginary part of the row filtering.
+ * @param kyr the real part of the kernel along the y-direction.
+ * @param kyi the imaginary part of the kernel along the y-direction.
+ * @param fr [output] the real part of the result.
+ * @param fi [output] the imaginary part of the result.
+ * @param y0 the first output row.
+ * @param y1 one past the last output row.
+ * @param M the number of rows of the data.
+ * @param N the number of columns of the data.
+ * @param kM the half size of the y-kernel.
+ */
+void dgaborCols(const double *__restrict rr, const double *__restrict ri,
+                const double *__restrict kyr, const double *__restrict kyi,
+                double *__restrict fr, double *__restrict fi,
+                const int y0, const int y1, const int M, const int N,
+                const int kM);
+
+/**
+ * Horizontal pass of the complex separable filter (single precision).
+ *
+ * @see dgaborRows
+ */
+void sgaborRows(const float *__restrict data,
+                const float *__restrict kxr, const float *__restrict kxi,
+                float *__restrict rr, float *__restrict ri,
+                const int y0, const int y1, const int N, const int kN);
+
+/**
+ * Vertical pass of the complex separable filter (single precision).
+ *
+ * @see dgaborCols
+ */
+void sgaborCols(const float *__restrict rr, const float *__restrict ri,
+                const float *__restrict kyr, const float *__restrict kyi,
+                float *__restrict fr, float *__restrict fi,
+                const int y0, const int y1, const int M, const int N,
+                const int kM);
+
+#endif // CONVOLUTION_H
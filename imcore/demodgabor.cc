@@ -30,7 +30,150 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "demodgabor.h"
 #include "gabor_gears.h"
 #include "scanner.h"
+#include "scanorder.h"
 #include <opencv2/imgproc/imgproc.hpp>
+#include <vector>
+
+namespace{
+
+/** A tile of the parallel mode and its demodulation */
+struct DemodTile{
+  /** The pixels of the output taken from this tile */
+  cv::Rect core;
+  /** The core extended by the overlap, the pixels demodulated */
+  cv::Rect ext;
+  cv::Mat fr, fi, fx, fy;
+};
+
+/**
+ * Flips the sign of tile t if its frequencies point against the ones of
+ * the reference tile in their overlap.
+ */
+void matchSign(const DemodTile& ref, DemodTile& t)
+{
+  const cv::Rect inter = ref.ext & t.ext;
+  const cv::Rect a = inter - ref.ext.tl();
+  const cv::Rect b = inter - t.ext.tl();
+  const double dot = ref.fx(a).dot(t.fx(b)) + ref.fy(a).dot(t.fy(b));
+
+  if(dot<0){
+    // The conjugated solution: the frequencies and the phase change sign
+    t.fx.convertTo(t.fx, -1, -1);
+    t.fy.convertTo(t.fy, -1, -1);
+    t.fi.convertTo(t.fi, -1, -1);
+  }
+}
+
+}
+
+/**
+ * Processes the pixels given by a scanner one by one.
+ */
+class DemodGabor::Stepper
+{
+public:
+  virtual ~Stepper(){}
+  /**
+   * Processes the given pixel.
+   */
+  virtual void process(const cv::Point pixel)=0;
+  /**
+   * Processes the current pixel of the scanner and moves to the next one.
+   *
+   * @return false when the scanner has no more pixels.
+   */
+  bool step(Scanner& scan)
+  {
+    process(scan.getPosition());
+    return scan.next();
+  }
+};
+
+/**
+ * Stepper for data of type T. It keeps the filters between steps.
+ */
+template<typename T>
+class DemodGabor::StepperT: public DemodGabor::Stepper
+{
+public:
+  StepperT(const DemodGabor& d)
+  :m_demodN(d.m_I, d.m_fr, d.m_fi, d.m_fx, d.m_fy, d.m_visited),
+   m_demodSeed(d.m_I, d.m_fr, d.m_fi, d.m_fx, d.m_fy, d.m_visited),
+   m_startPixel(d.m_startPixel)
+  {
+    m_demodN.setIters(d.m_iters).setKernelSize(d.m_kernelSize).
+      setKernelCache(d.m_cache).setCombFreqs(d.m_combFreqs).
+      setCombSize(d.m_combSize).setMaxFq(d.m_maxfq).setMinFq(d.m_minfq).
+      setTau(d.m_tau);
+    m_demodSeed.setIters(d.m_seedIters).setKernelSize(d.m_kernelSize).
+      setKernelCache(d.m_cache).setMaxFq(d.m_maxfq).setMinFq(d.m_minfq).
+      setTau(d.m_tau);
+    if(d.m_freqSums){
+      m_sums=gabor::FreqSums(d.m_fx, d.m_fy, d.m_visited);
+      m_demodN.setFreqSums(&m_sums);
+      m_demodSeed.setFreqSums(&m_sums);
+    }
+  }
+
+  void process(const cv::Point pixel)
+  {
+    const int i=pixel.y;
+    const int j=pixel.x;
+    if((i==m_startPixel.y && j==m_startPixel.x))
+      m_demodSeed(cv::Vec2d(0.7, 0.7),i,j);
+    else
+      m_demodN(i,j);
+  }
+
+private:
+  /** The neighbor frequency sums shared by both filters, if enabled */
+  gabor::FreqSums m_sums;
+  gabor::DemodNeighborhood<T> m_demodN;
+  gabor::DemodSeed<T> m_demodSeed;
+  const cv::Point m_startPixel;
+};
+
+/**
+ * Demodulates a range of tiles, each one from a seed at its center.
+ */
+class DemodGabor::TileBody: public cv::ParallelLoopBody
+{
+public:
+  TileBody(const DemodGabor& parent, std::vector<DemodTile>& tiles)
+  :m_parent(parent), m_tiles(&tiles)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    for(int k=r.start; k<r.end; k++){
+      DemodTile& t = (*m_tiles)[k];
+      DemodGabor demod(m_parent.m_I(t.ext), m_parent.m_type);
+      demod.m_scanMinf = m_parent.m_scanMinf;
+      demod.m_iters = m_parent.m_iters;
+      demod.m_seedIters = m_parent.m_seedIters;
+      demod.m_combSize = m_parent.m_combSize;
+      demod.m_combFreqs = m_parent.m_combFreqs;
+      demod.m_kernelSize = m_parent.m_kernelSize;
+      demod.m_maxfq = m_parent.m_maxfq;
+      demod.m_minfq = m_parent.m_minfq;
+      demod.m_tau = m_parent.m_tau;
+      demod.m_cache = m_parent.m_cache;
+      demod.m_freqSums = m_parent.m_freqSums;
+      demod.m_startPixel.x = t.core.x + t.core.width/2 - t.ext.x;
+      demod.m_startPixel.y = t.core.y + t.core.height/2 - t.ext.y;
+      demod.run();
+
+      t.fr = demod.m_fr;
+      t.fi = demod.m_fi;
+      t.fx = demod.m_fx;
+      t.fy = demod.m_fy;
+    }
+  }
+
+private:
+  const DemodGabor& m_parent;
+  std::vector<DemodTile>* m_tiles;
+};
 
 DemodGabor::DemodGabor()
 {
@@ -45,21 +188,26 @@ DemodGabor::DemodGabor()
   m_combFreqs=false;
   m_startPixel.x=0;
   m_startPixel.y=0;
+  m_cache=NULL;
+  m_freqSums=false;
+  m_type=CV_64F;
+  m_tileSize=0;
+  m_tileOverlap=16;
+  m_stepper=NULL;
 }
 
-DemodGabor::DemodGabor(const cv::Mat I)
+DemodGabor::DemodGabor(const cv::Mat I, const int type)
+:m_stepper(NULL)
 {
   CV_Assert(I.channels()==1);
+  CV_Assert(type==CV_32F || type==CV_64F);
 
-  if(I.type() != CV_64F)
-    I.convertTo(m_I, CV_64F);
+  m_type = type;
+  if(I.type() != m_type)
+    I.convertTo(m_I, m_type);
   else
     m_I = I.clone();
-  m_fr = cv::Mat_<double>::zeros(m_I.rows, m_I.cols);
-  m_fi = cv::Mat_<double>::zeros(m_I.rows, m_I.cols);
-  m_fx = cv::Mat_<double>::ones(m_I.rows, m_I.cols)*M_PI/2.0;
-  m_fy = cv::Mat_<double>::ones(m_I.rows, m_I.cols)*M_PI/2.0;
-  m_visited = cv::Mat_<uchar>::zeros(m_I.rows, m_I.cols);
+  reset();
   m_scanMinf = 0.03;
   m_minfq = 0.09;
   m_maxfq = M_PI/2;
@@ -71,6 +219,50 @@ DemodGabor::DemodGabor(const cv::Mat I)
   m_combFreqs=false;
   m_startPixel.x=I.cols/2;
   m_startPixel.y=I.rows/2;
+  m_cache=NULL;
+  m_freqSums=false;
+  m_tileSize=0;
+  m_tileOverlap=16;
+}
+
+DemodGabor::DemodGabor(const DemodGabor& cpy)
+:m_stepper(NULL)
+{
+  *this=cpy;
+}
+
+DemodGabor::~DemodGabor()
+{
+  invalidate();
+}
+
+DemodGabor& DemodGabor::operator=(const DemodGabor& cpy)
+{
+  if(this==&cpy)
+    return *this;
+  invalidate();
+  m_I=cpy.m_I;
+  m_fr=cpy.m_fr;
+  m_fi=cpy.m_fi;
+  m_fx=cpy.m_fx;
+  m_fy=cpy.m_fy;
+  m_visited=cpy.m_visited;
+  m_startPixel=cpy.m_startPixel;
+  m_scanMinf=cpy.m_scanMinf;
+  m_iters=cpy.m_iters;
+  m_seedIters=cpy.m_seedIters;
+  m_combSize=cpy.m_combSize;
+  m_combFreqs=cpy.m_combFreqs;
+  m_kernelSize=cpy.m_kernelSize;
+  m_maxfq=cpy.m_maxfq;
+  m_minfq=cpy.m_minfq;
+  m_tau=cpy.m_tau;
+  m_cache=cpy.m_cache;
+  m_freqSums=cpy.m_freqSums;
+  m_type=cpy.m_type;
+  m_tileSize=cpy.m_tileSize;
+  m_tileOverlap=cpy.m_tileOverlap;
+  return *this;
 }
 
 cv::Mat DemodGabor::getFi()
@@ -107,7 +299,8 @@ DemodGabor& DemodGabor::setScanMinf(double minf)
 
 void DemodGabor::removeDC()
 {
-  cv::Mat_<double> aux;
+  invalidate();
+  cv::Mat aux;
   cv::GaussianBlur(m_I, m_I, cv::Size(0,0), 1);
   cv::GaussianBlur(m_I, aux, cv::Size(0,0), 15);
 
@@ -116,121 +309,257 @@ void DemodGabor::removeDC()
 
 DemodGabor& DemodGabor::setStartPixel(const cv::Point pixel)
 {
+  invalidate();
   m_startPixel=pixel;
   return *this;
 }
 
 void DemodGabor::run()
 {
-  cv::Vec2d freqs;
-  int i=m_startPixel.y, j=m_startPixel.x;
-  freqs[0]=0.7; freqs[1]=0.7;
+  // The fields are written here, a kept stepper would have stale sums
+  invalidate();
+  if(m_tileSize>0 && (m_tileSize<m_I.rows || m_tileSize<m_I.cols)){
+    runTiled();
+    return;
+  }
+
+  if(m_type==CV_32F)
+    run_<float>(NULL);
+  else
+    run_<double>(NULL);
+}
+
+void DemodGabor::record(ScanOrder& order)
+{
+  invalidate();
+  if(m_type==CV_32F)
+    run_<float>(&order);
+  else
+    run_<double>(&order);
+}
 
-  m_fx(i,j)=freqs[0];
-  m_fy(i,j)=freqs[1];
+void DemodGabor::replay(const ScanOrder& order)
+{
+  CV_Assert(order.rows()==m_I.rows && order.cols()==m_I.cols);
+  if(order.size()==0)
+    return;
+  setStartPixel(order.point(0));
+
+  if(m_type==CV_32F)
+    replay_<float>(order);
+  else
+    replay_<double>(order);
+}
+
+bool DemodGabor::runInteractive(Scanner& scan, int iters)
+{
+  Stepper* s = stepper();
+  bool more=true;
+  for(int k=0; k<iters && more; k++)
+    more = s->step(scan);
+  return more;
+}
+
+bool DemodGabor::runFor(Scanner& scan, double ms)
+{
+  const int64 end = cv::getTickCount() +
+      (int64)(ms*1e-3*cv::getTickFrequency());
+  Stepper* s = stepper();
+  bool more=true;
+  // The clock is read every few pixels, reading it costs more than
+  // processing a pixel with small kernels.
+  do{
+    for(int k=0; k<16 && more; k++)
+      more = s->step(scan);
+  }while(more && cv::getTickCount()<end);
+  return more;
+}
+
+DemodGabor::Stepper* DemodGabor::stepper()
+{
+  if(m_stepper==NULL){
+    if(m_type==CV_32F)
+      m_stepper = new StepperT<float>(*this);
+    else
+      m_stepper = new StepperT<double>(*this);
+  }
+  return m_stepper;
+}
+
+void DemodGabor::invalidate()
+{
+  delete m_stepper;
+  m_stepper=NULL;
+}
+
+template<typename T>
+void DemodGabor::run_(ScanOrder* order)
+{
+  const int i=m_startPixel.y, j=m_startPixel.x;
+  m_fx.at<T>(i,j)=0.7;
+  m_fy.at<T>(i,j)=0.7;
 
   Scanner scan(m_fx, m_fy, m_startPixel);
   scan.setFreqMin(m_scanMinf);
-  cv::Point pixel;
-  gabor::DemodNeighborhood demodN(m_I, m_fr, m_fi, m_fx, m_fy, m_visited);
-  gabor::DemodSeed demodSeed(m_I, m_fr, m_fi, m_fx, m_fy, m_visited);
+  scan.recordTo(order);
+  StepperT<T> stepper(*this);
 
-  demodN.setIters(m_iters).setKernelSize(m_kernelSize).
-    setCombFreqs(m_combFreqs).setCombSize(m_combSize).
-    setMaxFq(m_maxfq).setMinFq(m_minfq).setTau(m_tau);
-  demodSeed.setIters(m_seedIters).setKernelSize(m_kernelSize).
-    setMaxFq(m_maxfq).setMinFq(m_minfq).setTau(m_tau);
+  while(stepper.step(scan));
+}
 
-  do{
-    pixel=scan.getPosition();
-    i=pixel.y;
-    j=pixel.x;
-    if((i==m_startPixel.y && j==m_startPixel.x)){
-      demodSeed(freqs,i,j);
-      freqs[0]=m_fx.at<double>(i,j); freqs[1]=m_fy.at<double>(i,j);
-      //scan.setFreqMin(sqrt(freqs[0]*freqs[0]+freqs[1]*freqs[1]));
+template<typename T>
+void DemodGabor::replay_(const ScanOrder& order)
+{
+  const int i=m_startPixel.y, j=m_startPixel.x;
+  m_fx.at<T>(i,j)=0.7;
+  m_fy.at<T>(i,j)=0.7;
+
+  StepperT<T> stepper(*this);
+  const int n=order.size(), d=ScanOrder::PREFETCH_DISTANCE;
+  for(int k=0; k<n; k++){
+    if(k+d<n){
+      const cv::Point ahead=order.point(k+d);
+      ScanOrder::prefetch(m_I, ahead);
+      ScanOrder::prefetch(m_fx, ahead);
+      ScanOrder::prefetch(m_fy, ahead);
     }
-    else
-      demodN(i,j);
-  }while(scan.next());
-}
-
-bool DemodGabor::runInteractive(Scanner& scan)
-{
-  cv::Vec2d freqs(0.7,0.7);
-
-  cv::Point pixel;
-  gabor::DemodNeighborhood demodN(m_I, m_fr, m_fi, m_fx, m_fy, m_visited);
-  gabor::DemodSeed demodSeed(m_I, m_fr, m_fi, m_fx, m_fy, m_visited);
-  demodN.setIters(m_iters).setKernelSize(m_kernelSize).
-    setCombFreqs(m_combFreqs).setCombSize(m_combSize).
-    setMaxFq(m_maxfq).setMinFq(m_minfq).setTau(m_tau);
-  demodSeed.setIters(m_seedIters).setKernelSize(m_kernelSize).
-    setMaxFq(m_maxfq).setMinFq(m_minfq).setTau(m_tau);
-
-  pixel=scan.getPosition();
-  const int i=pixel.y;
-  const int j=pixel.x;
-  if((i==m_startPixel.y && j==m_startPixel.x)){
-    demodSeed(freqs,i,j);
-    freqs[0]=m_fx.at<double>(i,j); freqs[1]=m_fy.at<double>(i,j);
-    //scan.setFreqMin(sqrt(freqs[0]*freqs[0]+freqs[1]*freqs[1]));
+    stepper.process(order.point(k));
   }
-  else
-    demodN(i,j);
+}
 
-  return scan.next();
+void DemodGabor::runTiled()
+{
+  // The signs of the tiles are matched in their overlaps
+  CV_Assert(m_tileOverlap>0);
+  invalidate();
+  const int ts=m_tileSize, ov=m_tileOverlap;
+  const int nx=(m_I.cols+ts-1)/ts, ny=(m_I.rows+ts-1)/ts;
+  const cv::Rect image(0, 0, m_I.cols, m_I.rows);
+  std::vector<DemodTile> tiles(nx*ny);
+  int root=0;
+
+  for(int ty=0; ty<ny; ty++)
+    for(int tx=0; tx<nx; tx++){
+      DemodTile& t = tiles[ty*nx + tx];
+      t.core = cv::Rect(tx*ts, ty*ts, ts, ts) & image;
+      t.ext = cv::Rect(t.core.x-ov, t.core.y-ov, t.core.width+2*ov,
+                       t.core.height+2*ov) & image;
+      if(t.core.contains(m_startPixel))
+        root=ty*nx + tx;
+    }
+
+  cv::parallel_for_(cv::Range(0, (int)tiles.size()), TileBody(*this, tiles));
+
+  // The tiles are visited in breadth-first order from the one holding the
+  // start pixel, each one takes the sign of the tile that reached it.
+  std::vector<char> matched(tiles.size(), 0);
+  std::vector<int> queue(1, root);
+  matched[root]=1;
+  for(size_t q=0; q<queue.size(); q++){
+    const int k=queue[q], tx=k%nx, ty=k/nx;
+    const int neighbors[4][2]={{tx-1, ty}, {tx+1, ty}, {tx, ty-1},
+                               {tx, ty+1}};
+    for(int n=0; n<4; n++){
+      const int x=neighbors[n][0], y=neighbors[n][1];
+      if(x<0 || x>=nx || y<0 || y>=ny || matched[y*nx + x])
+        continue;
+      matchSign(tiles[k], tiles[y*nx + x]);
+      matched[y*nx + x]=1;
+      queue.push_back(y*nx + x);
+    }
+  }
+
+  for(size_t k=0; k<tiles.size(); k++){
+    const DemodTile& t = tiles[k];
+    const cv::Rect core = t.core - t.ext.tl();
+    t.fr(core).copyTo(m_fr(t.core));
+    t.fi(core).copyTo(m_fi(t.core));
+    t.fx(core).copyTo(m_fx(t.core));
+    t.fy(core).copyTo(m_fy(t.core));
+  }
+  m_visited.setTo(true);
 }
 
 DemodGabor& DemodGabor::setIters(const int iters)
 {
+  invalidate();
   m_iters=iters;
   return *this;
 }
 DemodGabor& DemodGabor::setSeedIters(const int iters)
 {
+  invalidate();
   m_seedIters=iters;
   return *this;
 }
 DemodGabor& DemodGabor::setKernelSize(const double size)
 {
+  invalidate();
   m_kernelSize=size;
   return *this;
 }
 DemodGabor& DemodGabor::setMaxfq(const double w)
 {
+  invalidate();
   m_maxfq=w;
   return *this;
 }
 DemodGabor& DemodGabor::setMinfq(const double w)
 {
+  invalidate();
   m_minfq=w;
   return *this;
 }
 DemodGabor& DemodGabor::setTau(const double tau)
 {
+  invalidate();
   m_tau=tau;
   return *this;
 }
 
 DemodGabor& DemodGabor::setCombFreqs(const bool comb)
 {
+  invalidate();
   m_combFreqs=comb;
   return *this;
 }
 DemodGabor& DemodGabor::setCombSize(const int size)
 {
+  invalidate();
   m_combSize=size;
   return *this;
 }
+DemodGabor& DemodGabor::setTileSize(const int size)
+{
+  m_tileSize=size;
+  return *this;
+}
+DemodGabor& DemodGabor::setTileOverlap(const int overlap)
+{
+  m_tileOverlap=overlap;
+  return *this;
+}
+DemodGabor& DemodGabor::setKernelCache(gabor::KernelCache* cache)
+{
+  invalidate();
+  m_cache=cache;
+  return *this;
+}
+DemodGabor& DemodGabor::setFreqSums(const bool enable)
+{
+  invalidate();
+  m_freqSums=enable;
+  return *this;
+}
 
 void DemodGabor::reset()
 {
-  m_fx = cv::Mat_<double>::ones(m_I.rows, m_I.cols)*M_PI/2.0;
-  m_fy = cv::Mat_<double>::ones(m_I.rows, m_I.cols)*M_PI/2.0;
-  m_visited = cv::Mat_<uchar>::zeros(m_I.rows, m_I.cols);
-  m_fr =  cv::Mat_<double>::zeros(m_I.rows, m_I.cols);
-  m_fi =  cv::Mat_<double>::zeros(m_I.rows, m_I.cols);
+  invalidate();
+  m_fx = cv::Mat::ones(m_I.rows, m_I.cols, m_type)*M_PI/2.0;
+  m_fy = cv::Mat::ones(m_I.rows, m_I.cols, m_type)*M_PI/2.0;
+  m_visited.create(m_I.rows, m_I.cols);
+  m_fr =  cv::Mat::zeros(m_I.rows, m_I.cols, m_type);
+  m_fi =  cv::Mat::zeros(m_I.rows, m_I.cols, m_type);
 }
 
 
@@ -238,3 +567,8 @@ cv::Point DemodGabor::getStartPixel()
 {
   return m_startPixel;
 }
+
+int DemodGabor::getType()
+{
+  return m_type;
+}
@@ -35,12 +35,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 class Scanner;
+class ScanOrder;
 
 /**
  * Implemments an adaptive Gabor filter guided by the local frequencies.
  *
  * @author Julio C. Estrada
- * @note The data processed is double precision.
+ * @note The data is processed in double precision by default, single
+ * precision can be selected when the filter is built.
  */
 class DemodGabor
 {
@@ -49,14 +51,22 @@ public:
    * Default constructor.
    */
   DemodGabor();
+  DemodGabor(const DemodGabor& cpy);
+  ~DemodGabor();
+  DemodGabor& operator=(const DemodGabor& cpy);
   /**
    * Builds the filter to process the given image.
    *
+   * The image is converted to the given precision, which is also the
+   * precision of the outputs and of the estimated frequencies. Single
+   * precision halves the memory used and is enough for 8-bit camera data.
+   *
    * @param I the image to process
+   * @param type the precision of the processing, CV_32F or CV_64F.
    */
 
 #ifndef SWIG
-  DemodGabor(const cv::Mat I);
+  DemodGabor(const cv::Mat I, const int type=CV_64F);
 
   /**
    * Returns the real part of the output
@@ -144,7 +154,59 @@ public:
   DemodGabor& setStartPixel(const cv::Point pixel);
   DemodGabor& setCombFreqs(const bool comb);
   DemodGabor& setCombSize(const int size);
+  /**
+    Sets the tile size of the parallel mode.
+
+    When the tile size is greater than zero, run() splits the image into
+    square tiles of this size. Each tile, extended by the tile overlap, is
+    demodulated independently from a seed at its center and the tiles are
+    processed in parallel. The sign ambiguity of the frequencies and the
+    imaginary part between tiles is solved in their overlaps. The sequential
+    mode is used when the size is zero, the default, or when the image fits
+    into one tile.
+
+    @param size the tile size in pixels, zero disables the parallel mode.
+  */
+  DemodGabor& setTileSize(const int size);
+  /**
+    Sets the number of pixels that each tile is extended by on each side.
+
+    The overlap is used to match the sign of neighbor tiles, it should be
+    larger than the kernel size. Without overlap the signs can not be
+    matched, so the parallel mode requires a positive overlap and run()
+    throws otherwise. Default is 16.
+
+    @param overlap the overlap in pixels.
+  */
+  DemodGabor& setTileOverlap(const int overlap);
+#ifndef SWIG
+  /**
+    Sets the cache where the gabor kernels are taken from.
+
+    By default there is no cache and the kernels are generated at each
+    pixel. A cache, as gabor::KernelCache::shared(), rounds the frequency
+    and sigma of the kernels to its step, which slightly changes the
+    output.
+
+    @param cache the kernel cache, NULL generates the kernels at each pixel.
+  */
+  DemodGabor& setKernelCache(gabor::KernelCache* cache);
+#endif
+  /**
+    Sets whether the neighbor frequencies are averaged with running sums.
+
+    The sums avoid scanning the neighborhood of each pixel when its
+    frequencies are predicted, but they take about 9 bytes per pixel and
+    their single precision slightly changes the output. Disabled by default.
+
+    @param enable true to use the running sums.
+  */
+  DemodGabor& setFreqSums(const bool enable);
   cv::Point getStartPixel();
+  /**
+   * Returns the precision of the processing, CV_32F or CV_64F.
+   */
+  int getType();
 
 
   /**
@@ -152,20 +214,73 @@ public:
    */
   void run();
 
-  bool runInteractive(Scanner& scan);
+  /**
+   * Executes the filtering operation for the given number of pixels.
+   *
+   * The pixels are taken from the scanner. The filters used to process
+   * them are kept between calls, so the processing can be advanced in
+   * small steps, for example to show the partial results. They are
+   * rebuilt when a parameter changes.
+   *
+   * @param scan the scanner that gives the pixel sequence.
+   * @param iters the number of pixels to process.
+   * @return false when the scanner has no more pixels.
+   */
+  bool runInteractive(Scanner& scan, int iters=1);
+  /**
+   * Executes the filtering operation during the given time.
+   *
+   * It works as runInteractive, but it processes pixels until the time
+   * budget is spent instead of a fixed number of pixels.
+   *
+   * @param scan the scanner that gives the pixel sequence.
+   * @param ms the time budget in milliseconds.
+   * @return false when the scanner has no more pixels.
+   */
+  bool runFor(Scanner& scan, double ms);
+  /**
+   * Executes the filtering operation and records the pixel sequence.
+   *
+   * It works as run in the sequential mode, the tile size is not used.
+   *
+   * @param order [output] the pixel sequence followed.
+   */
+  void record(ScanOrder& order);
+  /**
+   * Executes the filtering operation following a recorded sequence.
+   *
+   * The path is not searched, the pixels are processed in the given
+   * order, so frames with the same mask and similar fringes can share the
+   * sequence recorded for one of them. The first pixel of the sequence is
+   * the start pixel.
+   *
+   * @param order the pixel sequence, recorded for images of the same size.
+   */
+  void replay(const ScanOrder& order);
 private:
+#ifndef SWIG
+  class TileBody;
+  class Stepper;
+  template<typename T> class StepperT;
+  template<typename T> void run_(ScanOrder* order);
+  template<typename T> void replay_(const ScanOrder& order);
+  void runTiled();
+  Stepper* stepper();
+  void invalidate();
+#endif
+
   /** The image matrix being processed */
-  cv::Mat_<double> m_I;
+  cv::Mat m_I;
   /** The real part of the output */
-  cv::Mat_<double> m_fr;
+  cv::Mat m_fr;
   /** The imaginary part of the output */
-  cv::Mat_<double> m_fi;
+  cv::Mat m_fi;
   /** The obtained frequencies at x-direction */
-  cv::Mat_<double> m_fx;
+  cv::Mat m_fx;
   /** The obtained frequencies at y-direction */
-  cv::Mat_<double> m_fy;
+  cv::Mat m_fy;
   /** Label field marking the pixels already visited */
-  cv::Mat_<uchar> m_visited;
+  BitImage m_visited;
   cv::Point m_startPixel;
 
   /** The minimum radial frequency to process */
@@ -178,6 +293,17 @@ private:
   double m_maxfq;
   double m_minfq;
   double m_tau;
+  gabor::KernelCache* m_cache;
+  /** Whether the neighbor frequencies are averaged with running sums */
+  bool m_freqSums;
+  /** The precision of the processing, CV_32F or CV_64F */
+  int m_type;
+  /** The tile size of the parallel mode, zero for the sequential mode */
+  int m_tileSize;
+  /** The pixels that each tile is extended by on each side */
+  int m_tileOverlap;
+  /** The filters of runInteractive, NULL until they are needed */
+  Stepper* m_stepper;
 
 };
 
@@ -26,128 +26,11 @@ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 **************************************************************************/
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include "gabor_gears.h"
 
-/**
- */
-inline
-double dconvolutionAtXY(const double *__restrict data,
-               const double *__restrict kernelx,
-               const double *__restrict kernely,
-               const int x, const int y,
-               const int M, const int N,
-               const int kM, const int kN)
-{
-  const int LIx = (x-kN)>=0? -kN:-x;
-  const int LSx = (x+kN)<N?  kN:N-x-1;
-  const int LIy = (y-kM)>=0? -kM:-y;
-  const int LSy = (y+kM)<M? kM:M-y-1;
-
-  double sum=0;
-  //double weight=0;
-  double f =0;
-  for(int i=LIy; i<=LSy; i++){
-    f=0;
-    for(int j=LIx; j<=LSx; j++)
-      f+= data[(y+i)*N + j+x]*kernelx[kN+j];
-    sum+=f*kernely[kM+i];
-    //weight+=kernely[kM+i];
-  }
-
-  return sum;//weight!=0? sum/weight:0;
-}
-
-inline
-void dconvolution(const double *__restrict data,
-         const double *__restrict kernelx,
-         const double *__restrict kernely,
-         double *__restrict out,
-         const int M, const int N,
-         const int KM, const int KN)
-{
-  const int kM=KM/2;
-  const int kN=KN/2;
-  for(int y=0; y<M; y++)
-    for(int x=0; x<N; x++){
-      int LIx = (x-kN)>=0? -kN:-x;
-      int LSx = (x+kN)<N?  kN:N-x-1;
-      int LIy = (y-kM)>=0? -kM:-y;
-      int LSy = (y+kM)<M? kM:M-y-1;
-
-      double sum=0;
-      //double weight=0;
-      double f =0;
-      for(int i=LIy; i<=LSy; i++){
-        f=0;
-        for(int j=LIx; j<=LSx; j++)
-          f+= data[(y+i)*N + j+x]*kernelx[kN+j];
-        sum+=f*kernely[kM+i];
-        //weight+=kernely[kM+i];
-      }
-      out[y*N + x]=sum; //sum/weight;
-    }
-}
-
-inline
-float sconvolutionAtXY(const float *__restrict data,
-               const float *__restrict kernelx,
-               const float *__restrict kernely,
-               const int x, const int y,
-               const int M, const int N,
-               const int kM, const int kN)
-{
-  const int LIx = (x-kN)>=0? -kN:-x;
-  const int LSx = (x+kN)<N?  kN:N-x-1;
-  const int LIy = (y-kM)>=0? -kM:-y;
-  const int LSy = (y+kM)<M? kM:M-y-1;
-
-  double sum=0;
-  //double weight=0;
-  double f =0;
-  for(int i=LIy; i<=LSy; i++){
-    f=0;
-    for(int j=LIx; j<=LSx; j++)
-      f+= data[(y+i)*N + j+x]*kernelx[kN+j];
-    sum+=f*kernely[kM+i];
-    //weight+=kernely[kM+i];
-  }
-
-  return sum;//weight!=0? sum/weight:0;
-}
-
-inline
-void sconvolution(const float *__restrict data,
-           const float *__restrict kernelx,
-           const float *__restrict kernely,
-           float *__restrict out,
-           const int M, const int N,
-           const int KM, const int KN)
-{
-  const int kM=KM/2;
-  const int kN=KN/2;
-  for(int y=0; y<M; y++)
-    for(int x=0; x<N; x++){
-      int LIx = (x-kN)>=0? -kN:-x;
-      int LSx = (x+kN)<N?  kN:N-x-1;
-      int LIy = (y-kM)>=0? -kM:-y;
-      int LSy = (y+kM)<M? kM:M-y-1;
-
-      double sum=0;
-      //double weight=0;
-      double f =0;
-      for(int i=LIy; i<=LSy; i++){
-        f=0;
-        for(int j=LIx; j<=LSx; j++)
-          f+= data[(y+i)*N + j+x]*kernelx[kN+j];
-        sum+=f*kernely[kM+i];
-        //weight+=kernely[kM+i];
-      }
-      out[y*N + x]=sum;//sum/weight;
-    }
-}
-
 void gen_gaborKernel(cv::Mat& greal, cv::Mat& gimag, const double f,
              const double sigma, const int type) throw(cv::Exception)
 {
@@ -172,6 +55,105 @@ void gen_gaborKernel(cv::Mat& greal, cv::Mat& gimag, const double f,
   }
 }
 
+bool gabor::KernelCache::Key::operator<(const Key& k) const
+{
+  if(f!=k.f)
+    return f<k.f;
+  if(sigma!=k.sigma)
+    return sigma<k.sigma;
+  return type<k.type;
+}
+
+gabor::KernelCache::KernelCache(const double step, const size_t maxBytes)
+:m_step(step), m_maxBytes(maxBytes), m_bytes(0)
+{
+}
+
+void gabor::KernelCache::get(cv::Mat& greal, cv::Mat& gimag, const double f,
+                             const double sigma, const int type)
+{
+  if(m_step<=0){
+    gen_gaborKernel(greal, gimag, f, sigma, type);
+    return;
+  }
+
+  Key key;
+  key.f = cvRound(f/m_step);
+  key.sigma = cvRound(sigma/m_step);
+  key.type = type;
+  {
+    cv::AutoLock lock(m_mutex);
+    std::map<Key, Entry>::iterator it = m_kernels.find(key);
+    if(it!=m_kernels.end()){
+      greal = it->second.greal;
+      gimag = it->second.gimag;
+      return;
+    }
+  }
+
+  // The kernel is generated outside the lock, other threads can still
+  // read the cache meanwhile.
+  Entry entry;
+  gen_gaborKernel(entry.greal, entry.gimag, key.f*m_step, key.sigma*m_step,
+                  type);
+  greal = entry.greal;
+  gimag = entry.gimag;
+
+  cv::AutoLock lock(m_mutex);
+  if(m_kernels.find(key)!=m_kernels.end())
+    return;
+  m_kernels[key] = entry;
+  m_order.push_back(key);
+  m_bytes+= 2*entry.greal.total()*entry.greal.elemSize();
+  while(m_bytes>m_maxBytes && !m_order.empty()){
+    std::map<Key, Entry>::iterator it = m_kernels.find(m_order.front());
+    m_bytes-= 2*it->second.greal.total()*it->second.greal.elemSize();
+    m_kernels.erase(it);
+    m_order.pop_front();
+  }
+}
+
+gabor::KernelCache& gabor::KernelCache::setStep(const double step)
+{
+  clear();
+  cv::AutoLock lock(m_mutex);
+  m_step=step;
+  return *this;
+}
+
+gabor::KernelCache& gabor::KernelCache::setMaxBytes(const size_t bytes)
+{
+  cv::AutoLock lock(m_mutex);
+  m_maxBytes=bytes;
+  return *this;
+}
+
+void gabor::KernelCache::clear()
+{
+  cv::AutoLock lock(m_mutex);
+  m_kernels.clear();
+  m_order.clear();
+  m_bytes=0;
+}
+
+size_t gabor::KernelCache::size()
+{
+  cv::AutoLock lock(m_mutex);
+  return m_kernels.size();
+}
+
+size_t gabor::KernelCache::bytes()
+{
+  cv::AutoLock lock(m_mutex);
+  return m_bytes;
+}
+
+gabor::KernelCache& gabor::KernelCache::shared()
+{
+  static KernelCache cache;
+  return cache;
+}
+
 void gabor_adaptiveFilterXY(cv::Mat data, cv::Mat fr, cv::Mat fi,
                             const double wx, const double wy,
                             const int x, const int y)
@@ -186,61 +168,298 @@ void gabor_adaptiveFilterXY(cv::Mat data, cv::Mat fr, cv::Mat fi,
   gen_gaborKernel(hxr, hxi, wx, sx, data.type());
   gen_gaborKernel(hyr, hyi, wy, sy, data.type());
 
-  if(data.type()==CV_32F){
-    fr.at<float>(y,x)=convolutionAtXY<float>(data, hxr, hyr, x, y) -
-        convolutionAtXY<float>(data, hxi, hyi, x, y);
-    fi.at<float>(y,x)=convolutionAtXY<float>(data, hxr, hyi, x, y) +
-        convolutionAtXY<float>(data, hxi, hyr, x, y);
+  if(data.type()==CV_32F)
+    gaborAtXY<float>(data, hxr, hxi, hyr, hyi, x, y, fr.at<float>(y,x),
+                     fi.at<float>(y,x));
+  else if(data.type()==CV_64F)
+    gaborAtXY<double>(data, hxr, hxi, hyr, hyi, x, y, fr.at<double>(y,x),
+                      fi.at<double>(y,x));
+}
+
+namespace{
+
+/**
+ * Horizontal pass of gabor_filter over a range of rows.
+ */
+class GaborRowPass: public cv::ParallelLoopBody
+{
+public:
+  GaborRowPass(const cv::Mat& data, const cv::Mat& hxr, const cv::Mat& hxi,
+               cv::Mat& rr, cv::Mat& ri)
+  :m_data(data), m_hxr(hxr), m_hxi(hxi), m_rr(rr), m_ri(ri)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    cv::Mat rr=m_rr, ri=m_ri;
+    if(m_data.type()==CV_32F)
+      sgaborRows(m_data.ptr<float>(), m_hxr.ptr<float>(), m_hxi.ptr<float>(),
+                 rr.ptr<float>(), ri.ptr<float>(), r.start, r.end,
+                 m_data.cols, m_hxr.cols/2);
+    else
+      dgaborRows(m_data.ptr<double>(), m_hxr.ptr<double>(),
+                 m_hxi.ptr<double>(), rr.ptr<double>(), ri.ptr<double>(),
+                 r.start, r.end, m_data.cols, m_hxr.cols/2);
   }
-  else if(data.type()==CV_64F){
-    fr.at<double>(y,x)=convolutionAtXY<double>(data, hxr, hyr, x, y) -
-        convolutionAtXY<double>(data, hxi, hyi, x, y);
-    fi.at<double>(y,x)=convolutionAtXY<double>(data, hxr, hyi, x, y) +
-        convolutionAtXY<double>(data, hxi, hyr, x, y);
+
+private:
+  cv::Mat m_data, m_hxr, m_hxi, m_rr, m_ri;
+};
+
+/**
+ * Vertical pass of gabor_filter over a range of output rows.
+ */
+class GaborColPass: public cv::ParallelLoopBody
+{
+public:
+  GaborColPass(const cv::Mat& rr, const cv::Mat& ri, const cv::Mat& hyr,
+               const cv::Mat& hyi, cv::Mat& fr, cv::Mat& fi)
+  :m_rr(rr), m_ri(ri), m_hyr(hyr), m_hyi(hyi), m_fr(fr), m_fi(fi)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    cv::Mat fr=m_fr, fi=m_fi;
+    if(m_rr.type()==CV_32F)
+      sgaborCols(m_rr.ptr<float>(), m_ri.ptr<float>(), m_hyr.ptr<float>(),
+                 m_hyi.ptr<float>(), fr.ptr<float>(), fi.ptr<float>(),
+                 r.start, r.end, m_rr.rows, m_rr.cols, m_hyr.cols/2);
+    else
+      dgaborCols(m_rr.ptr<double>(), m_ri.ptr<double>(), m_hyr.ptr<double>(),
+                 m_hyi.ptr<double>(), fr.ptr<double>(), fi.ptr<double>(),
+                 r.start, r.end, m_rr.rows, m_rr.cols, m_hyr.cols/2);
   }
+
+private:
+  cv::Mat m_rr, m_ri, m_hyr, m_hyi, m_fr, m_fi;
+};
+
 }
 
-void gabor_filter(cv::Mat data, cv::Mat fr, cv::Mat fi,
-                  const double wx, const double wy)
+namespace{
+
+/** Half size of the largest kernel generated by gabor_filter */
+const int MAX_KERNEL_HALFSIZE=66;
+
+void gabor_kernels(const double wx, const double wy, const int type,
+                   cv::Mat& hxr, cv::Mat& hxi, cv::Mat& hyr, cv::Mat& hyi)
 {
-  cv::Mat hxr, hxi, hyr, hyi;
-  cv::Mat tmp1(data.rows, data.cols, data.type());
-  cv::Mat tmp2(data.rows, data.cols, data.type());
   double sx = fabs(1.5708/wx), sy = fabs(1.5708/wy);
 
   sx = sx>22? 22:(sx<1? 1:sx);
   sy = sy>22? 22:(sy<1? 1:sy);
-  gen_gaborKernel(hxr, hxi, wx, sx, data.type());
-  gen_gaborKernel(hyr, hyi, wy, sy, data.type());
+  gen_gaborKernel(hxr, hxi, wx, sx, type);
+  gen_gaborKernel(hyr, hyi, wy, sy, type);
+}
 
-  if(data.type()==CV_32F){
-    sconvolution(data.ptr<float>(), hxr.ptr<float>(), hyr.ptr<float>(),
-                 tmp1.ptr<float>(), data.rows, data.cols, hyr.cols, hxr.cols);
-    sconvolution(data.ptr<float>(), hxi.ptr<float>(), hyi.ptr<float>(),
-                 tmp2.ptr<float>(), data.rows, data.cols, hyi.cols, hxi.cols);
-    fr = tmp1 - tmp2;
-    sconvolution(data.ptr<float>(), hxr.ptr<float>(), hyi.ptr<float>(),
-                 tmp1.ptr<float>(), data.rows, data.cols, hyi.cols, hxr.cols);
-    sconvolution(data.ptr<float>(), hxi.ptr<float>(), hyr.ptr<float>(),
-                 tmp2.ptr<float>(), data.rows, data.cols, hyr.cols, hxi.cols);
-    fi = tmp1 + tmp2;
+/**
+ * Tells if the FFT method is expected to be faster than the direct one.
+ *
+ * The direct method costs a dual dot product per row tap and four
+ * multiply-adds per column tap at every pixel. The FFT method costs an
+ * inverse complex transform of the padded data, plus the forward
+ * transform if the spectrum is not available yet.
+ */
+bool fft_isFaster(const int rows, const int cols, const int KX, const int KY,
+                  const bool haveSpectrum)
+{
+  const double P = cv::getOptimalDFTSize(rows + MAX_KERNEL_HALFSIZE);
+  const double Q = cv::getOptimalDFTSize(cols + MAX_KERNEL_HALFSIZE);
+  const double direct = (double)rows*cols*(4.0*KX + 8.0*KY);
+  const double lg = log(P*Q)/log(2.0);
+  double fft = 5*P*Q*lg + 12*P*Q;
+  if(!haveSpectrum)
+    fft+= 2.5*P*Q*lg;
+  return fft<direct;
+}
+
+/**
+ * Spectrum of a one-dimensional kernel padded to length L.
+ *
+ * The tap j of the kernel is placed at (L-j) mod L, so the product with
+ * the spectrum of the data gives the correlation computed by the direct
+ * method.
+ */
+template<typename T>
+cv::Mat kernel_spectrum(const cv::Mat& hr, const cv::Mat& hi, const int L)
+{
+  const int k=hr.cols/2;
+  cv::Mat h = cv::Mat::zeros(1, L, CV_MAKETYPE(cv::DataType<T>::depth, 2));
+  T* p = h.ptr<T>();
+  for(int j=-k; j<=k; j++){
+    const int l = (L-j)%L;
+    p[2*l]  = hr.at<T>(0, k+j);
+    p[2*l+1]= hi.at<T>(0, k+j);
+  }
+  cv::Mat H;
+  cv::dft(h, H);
+  return H;
+}
+
+/**
+ * Multiplies the data spectrum by the separable kernel spectrum Hy Hx.
+ */
+template<typename T>
+void mul_separable(const cv::Mat& D, const cv::Mat& Hx, const cv::Mat& Hy,
+                   cv::Mat& R)
+{
+  const T* hx = Hx.ptr<T>();
+  const T* hy = Hy.ptr<T>();
+  for(int u=0; u<D.rows; u++){
+    const T* d = D.ptr<T>(u);
+    T* r = R.ptr<T>(u);
+    const T ar = hy[2*u], ai = hy[2*u+1];
+    for(int v=0; v<D.cols; v++){
+      const T kr = ar*hx[2*v] - ai*hx[2*v+1];
+      const T ki = ar*hx[2*v+1] + ai*hx[2*v];
+      const T dr = d[2*v], di = d[2*v+1];
+      r[2*v]   = dr*kr - di*ki;
+      r[2*v+1] = dr*ki + di*kr;
+    }
   }
-  else if(data.type()==CV_64F){
-    dconvolution(data.ptr<double>(), hxr.ptr<double>(), hyr.ptr<double>(),
-                 tmp1.ptr<double>(), data.rows, data.cols, hyr.cols, hxr.cols);
-    dconvolution(data.ptr<double>(), hxi.ptr<double>(), hyi.ptr<double>(),
-                 tmp2.ptr<double>(), data.rows, data.cols, hyi.cols, hxi.cols);
-    fr = tmp1 - tmp2;
-    dconvolution(data.ptr<double>(), hxr.ptr<double>(), hyi.ptr<double>(),
-                 tmp1.ptr<double>(), data.rows, data.cols, hyi.cols, hxr.cols);
-    dconvolution(data.ptr<double>(), hxi.ptr<double>(), hyr.ptr<double>(),
-                 tmp2.ptr<double>(), data.rows, data.cols, hyr.cols, hxi.cols);
-    fi = tmp1 + tmp2;
+}
+
+void gabor_filterDirect(cv::Mat data, cv::Mat fr, cv::Mat fi,
+                        const cv::Mat& hxr, const cv::Mat& hxi,
+                        const cv::Mat& hyr, const cv::Mat& hyi)
+{
+  // The rows are filtered first into an intermediate complex image, then
+  // its columns. Each pass costs a kernel length per pixel and the rows
+  // of each pass are split between threads.
+  cv::Mat rr(data.rows, data.cols, data.type());
+  cv::Mat ri(data.rows, data.cols, data.type());
+
+  cv::parallel_for_(cv::Range(0, data.rows),
+                    GaborRowPass(data, hxr, hxi, rr, ri));
+  cv::parallel_for_(cv::Range(0, data.rows),
+                    GaborColPass(rr, ri, hyr, hyi, fr, fi));
+}
+
+}
+
+void gabor_filter(cv::Mat data, cv::Mat fr, cv::Mat fi,
+                  const double wx, const double wy, const int method)
+{
+  if(data.type()!=CV_32F && data.type()!=CV_64F)
+    return;
+
+  if(method!=GABOR_DIRECT){
+    gabor::FilterBank bank(data);
+    bank.setMethod(method);
+    bank(fr, fi, wx, wy);
+    return;
   }
+
+  cv::Mat hxr, hxi, hyr, hyi;
+  CV_Assert(fr.rows==data.rows && fr.cols==data.cols &&
+            fr.type()==data.type());
+  CV_Assert(fi.rows==data.rows && fi.cols==data.cols &&
+            fi.type()==data.type());
+  gabor_kernels(wx, wy, data.type(), hxr, hxi, hyr, hyi);
+  gabor_filterDirect(data, fr, fi, hxr, hxi, hyr, hyi);
 }
 
-cv::Vec2d peak_freqXY(const cv::Mat fx, const cv::Mat fy, cv::Mat visited,
-                      const int x, const int y)
+gabor::FilterBank::FilterBank()
+:m_method(GABOR_DIRECT)
+{
+}
+
+gabor::FilterBank::FilterBank(cv::Mat data)
+:m_data(data), m_method(GABOR_DIRECT)
+{
+}
+
+gabor::FilterBank& gabor::FilterBank::setData(cv::Mat data)
+{
+  m_data=data;
+  m_spectrum.release();
+  return *this;
+}
+
+gabor::FilterBank& gabor::FilterBank::setMethod(const int method)
+{
+  m_method=method;
+  return *this;
+}
+
+int gabor::FilterBank::getMethod() const
+{
+  return m_method;
+}
+
+void gabor::FilterBank::operator()(cv::Mat fr, cv::Mat fi, const double wx,
+                                   const double wy)
+{
+  if(m_data.type()!=CV_32F && m_data.type()!=CV_64F)
+    return;
+
+  CV_Assert(fr.rows==m_data.rows && fr.cols==m_data.cols &&
+            fr.type()==m_data.type());
+  CV_Assert(fi.rows==m_data.rows && fi.cols==m_data.cols &&
+            fi.type()==m_data.type());
+  cv::Mat hxr, hxi, hyr, hyi;
+  gabor_kernels(wx, wy, m_data.type(), hxr, hxi, hyr, hyi);
+
+  bool fft = m_method==GABOR_FFT;
+  if(m_method==GABOR_AUTO)
+    fft = fft_isFaster(m_data.rows, m_data.cols, hxr.cols, hyr.cols,
+                       !m_spectrum.empty());
+  if(fft)
+    filterFFT(fr, fi, hxr, hxi, hyr, hyi);
+  else
+    gabor_filterDirect(m_data, fr, fi, hxr, hxi, hyr, hyi);
+}
+
+void gabor::FilterBank::filterFFT(cv::Mat fr, cv::Mat fi,
+                                  const cv::Mat& hxr, const cv::Mat& hxi,
+                                  const cv::Mat& hyr, const cv::Mat& hyi)
+{
+  const int M=m_data.rows, N=m_data.cols;
+  if(m_spectrum.empty()){
+    // The zero padding must hold the largest kernel so the circular
+    // convolution does not wrap the data.
+    const int P = cv::getOptimalDFTSize(M + MAX_KERNEL_HALFSIZE);
+    const int Q = cv::getOptimalDFTSize(N + MAX_KERNEL_HALFSIZE);
+    cv::Mat padded = cv::Mat::zeros(P, Q, m_data.type());
+    m_data.copyTo(padded(cv::Rect(0, 0, N, M)));
+    cv::dft(padded, m_spectrum, cv::DFT_COMPLEX_OUTPUT);
+  }
+
+  const int P=m_spectrum.rows, Q=m_spectrum.cols;
+  cv::Mat R(P, Q, m_spectrum.type()), out;
+  if(m_data.type()==CV_32F)
+    mul_separable<float>(m_spectrum, kernel_spectrum<float>(hxr, hxi, Q),
+                         kernel_spectrum<float>(hyr, hyi, P), R);
+  else
+    mul_separable<double>(m_spectrum, kernel_spectrum<double>(hxr, hxi, Q),
+                          kernel_spectrum<double>(hyr, hyi, P), R);
+  cv::idft(R, out, cv::DFT_SCALE);
+
+  cv::Mat parts[2];
+  cv::split(out(cv::Rect(0, 0, N, M)), parts);
+  parts[0].copyTo(fr);
+  parts[1].copyTo(fi);
+}
+
+namespace{
+
+/** Reads a label field stored in an 8-bit matrix */
+class MatLabels{
+public:
+  explicit MatLabels(const cv::Mat& labels)
+  :m_labels(labels)
+  {}
+  bool operator()(const int i, const int j) const
+  {
+    return m_labels.at<uchar>(i,j)!=0;
+  }
+private:
+  const cv::Mat& m_labels;
+};
+
+template<typename T, typename Labels>
+cv::Vec2d peak_freqXY_(const cv::Mat& fx, const cv::Mat& fy,
+                       const Labels& visited, const int x, const int y)
 {
   const int N=9;
   cv::Vec2d freqs=0;
@@ -249,9 +468,9 @@ cv::Vec2d peak_freqXY(const cv::Mat fx, const cv::Mat fy, cv::Mat visited,
   for(int i=y-N/2; i<=y+N/2; i++)
     for(int j=x-N/2; j<=x+N/2; j++){
       if(j>=0 && j<fx.cols && i>=0 && i<fx.rows)
-        if(visited.at<char>(i,j)){
-          freqs[0]+=fx.at<double>(i,j);
-          freqs[1]+=fy.at<double>(i,j);
+        if(visited(i,j)){
+          freqs[0]+=fx.at<T>(i,j);
+          freqs[1]+=fy.at<T>(i,j);
           cont++;
         }
     }
@@ -260,22 +479,45 @@ cv::Vec2d peak_freqXY(const cv::Mat fx, const cv::Mat fy, cv::Mat visited,
   freqs[1]=cont>=0? freqs[1]/cont:0;
 
   return freqs;
+}
+
+}
+
+cv::Vec2d peak_freqXY(const cv::Mat fx, const cv::Mat fy,
+                      const BitImage& visited, const int x, const int y)
+{
+  if(fx.type()==CV_32F)
+    return peak_freqXY_<float>(fx, fy, visited, x, y);
+  return peak_freqXY_<double>(fx, fy, visited, x, y);
+}
 
+cv::Vec2d peak_freqXY(const cv::Mat fx, const cv::Mat fy, cv::Mat visited,
+                      const int x, const int y)
+{
+  // Only the window is read, the field is not converted
+  CV_Assert(visited.channels()==1 && visited.elemSize()==1);
+  const MatLabels labels(visited);
+  if(fx.type()==CV_32F)
+    return peak_freqXY_<float>(fx, fy, labels, x, y);
+  return peak_freqXY_<double>(fx, fy, labels, x, y);
 }
 
 gabor::FilterXY::FilterXY()
 {
   m_kernelN=7;
+  m_cache=NULL;
 }
 
 gabor::FilterXY::FilterXY(cv::Mat dat, cv::Mat fre, cv::Mat fim)
 :data(dat), fr(fre), fi(fim)
 {
   m_kernelN=7;
+  m_cache=NULL;
 }
 
 gabor::FilterXY::FilterXY(const gabor::FilterXY& cpy)
-:data(cpy.data), fr(cpy.fr), fi(cpy.fi), m_kernelN(cpy.m_kernelN)
+:data(cpy.data), fr(cpy.fr), fi(cpy.fi), m_kernelN(cpy.m_kernelN),
+ m_cache(cpy.m_cache)
 {
 }
 
@@ -295,21 +537,21 @@ void gabor::FilterXY::operator()(const double wx, const double wy, const int x,
   sx = sx>m_kernelN? m_kernelN:(sx<1? 1:sx);
   sy = sy>m_kernelN? m_kernelN:(sy<1? 1:sy);
 
-  gen_gaborKernel(hxr, hxi, wx, sx, data.type());
-  gen_gaborKernel(hyr, hyi, wy, sy, data.type());
-
-  if(data.type()==CV_32F){
-    fr.at<float>(y,x)=convolutionAtXY<float>(data, hxr, hyr, x, y) -
-        convolutionAtXY<float>(data, hxi, hyi, x, y);
-    fi.at<float>(y,x)=convolutionAtXY<float>(data, hxr, hyi, x, y) +
-        convolutionAtXY<float>(data, hxi, hyr, x, y);
+  if(m_cache!=NULL){
+    m_cache->get(hxr, hxi, wx, sx, data.type());
+    m_cache->get(hyr, hyi, wy, sy, data.type());
   }
-  else if(data.type()==CV_64F){
-    fr.at<double>(y,x)=convolutionAtXY<double>(data, hxr, hyr, x, y) -
-        convolutionAtXY<double>(data, hxi, hyi, x, y);
-    fi.at<double>(y,x)=convolutionAtXY<double>(data, hxr, hyi, x, y) +
-        convolutionAtXY<double>(data, hxi, hyr, x, y);
+  else{
+    gen_gaborKernel(hxr, hxi, wx, sx, data.type());
+    gen_gaborKernel(hyr, hyi, wy, sy, data.type());
   }
+
+  if(data.type()==CV_32F)
+    gaborAtXY<float>(data, hxr, hxi, hyr, hyi, x, y, fr.at<float>(y,x),
+                     fi.at<float>(y,x));
+  else if(data.type()==CV_64F)
+    gaborAtXY<double>(data, hxr, hxi, hyr, hyi, x, y, fr.at<double>(y,x),
+                      fi.at<double>(y,x));
 }
 
 gabor::FilterXY& gabor::FilterXY::setKernelSize(double size)
@@ -318,6 +560,12 @@ gabor::FilterXY& gabor::FilterXY::setKernelSize(double size)
   return *this;
 }
 
+gabor::FilterXY& gabor::FilterXY::setKernelCache(KernelCache* cache)
+{
+  m_cache=cache;
+  return *this;
+}
+
 
 gabor::FilterNeighbor::FilterNeighbor(cv::Mat param_I, cv::Mat param_fr,
                                       cv::Mat param_fi)
@@ -345,61 +593,246 @@ gabor::FilterNeighbor& gabor::FilterNeighbor::setKernelSize(double size)
   return *this;
 }
 
-gabor::DemodPixel::DemodPixel(cv::Mat parm_I, cv::Mat parm_fr,
-                              cv::Mat parm_fi, cv::Mat parm_fx,
-                              cv::Mat parm_fy, cv::Mat parm_visited)
+gabor::FilterNeighbor& gabor::FilterNeighbor::
+  setKernelCache(KernelCache* cache)
+{
+  m_localFilter.setKernelCache(cache);
+  return *this;
+}
+
+namespace{
+
+template<typename T>
+void freqSums_fill(const cv::Mat& fx, const cv::Mat& fy,
+                   const BitImage& visited, std::vector<double>& vx,
+                   std::vector<double>& vy, std::vector<int>& vc)
+{
+  for(int i=0; i<fx.rows; i++)
+    for(int j=0; j<fx.cols; j++)
+      if(visited(i,j)){
+        vx[i*fx.cols + j]=fx.at<T>(i,j);
+        vy[i*fx.cols + j]=fy.at<T>(i,j);
+        vc[i*fx.cols + j]=1;
+      }
+}
+
+}
+
+gabor::FreqSums::FreqSums()
+:M(0), N(0), m_blocksX(0)
+{
+}
+
+gabor::FreqSums::FreqSums(const cv::Mat fx, const cv::Mat fy,
+                          const BitImage& visited)
+:M(fx.rows), N(fx.cols), m_blocksX((fx.cols+BLOCK-1)/BLOCK)
+{
+  const int blocksY=(M+BLOCK-1)/BLOCK;
+  const size_t size=(size_t)blocksY*m_blocksX*BLOCK*BLOCK;
+  m_fx.assign(size, 0.f);
+  m_fy.assign(size, 0.f);
+  m_count.assign(size, 0);
+
+  std::vector<double> vx(M*N, 0), vy(M*N, 0);
+  std::vector<int> vc(M*N, 0);
+  if(fx.type()==CV_32F)
+    freqSums_fill<float>(fx, fy, visited, vx, vy, vc);
+  else
+    freqSums_fill<double>(fx, fy, visited, vx, vy, vc);
+
+  // The summed-area table of each block, accumulated in double precision
+  std::vector<double> cx(BLOCK), cy(BLOCK);
+  std::vector<int> cc(BLOCK);
+  for(int by=0; by<blocksY; by++)
+    for(int bx=0; bx<m_blocksX; bx++){
+      std::fill(cx.begin(), cx.end(), 0.0);
+      std::fill(cy.begin(), cy.end(), 0.0);
+      std::fill(cc.begin(), cc.end(), 0);
+      for(int u=0; u<BLOCK && by*BLOCK+u<M; u++){
+        const int i=by*BLOCK + u;
+        double rx=0, ry=0;
+        int rc=0;
+        for(int v=0; v<BLOCK; v++){
+          const int j=bx*BLOCK + v;
+          if(j<N){
+            rx+=vx[i*N + j];
+            ry+=vy[i*N + j];
+            rc+=vc[i*N + j];
+          }
+          cx[v]+=rx;
+          cy[v]+=ry;
+          cc[v]+=rc;
+          const size_t k=index(i, j);
+          m_fx[k]=(float)cx[v];
+          m_fy[k]=(float)cy[v];
+          m_count[k]=(uchar)cc[v];
+        }
+      }
+    }
+}
+
+size_t gabor::FreqSums::index(const int i, const int j) const
+{
+  const size_t block=(size_t)(i/BLOCK)*m_blocksX + j/BLOCK;
+  return (block*BLOCK + i%BLOCK)*BLOCK + j%BLOCK;
+}
+
+void gabor::FreqSums::add(const int i, const int j, const double fx,
+                          const double fy, const int count)
+{
+  // The entries of the block below and to the right of (i,j)
+  const int u0=i%BLOCK, v0=j%BLOCK;
+  const size_t base=index(i, j) - u0*BLOCK - v0;
+  const float dx=(float)fx, dy=(float)fy;
+  for(int u=u0; u<BLOCK; u++){
+    const size_t row=base + u*BLOCK;
+    for(int v=v0; v<BLOCK; v++){
+      m_fx[row + v]+= dx;
+      m_fy[row + v]+= dy;
+      m_count[row + v]+= count;
+    }
+  }
+}
+
+void gabor::FreqSums::insert(const int i, const int j, const double fx,
+                             const double fy)
+{
+  add(i, j, fx, fy, 1);
+}
+
+void gabor::FreqSums::update(const int i, const int j, const double dfx,
+                             const double dfy)
+{
+  add(i, j, dfx, dfy, 0);
+}
+
+void gabor::FreqSums::blockSum(const int i0, const int j0, const int i1,
+                               const int j1, double& sx, double& sy,
+                               int& count) const
+{
+  const bool top=i0%BLOCK>0, left=j0%BLOCK>0;
+  size_t k=index(i1, j1);
+  sx+=m_fx[k];
+  sy+=m_fy[k];
+  count+=m_count[k];
+  if(top){
+    k=index(i0-1, j1);
+    sx-=m_fx[k];
+    sy-=m_fy[k];
+    count-=m_count[k];
+  }
+  if(left){
+    k=index(i1, j0-1);
+    sx-=m_fx[k];
+    sy-=m_fy[k];
+    count-=m_count[k];
+  }
+  if(top && left){
+    k=index(i0-1, j0-1);
+    sx+=m_fx[k];
+    sy+=m_fy[k];
+    count+=m_count[k];
+  }
+}
+
+int gabor::FreqSums::sum(const int i, const int j, const int size,
+                         cv::Vec2d& sums) const
+{
+  const int top = std::max(i-size/2, 0);
+  const int left = std::max(j-size/2, 0);
+  const int bottom = std::min(i+size/2, M-1);
+  const int right = std::min(j+size/2, N-1);
+
+  double sx=0, sy=0;
+  int count=0;
+  for(int y=top; y<=bottom; y=(y/BLOCK+1)*BLOCK){
+    const int y1=std::min((y/BLOCK+1)*BLOCK-1, bottom);
+    for(int x=left; x<=right; x=(x/BLOCK+1)*BLOCK){
+      const int x1=std::min((x/BLOCK+1)*BLOCK-1, right);
+      blockSum(y, x, y1, x1, sx, sy, count);
+    }
+  }
+  sums[0]=sx;
+  sums[1]=sy;
+  return count;
+}
+
+template<typename T>
+gabor::DemodPixel<T>::DemodPixel(cv::Mat parm_I, cv::Mat parm_fr,
+                                 cv::Mat parm_fi, cv::Mat parm_fx,
+                                 cv::Mat parm_fy, BitImage parm_visited)
 :m_filter(parm_I, parm_fr, parm_fi), m_calcfreq(parm_fr, parm_fi),
- fx(parm_fx), fy(parm_fy), visited(parm_visited), m_tau(0.15), 
-  m_combFreqs(false), m_combN(7)
+ fx(parm_fx), fy(parm_fy), visited(parm_visited), m_sums(NULL),
+ m_tau(0.15), m_combFreqs(false), m_combN(7)
 {
   m_iters=1;
 }
 
-gabor::DemodPixel& gabor::DemodPixel::setKernelSize(const double size)
+template<typename T>
+gabor::DemodPixel<T>& gabor::DemodPixel<T>::setKernelSize(const double size)
 {
   m_filter.setKernelSize(size);
   return *this;
 }
 
-gabor::DemodPixel& gabor::DemodPixel::setTau(const double tau)
+template<typename T>
+gabor::DemodPixel<T>& gabor::DemodPixel<T>::setKernelCache(KernelCache* cache)
+{
+  m_filter.setKernelCache(cache);
+  return *this;
+}
+
+template<typename T>
+gabor::DemodPixel<T>& gabor::DemodPixel<T>::setTau(const double tau)
 {
   m_tau=tau;
   return *this;
 }
 
-gabor::DemodPixel& gabor::DemodPixel::setMaxFq(const double w)
+template<typename T>
+gabor::DemodPixel<T>& gabor::DemodPixel<T>::setMaxFq(const double w)
 {
   m_calcfreq.setMaxFq(w);
   return *this;
 }
 
-gabor::DemodPixel& gabor::DemodPixel::setMinFq(const double w)
+template<typename T>
+gabor::DemodPixel<T>& gabor::DemodPixel<T>::setMinFq(const double w)
 {
   m_calcfreq.setMinFq(w);
   return *this;
 }
 
-void gabor::DemodPixel::operator()(const int i, const int j)
+template<typename T>
+void gabor::DemodPixel<T>::operator()(const int i, const int j)
 {
   cv::Vec2d freqs, freq;
 
-  freqs= peak_freqXY(fx, fy, visited, j, i);
-  visited.at<char>(i,j)=1;
+  if(m_sums!=NULL){
+    const int cont = m_sums->sum(i, j, 9, freqs);
+    freqs[0]=cont>=0? freqs[0]/cont:0;
+    freqs[1]=cont>=0? freqs[1]/cont:0;
+    if(!visited(i,j))
+      m_sums->insert(i, j, fx.at<T>(i,j), fy.at<T>(i,j));
+  }
+  else
+    freqs= peak_freqXY_<T>(fx, fy, visited, j, i);
+  visited.set(i,j);
 
   for(int iter=0; iter<m_iters; iter++){
     m_filter(freqs[0], freqs[1], i, j);
     freq = m_calcfreq(j, i);
     freq = (!m_calcfreq.changed())? freq:0.;
     freq = m_tau*freq + (1-m_tau)*freqs;
-    fx.at<double>(i,j)=freq[0];
-    fy.at<double>(i,j)=freq[1];
+    setFreqs(i, j, freq);
     if(m_combFreqs)
       freq = combFreq(freq,i,j);
   }
 }
 
-cv::Vec2d gabor::DemodPixel::combFreq(cv::Vec2d freqs, 
-				      const int i, const int j)
+template<typename T>
+cv::Vec2d gabor::DemodPixel<T>::combFreq(cv::Vec2d freqs,
+                                         const int i, const int j)
 {
   const int N = m_combN;
   const float p=0.3;//Probabilidad de cambio
@@ -409,8 +842,8 @@ cv::Vec2d gabor::DemodPixel::combFreq(cv::Vec2d freqs,
   for(int m=i-N/2; m<=i+N/2; m++)
     for(int n=j-N/2; n<=j+N/2; n++)
       if(n>=0 && n<fx.cols && m>=0 && m<fx.rows)
-        if(visited.at<char>(m,n)){
-          sum1=freqs[0]*fx.at<double>(m,n) + freqs[1]*fy.at<double>(m,n);
+        if(visited(m,n)){
+          sum1=freqs[0]*fx.at<T>(m,n) + freqs[1]*fy.at<T>(m,n);
           cont++;
           right+= (sum1>=0? 1:0);
         }
@@ -421,97 +854,130 @@ cv::Vec2d gabor::DemodPixel::combFreq(cv::Vec2d freqs,
     freqs[1]=0;
     cont=0;
 
-    for(int m=i-N/2; m<=i+N/2; m++)
-      for(int n=j-N/2; n<=j+N/2; n++)
-        if(n>=0 && n<fx.cols && m>=0 && m<fx.rows)
-          if(visited.at<char>(m,n)){
-            freqs[0]+=fx.at<double>(m,n);
-            freqs[1]+=fy.at<double>(m,n);
-            cont++;
-          }
+    if(m_sums!=NULL)
+      cont = m_sums->sum(i, j, N, freqs);
+    else
+      for(int m=i-N/2; m<=i+N/2; m++)
+        for(int n=j-N/2; n<=j+N/2; n++)
+          if(n>=0 && n<fx.cols && m>=0 && m<fx.rows)
+            if(visited(m,n)){
+              freqs[0]+=fx.at<T>(m,n);
+              freqs[1]+=fy.at<T>(m,n);
+              cont++;
+            }
     freqs[0]/=cont>0? cont:1;
     freqs[1]/=cont>0? cont:1;
   }
   return freqs;
 }
 
-gabor::DemodPixel& gabor::DemodPixel::setCombFreqs(bool flag)
+template<typename T>
+void gabor::DemodPixel<T>::setFreqs(const int i, const int j,
+                                    const cv::Vec2d freqs)
+{
+  const T wx=freqs[0], wy=freqs[1];
+  if(m_sums!=NULL)
+    m_sums->update(i, j, wx-fx.at<T>(i,j), wy-fy.at<T>(i,j));
+  fx.at<T>(i,j)=wx;
+  fy.at<T>(i,j)=wy;
+}
+
+template<typename T>
+gabor::DemodPixel<T>& gabor::DemodPixel<T>::setFreqSums(FreqSums* sums)
+{
+  m_sums=sums;
+  return *this;
+}
+
+template<typename T>
+gabor::DemodPixel<T>& gabor::DemodPixel<T>::setCombFreqs(bool flag)
 {
   m_combFreqs=flag;
   return *this;
 }
 
-gabor::DemodPixel& gabor::DemodPixel::setCombNsize(const int Nsize)
+template<typename T>
+gabor::DemodPixel<T>& gabor::DemodPixel<T>::setCombNsize(const int Nsize)
 {
   m_combN=Nsize;
   return *this;
 }
 
-gabor::DemodSeed::DemodSeed(cv::Mat parm_I, cv::Mat parm_fr, cv::Mat parm_fi,
-                            cv::Mat parm_fx, cv::Mat parm_fy, cv::Mat
-                            parm_visited)
-:DemodPixel(parm_I, parm_fr, parm_fi, parm_fx, parm_fy, parm_visited)
+template<typename T>
+gabor::DemodSeed<T>::DemodSeed(cv::Mat parm_I, cv::Mat parm_fr,
+                               cv::Mat parm_fi, cv::Mat parm_fx,
+                               cv::Mat parm_fy, BitImage parm_visited)
+:DemodPixel<T>(parm_I, parm_fr, parm_fi, parm_fx, parm_fy, parm_visited)
 {
-  m_iters=1;
+  this->m_iters=1;
 }
 
-gabor::DemodPixel& gabor::DemodPixel::setIters(const int iters)
+template<typename T>
+gabor::DemodPixel<T>& gabor::DemodPixel<T>::setIters(const int iters)
 {
   m_iters=iters;
   return *this;
 }
 
-void gabor::DemodSeed::operator()(cv::Vec2d freqs, const int i, const int j)
+template<typename T>
+void gabor::DemodSeed<T>::operator()(cv::Vec2d freqs, const int i,
+                                     const int j)
 {
-  for(int iter=0; iter<m_iters; iter++){
-    m_filter(freqs[0], freqs[1], i,j);
-    freqs = m_calcfreq(j, i);
+  for(int iter=0; iter<this->m_iters; iter++){
+    this->m_filter(freqs[0], freqs[1], i,j);
+    freqs = this->m_calcfreq(j, i);
   }
-  fx.at<double>(i,j)=freqs[0];
-  fy.at<double>(i,j)=freqs[1];
-  visited.at<char>(i,j)=1;
+  if(this->m_sums!=NULL && !this->visited(i,j))
+    this->m_sums->insert(i, j, this->fx.template at<T>(i,j),
+                         this->fy.template at<T>(i,j));
+  this->visited.set(i,j);
+  this->setFreqs(i, j, freqs);
 }
 
-gabor::CalcFreqXY::CalcFreqXY(cv::Mat param_fr, cv::Mat param_fi)
+template<typename T>
+gabor::CalcFreqXY<T>::CalcFreqXY(cv::Mat param_fr, cv::Mat param_fi)
 : fr(param_fr), fi(param_fi)
 {
   m_maxf=M_PI/2;
   m_minf=0.1;
 }
 
-gabor::CalcFreqXY& gabor::CalcFreqXY::setMaxFq(const double w)
+template<typename T>
+gabor::CalcFreqXY<T>& gabor::CalcFreqXY<T>::setMaxFq(const double w)
 {
   m_maxf=w;
   return *this;
 }
 
-gabor::CalcFreqXY& gabor::CalcFreqXY::setMinFq(const double w)
+template<typename T>
+gabor::CalcFreqXY<T>& gabor::CalcFreqXY<T>::setMinFq(const double w)
 {
   m_minf=w;
   return *this;
 }
 
-cv::Vec2d gabor::CalcFreqXY::operator()(const int x, const int y)
+template<typename T>
+cv::Vec2d gabor::CalcFreqXY<T>::operator()(const int x, const int y)
 {
   cv::Vec2d freqs;
-  double imx = x-1>=0? (fi.at<double>(y,x)-fi.at<double>(y,x-1)):
-                       (fi.at<double>(y,x+1)-fi.at<double>(y,x));
-  double rex = x-1>=0? (fr.at<double>(y,x)-fr.at<double>(y,x-1)):
-                       (fr.at<double>(y,x+1)-fr.at<double>(y,x));
-  double magn = fr.at<double>(y,x)*fr.at<double>(y,x) +
-      fi.at<double>(y,x)*fi.at<double>(y,x);
+  double imx = x-1>=0? (fi.at<T>(y,x)-fi.at<T>(y,x-1)):
+                       (fi.at<T>(y,x+1)-fi.at<T>(y,x));
+  double rex = x-1>=0? (fr.at<T>(y,x)-fr.at<T>(y,x-1)):
+                       (fr.at<T>(y,x+1)-fr.at<T>(y,x));
+  double magn = fr.at<T>(y,x)*fr.at<T>(y,x) +
+      fi.at<T>(y,x)*fi.at<T>(y,x);
 
   if(magn<0.0001)
     magn=0.0001; //Evitar devision entre 0
 
-  freqs[0] = (imx*fr.at<double>(y,x) - fi.at<double>(y,x)*rex)/magn;
+  freqs[0] = (imx*fr.at<T>(y,x) - fi.at<T>(y,x)*rex)/magn;
 
-  imx = y-1>=0? (fi.at<double>(y,x)-fi.at<double>(y-1,x)):
-                       (fi.at<double>(y+1,x)-fi.at<double>(y,x));
-  rex = y-1>=0? (fr.at<double>(y,x)-fr.at<double>(y-1,x)):
-                       (fr.at<double>(y+1,x)-fr.at<double>(y,x));
+  imx = y-1>=0? (fi.at<T>(y,x)-fi.at<T>(y-1,x)):
+                       (fi.at<T>(y+1,x)-fi.at<T>(y,x));
+  rex = y-1>=0? (fr.at<T>(y,x)-fr.at<T>(y-1,x)):
+                       (fr.at<T>(y+1,x)-fr.at<T>(y,x));
 
-  freqs[1] = (imx*fr.at<double>(y,x) - fi.at<double>(y,x)*rex)/magn;
+  freqs[1] = (imx*fr.at<T>(y,x) - fi.at<T>(y,x)*rex)/magn;
   m_changed=false;
 
   magn=freqs[0]*freqs[0]+freqs[1]*freqs[1];
@@ -529,93 +995,114 @@ cv::Vec2d gabor::CalcFreqXY::operator()(const int x, const int y)
   }
   return freqs;
 }
-bool gabor::CalcFreqXY::changed()
+template<typename T>
+bool gabor::CalcFreqXY<T>::changed()
 {
   return m_changed;
 }
 
-gabor::DemodNeighborhood::DemodNeighborhood(cv::Mat param_I, cv::Mat param_fr,
-                                            cv::Mat param_fi, cv::Mat param_fx,
-                                            cv::Mat param_fy,
-                                            cv::Mat param_visited)
+template<typename T>
+gabor::DemodNeighborhood<T>::DemodNeighborhood(cv::Mat param_I,
+                                               cv::Mat param_fr,
+                                               cv::Mat param_fi,
+                                               cv::Mat param_fx,
+                                               cv::Mat param_fy,
+                                               BitImage param_visited)
 :visit(param_visited),
  m_demodPixel(param_I, param_fr, param_fi, param_fx, param_fy, param_visited)
 {
 }
 
-gabor::DemodNeighborhood& gabor::DemodNeighborhood::
+template<typename T>
+gabor::DemodNeighborhood<T>& gabor::DemodNeighborhood<T>::
   setKernelSize(const double size)
 {
   m_demodPixel.setKernelSize(size);
   return *this;
 }
 
-gabor::DemodNeighborhood& gabor::DemodNeighborhood::setMaxFq(const double w)
+template<typename T>
+gabor::DemodNeighborhood<T>& gabor::DemodNeighborhood<T>::
+  setKernelCache(KernelCache* cache)
+{
+  m_demodPixel.setKernelCache(cache);
+  return *this;
+}
+
+template<typename T>
+gabor::DemodNeighborhood<T>& gabor::DemodNeighborhood<T>::
+  setMaxFq(const double w)
 {
   m_demodPixel.setMaxFq(w);
   return *this;
 }
 
-gabor::DemodNeighborhood& gabor::DemodNeighborhood::setMinFq(const double w)
+template<typename T>
+gabor::DemodNeighborhood<T>& gabor::DemodNeighborhood<T>::
+  setMinFq(const double w)
 {
   m_demodPixel.setMinFq(w);
   return *this;
 }
 
-gabor::DemodNeighborhood& gabor::DemodNeighborhood::setTau(const double tau)
+template<typename T>
+gabor::DemodNeighborhood<T>& gabor::DemodNeighborhood<T>::
+  setTau(const double tau)
 {
   m_demodPixel.setTau(tau);
   return *this;
 }
 
-gabor::DemodNeighborhood& gabor::DemodNeighborhood::setIters(const int iters)
+template<typename T>
+gabor::DemodNeighborhood<T>& gabor::DemodNeighborhood<T>::
+  setIters(const int iters)
 {
   m_demodPixel.setIters(iters);
   return *this;
 }
 
-gabor::DemodNeighborhood& gabor::DemodNeighborhood::setCombFreqs(bool flag)
+template<typename T>
+gabor::DemodNeighborhood<T>& gabor::DemodNeighborhood<T>::
+  setCombFreqs(bool flag)
 {
   m_demodPixel.setCombFreqs(flag);
   return *this;
 }
 
-gabor::DemodNeighborhood& gabor::DemodNeighborhood::setCombSize(int size)
+template<typename T>
+gabor::DemodNeighborhood<T>& gabor::DemodNeighborhood<T>::
+  setCombSize(int size)
 {
   m_demodPixel.setCombNsize(size);
   return *this;
 }
 
-void gabor::DemodNeighborhood::operator()(const int i, const int j)
+template<typename T>
+gabor::DemodNeighborhood<T>& gabor::DemodNeighborhood<T>::
+  setFreqSums(FreqSums* sums)
+{
+  m_demodPixel.setFreqSums(sums);
+  return *this;
+}
+
+template<typename T>
+void gabor::DemodNeighborhood<T>::operator()(const int i, const int j)
 {
   //if(!visit(i,j))
     m_demodPixel(i, j);
-  if(j-1>=0)
-    if(!visit(i,j-1))
-      m_demodPixel(i, j-1);
-  if(j+1<visit.cols)
-    if(!visit(i,j+1))
-      m_demodPixel(i, j+1);
-  if(i-1>=0)
-    if(!visit(i-1,j))
-      m_demodPixel(i-1, j);
-  if(i+1<visit.rows)
-    if(!visit(i+1,j))
-      m_demodPixel(i+1, j);
-  if(j-1>=0 && i-1>=0)
-    if(!visit(i-1,j-1))
-      m_demodPixel(i-1, j-1);
-  if(j+1<visit.cols && i-1>=0)
-    if(!visit(i-1,j+1))
-      m_demodPixel(i-1, j+1);
-  if(j+1<visit.cols && i+1<visit.rows)
-    if(!visit(i+1,j+1))
-      m_demodPixel(i+1, j+1);
-  if(j-1>=0 && i+1<visit.rows)
-    if(!visit(i+1,j-1))
-      m_demodPixel(i+1, j-1);
+  // Demodulating a pixel only marks that pixel, so the unvisited
+  // neighbors can be taken at once.
+  const unsigned int nb = visit.inside8(i,j) & ~visit.neighbors8(i,j);
+  for(int k=0; k<8; k++)
+    if((nb>>k)&1)
+      m_demodPixel(i+NB_DY[k], j+NB_DX[k]);
 }
 
-
-
-
+template class gabor::CalcFreqXY<float>;
+template class gabor::CalcFreqXY<double>;
+template class gabor::DemodPixel<float>;
+template class gabor::DemodPixel<double>;
+template class gabor::DemodSeed<float>;
+template class gabor::DemodSeed<double>;
+template class gabor::DemodNeighborhood<float>;
+template class gabor::DemodNeighborhood<double>;
@@ -30,6 +30,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define GABOR_GEARS
 
 #include <opencv2/core/core.hpp>
+#include <map>
+#include <list>
+#include <vector>
+#include "convolution.h"
+#include "bitimage.h"
 
 #define DEMOD_UNKNOWN_TYPE 1000
 
@@ -71,51 +76,63 @@ void gabor_adaptiveFilterXY(cv::Mat data, cv::Mat fr, cv::Mat fi,
                             const double wx, const double wy,
                             const int x, const int y);
 
+/**
+ * Methods to apply a gabor filter to a whole image.
+ */
+enum GaborFilterMethod{
+  /** Selects the fastest method from the kernel and image sizes */
+  GABOR_AUTO=0,
+  /** Separable convolution in the spatial domain */
+  GABOR_DIRECT,
+  /** Pointwise product in the Fourier domain */
+  GABOR_FFT
+};
+
 /**
  * Applies a gabor filter to whole image.
  *
+ * The direct method applies the filter in two passes, first along the
+ * rows and then along the columns, splitting the rows of each pass
+ * between threads. The FFT method multiplies the spectrum of the data by
+ * the spectrum of the kernel, it is faster for large kernels. Both give
+ * the same result up to rounding, the kernel is truncated at the borders
+ * of the data. The direct method is used unless other is requested.
+ *
+ * To filter the same data at several frequencies use gabor::FilterBank,
+ * which computes the spectrum of the data only once.
+ *
  * @param data The data matrix that is being filtered.
- * @param fr [output] The real part of the filtering.
- * @param fi [output] The imaginary part of the filtering.
+ * @param fr [output] The real part of the filtering, it must be allocated
+ * with the size and type of the data.
+ * @param fi [output] The imaginary part of the filtering, as fr.
  * @param wx Tuning frequency at x.
  * @param wy Tuning frequency at y.
- * @param x The x-position.
- * @param y The y-position.
+ * @param method One of GaborFilterMethod.
  */
 void gabor_filter(cv::Mat data, cv::Mat fr, cv::Mat fi,
-                  const double wx, const double wy);
+                  const double wx, const double wy,
+                  const int method=GABOR_DIRECT);
 
+/**
+ * Averages the frequencies of the visited pixels in the 9x9 window
+ * centered at (x,y).
+ *
+ * @param fx the frequencies at x-direction, CV_32F or CV_64F.
+ * @param fy the frequencies at y-direction, of the same type of fx.
+ * @param visited the label field marking the visited pixels.
+ * @param x the column of the center.
+ * @param y the row of the center.
+ * @return the mean frequencies.
+ */
+cv::Vec2d peak_freqXY(const cv::Mat fx, const cv::Mat fy,
+                      const BitImage& visited, const int x, const int y);
+/**
+ * Averages the frequencies with the visited pixels given by an 8-bit
+ * matrix, nonzero where visited. Only the window is read.
+ */
 cv::Vec2d peak_freqXY(const cv::Mat fx, const cv::Mat fy, cv::Mat visited,
                       const int x, const int y);
 
-double dconvolutionAtXY(const double *__restrict data,
-               const double *__restrict kernelx,
-               const double *__restrict kernely,
-               const int x, const int y,
-               const int M, const int N,
-               const int kM, const int kN);
-
-void dconvolution(const double *__restrict data,
-           const double *__restrict kernelx,
-           const double *__restrict kernely,
-           double *__restrict out,
-           const int M, const int N,
-           const int KM, const int KN);
-
-float sconvolutionAtXY(const float *__restrict data,
-               const float *__restrict kernelx,
-               const float *__restrict kernely,
-               const int x, const int y,
-               const int M, const int N,
-               const int kM, const int kN);
-
-void sconvolution(const float *__restrict data,
-           const float *__restrict kernelx,
-           const float *__restrict kernely,
-           float *__restrict out,
-           const int M, const int N,
-           const int KM, const int KN);
-
 template <typename T>
 T convolutionAtXY(const cv::Mat data, const cv::Mat kernelx,
           const cv::Mat kernely, const int x, const int y)
@@ -135,7 +152,188 @@ T convolutionAtXY(const cv::Mat data, const cv::Mat kernelx,
   return 0;
 }
 
+/**
+ * Applies the complex kernel (hxr + i hxi)(hyr + i hyi) at (x,y).
+ *
+ * The neighborhood of (x,y) is read only once, see dgaborAtXY.
+ *
+ * @param data The data matrix, CV_32F or CV_64F.
+ * @param hxr The real part of the kernel along the x-direction.
+ * @param hxi The imaginary part of the kernel along the x-direction.
+ * @param hyr The real part of the kernel along the y-direction.
+ * @param hyi The imaginary part of the kernel along the y-direction.
+ * @param x The x-position.
+ * @param y The y-position.
+ * @param re [output] The real part of the result.
+ * @param im [output] The imaginary part of the result.
+ */
+template <typename T>
+void gaborAtXY(const cv::Mat data, const cv::Mat hxr, const cv::Mat hxi,
+               const cv::Mat hyr, const cv::Mat hyi, const int x, const int y,
+               T& re, T& im)
+{
+  if(data.type()==CV_32F){
+    float r, i;
+    sgaborAtXY(data.ptr<float>(), hxr.ptr<float>(), hxi.ptr<float>(),
+               hyr.ptr<float>(), hyi.ptr<float>(), x, y,
+               data.rows, data.cols, hyr.cols/2, hxr.cols/2, &r, &i);
+    re=r;
+    im=i;
+  }
+  else if(data.type()==CV_64F){
+    double r, i;
+    dgaborAtXY(data.ptr<double>(), hxr.ptr<double>(), hxi.ptr<double>(),
+               hyr.ptr<double>(), hyi.ptr<double>(), x, y,
+               data.rows, data.cols, hyr.cols/2, hxr.cols/2, &r, &i);
+    re=r;
+    im=i;
+  }
+}
+
 namespace gabor{
+  /**
+   * Cache of one-dimensional Gabor kernels.
+   *
+   * The kernels are indexed by their tuning frequency and sigma quantized
+   * with a fixed step, so pixels with close frequencies share the same
+   * kernel instead of generating it again. When the stored kernels exceed
+   * the memory limit, the oldest ones are removed.
+   *
+   * The quantization rounds the frequency and sigma to the nearest
+   * multiple of the step, so the filtering differs slightly from the one
+   * with the exact kernels. The filters only use a cache when it is set
+   * explicitly.
+   *
+   * The cache can be shared by several threads. The returned kernels are
+   * reference counted, so they stay valid even if they are removed from
+   * the cache later.
+   *
+   * @author Julio C. Estrada
+   */
+  class KernelCache{
+  public:
+    /**
+     * Builds an empty cache.
+     *
+     * @param step the quantization step for the frequency and sigma. A
+     * step less or equal to zero disables the cache.
+     * @param maxBytes the maximum memory used by the stored kernels.
+     */
+    KernelCache(const double step=0.001, const size_t maxBytes=1<<24);
+
+    /**
+     * Returns the kernel tuned at the quantized frequency and sigma.
+     *
+     * It works as gen_gaborKernel, but the kernel is generated only the
+     * first time that the quantized pair (f, sigma) is requested.
+     *
+     * @param greal [output] The real part of the kernel.
+     * @param gimag [output] The imaginary part of the kernel.
+     * @param f The tuning frequency.
+     * @param sigma The width of the gabor filter.
+     * @param type The data type of the output, CV_32F or CV_64F.
+     */
+    void get(cv::Mat& greal, cv::Mat& gimag, const double f,
+             const double sigma, const int type);
+    /**
+     * Sets the quantization step and empties the cache.
+     *
+     * @param step the quantization step, zero or less disables the cache.
+     */
+    KernelCache& setStep(const double step);
+    /**
+     * Sets the maximum memory that the stored kernels can use.
+     *
+     * @param bytes the memory limit in bytes.
+     */
+    KernelCache& setMaxBytes(const size_t bytes);
+    /** Removes all the stored kernels. */
+    void clear();
+    /** Returns the number of stored kernels. */
+    size_t size();
+    /** Returns the memory used by the stored kernels. */
+    size_t bytes();
+
+    /**
+     * Returns a cache that can be shared by several filters.
+     */
+    static KernelCache& shared();
+  private:
+    struct Key{
+      int f, sigma, type;
+      bool operator<(const Key& k) const;
+    };
+    struct Entry{
+      cv::Mat greal, gimag;
+    };
+
+    std::map<Key, Entry> m_kernels;
+    /** Insertion order of the kernels, used to remove the oldest ones */
+    std::list<Key> m_order;
+    cv::Mutex m_mutex;
+    double m_step;
+    size_t m_maxBytes;
+    size_t m_bytes;
+  };
+
+  /**
+   * Bank of gabor filters applied to the same data.
+   *
+   * It applies gabor_filter at several frequencies to one image. The
+   * spectrum of the data is computed the first time that the FFT method
+   * is used and it is reused by the following filters, so each of them
+   * only costs a pointwise product and an inverse transform. The data is
+   * padded to fit the largest kernel generated by gabor_filter.
+   *
+   * @author Julio C. Estrada
+   */
+  class FilterBank{
+  public:
+    FilterBank();
+    /**
+     * Builds the bank for the given data.
+     *
+     * @param data the data matrix, CV_32F or CV_64F.
+     */
+    FilterBank(cv::Mat data);
+
+    /**
+     * Sets the data that is being filtered and drops its spectrum.
+     */
+    FilterBank& setData(cv::Mat data);
+    /**
+     * Sets the method used to filter the data.
+     *
+     * @param method one of GaborFilterMethod, by default GABOR_DIRECT.
+     */
+    FilterBank& setMethod(const int method);
+    /**
+     * Returns the method used to filter the data.
+     */
+    int getMethod() const;
+
+    /**
+     * Filters the data at the given frequency.
+     *
+     * @param fr [output] The real part of the filtering, it must be
+     * allocated with the size and type of the data.
+     * @param fi [output] The imaginary part of the filtering, as fr.
+     * @param wx Tuning frequency at x.
+     * @param wy Tuning frequency at y.
+     */
+    void operator()(cv::Mat fr, cv::Mat fi, const double wx,
+                    const double wy);
+  private:
+    void filterFFT(cv::Mat fr, cv::Mat fi, const cv::Mat& hxr,
+                   const cv::Mat& hxi, const cv::Mat& hyr,
+                   const cv::Mat& hyi);
+
+    cv::Mat m_data;
+    /** Spectrum of the padded data, empty until it is needed */
+    cv::Mat m_spectrum;
+    int m_method;
+  };
+
   /**
    * Gabor filter at position (x,y).
    *
@@ -156,6 +354,16 @@ namespace gabor{
      * @param size the maximum size
      */
     FilterXY& setKernelSize(double size);
+    /**
+     * Sets the cache where the kernels are taken from.
+     *
+     * By default there is no cache and the kernels are generated at each
+     * pixel. The cache rounds the frequency and sigma to its step.
+     *
+     * @param cache the kernel cache, NULL generates the kernels at each
+     * pixel.
+     */
+    FilterXY& setKernelCache(KernelCache* cache);
   protected:
     cv::Mat hxr, hxi, hyr, hyi;
     cv::Mat data;
@@ -163,6 +371,8 @@ namespace gabor{
   private:
     /** The maximum kernel size. */
     double m_kernelN;
+    /** The cache of kernels, it can be NULL. */
+    KernelCache* m_cache;
   };
 
   /**
@@ -179,19 +389,104 @@ namespace gabor{
     FilterNeighbor(cv::Mat param_I, cv::Mat param_fr, cv::Mat param_fi);
     void operator()(double wx, double wy, int i, int j);
     FilterNeighbor& setKernelSize(double size);
+    FilterNeighbor& setKernelCache(KernelCache* cache);
   protected:
     FilterXY m_localFilter;
   private:
     const int M, N;
   };
 
+  /**
+   * Running sums of the frequencies of the visited pixels.
+   *
+   * The image is split into blocks of BLOCKxBLOCK pixels and each block
+   * keeps its own summed-area tables of fx, fy and of the number of
+   * visited pixels. A window of up to BLOCK+1 pixels per side covers at
+   * most 2x2 blocks, so its sums take at most sixteen reads whatever its
+   * position, and larger windows add the totals of the blocks they cover.
+   * Visiting a pixel or changing its frequencies only updates the tables
+   * of its block.
+   *
+   * The tables are stored in single precision, about 9 bytes per pixel,
+   * so the sums have a relative error about 1e-6.
+   *
+   * @author Julio C. Estrada
+   */
+  class FreqSums{
+  public:
+    /** The side of the blocks */
+    enum{ BLOCK=8 };
+
+    FreqSums();
+    /**
+     * Builds the sums with the pixels already visited.
+     *
+     * @param fx the frequencies at x-direction, CV_32F or CV_64F.
+     * @param fy the frequencies at y-direction, of the same type of fx.
+     * @param visited the label field marking the visited pixels.
+     */
+    FreqSums(const cv::Mat fx, const cv::Mat fy, const BitImage& visited);
+
+    /**
+     * Adds a newly visited pixel to the sums.
+     *
+     * @param i the row of the pixel.
+     * @param j the column of the pixel.
+     * @param fx the frequency at x-direction of the pixel.
+     * @param fy the frequency at y-direction of the pixel.
+     */
+    void insert(const int i, const int j, const double fx, const double fy);
+    /**
+     * Changes the frequencies of a visited pixel.
+     *
+     * @param i the row of the pixel.
+     * @param j the column of the pixel.
+     * @param dfx the change of the frequency at x-direction.
+     * @param dfy the change of the frequency at y-direction.
+     */
+    void update(const int i, const int j, const double dfx,
+                const double dfy);
+    /**
+     * Sums the frequencies of the visited pixels in a window.
+     *
+     * The window of NxN pixels is centered at (i,j) and it is clipped at
+     * the borders.
+     *
+     * @param i the row of the center.
+     * @param j the column of the center.
+     * @param N the window size.
+     * @param sums [output] the sums of fx and fy.
+     * @return the number of visited pixels in the window.
+     */
+    int sum(const int i, const int j, const int N, cv::Vec2d& sums) const;
+  private:
+    void add(const int i, const int j, const double fx, const double fy,
+             const int count);
+    /** Position of the pixel (i,j) in the tables, block by block */
+    size_t index(const int i, const int j) const;
+    /** Adds the sums of the rectangle from (i0,j0) to (i1,j1) included,
+        which must lie inside one block */
+    void blockSum(const int i0, const int j0, const int i1, const int j1,
+                  double& sx, double& sy, int& count) const;
+
+    std::vector<float> m_fx, m_fy;
+    std::vector<uchar> m_count;
+    int M, N;
+    /** The number of blocks along the columns */
+    int m_blocksX;
+  };
+
   /**
    * Estimates the local frequency at pixel (x,y).
    *
    * Given the real part and imaginary part of a complex data matrix, it
    * estimates the local frequency at location (x,y) using finite
    * differences.
+   *
+   * The template parameter is the element type of the data, float or
+   * double.
    */
+  template<typename T>
   class CalcFreqXY{
   public:
     CalcFreqXY(cv::Mat param_fr, cv::Mat param_fi);
@@ -212,7 +507,11 @@ namespace gabor{
    * 
    * It filters the neighborhood around the given pixel and estimates the
    * local frequency and stores the local frequency.
+   *
+   * The template parameter is the element type of the fringe pattern,
+   * the filter outputs and the frequencies, float or double.
    */
+  template<typename T>
   class DemodPixel{
   public:
     /**
@@ -227,10 +526,11 @@ namespace gabor{
      * pixels
      */
     DemodPixel(cv::Mat parm_I, cv::Mat parm_fr, cv::Mat parm_fi,
-               cv::Mat parm_fx, cv::Mat parm_fy, cv::Mat parm_visited);
+               cv::Mat parm_fx, cv::Mat parm_fy, BitImage parm_visited);
 
     void operator()(const int i, const int j);
     DemodPixel& setKernelSize(const double size);
+    DemodPixel& setKernelCache(KernelCache* cache);
     DemodPixel& setTau(const double tau);
     DemodPixel& setMinFq(const double w);
     DemodPixel& setMaxFq(const double w);
@@ -248,12 +548,27 @@ namespace gabor{
      * @param Nsize the comb size. Default is 7
      */
     DemodPixel& setCombNsize(const int Nsize);
+    /**
+     * Sets the running sums used to average the neighbor frequencies.
+     *
+     * The sums must be shared by all the objects processing the same
+     * frequency fields. Without sums the neighborhoods are scanned.
+     *
+     * @param sums the running sums, NULL to scan the neighborhoods.
+     */
+    DemodPixel& setFreqSums(FreqSums* sums);
 
   protected:
-    cv::Mat fx, fy, visited;
+    cv::Mat fx, fy;
+    BitImage visited;
     FilterNeighbor m_filter;
-    CalcFreqXY m_calcfreq;
+    CalcFreqXY<T> m_calcfreq;
     int m_iters;
+    /** The running sums of the frequencies, it can be NULL */
+    FreqSums* m_sums;
+
+    /** Stores the frequencies of the visited pixel (i,j) */
+    void setFreqs(const int i, const int j, const cv::Vec2d freqs);
   private:
     /** Parameter of recursive filter */
     double m_tau;
@@ -265,30 +580,34 @@ namespace gabor{
     cv::Vec2d combFreq(cv::Vec2d freqs, const int i, const int j);
   };
 
-  class DemodSeed:public DemodPixel{
+  template<typename T>
+  class DemodSeed:public DemodPixel<T>{
   public:
     DemodSeed(cv::Mat parm_I, cv::Mat parm_fr, cv::Mat parm_fi,
-              cv::Mat parm_fx, cv::Mat parm_fy, cv::Mat parm_visited);
+              cv::Mat parm_fx, cv::Mat parm_fy, BitImage parm_visited);
     void operator()(cv::Vec2d freqs, const int i, const int j);
   };
 
+  template<typename T>
   class DemodNeighborhood{
   public:
     DemodNeighborhood(cv::Mat param_I, cv::Mat param_fr,
                       cv::Mat param_fi, cv::Mat param_fx,
-                      cv::Mat param_fy, cv::Mat param_visited);
+                      cv::Mat param_fy, BitImage param_visited);
 
     DemodNeighborhood& setKernelSize(const double size);
+    DemodNeighborhood& setKernelCache(KernelCache* cache);
     DemodNeighborhood& setMinFq(const double w);
     DemodNeighborhood& setMaxFq(const double w);
     DemodNeighborhood& setTau(const double tau);
     DemodNeighborhood& setIters(const int iters);
     DemodNeighborhood& setCombFreqs(bool flag);
     DemodNeighborhood& setCombSize(int size);
+    DemodNeighborhood& setFreqSums(FreqSums* sums);
     void operator()(const int i, const int j);
   protected:
-    const cv::Mat_<uchar> visit;
-    DemodPixel m_demodPixel;
+    const BitImage visit;
+    DemodPixel<T> m_demodPixel;
   };
 }
 
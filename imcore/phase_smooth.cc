@@ -0,0 +1,320 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include "phase_smooth.h"
+#include "phase_wrap.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace{
+
+#ifdef __SSE2__
+/** Takes a where the mask is set and b elsewhere */
+inline __m128 select(const __m128 mask, const __m128 a, const __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/**
+ * Sine and cosine of four phases.
+ *
+ * The phase is wrapped and reduced to [-pi/4,pi/4] by the nearest multiple
+ * of pi/2, where the Taylor polynomials of degree 7 and 8 have an error
+ * below 4e-7. The quadrant swaps and negates the results.
+ */
+inline void sincos4(const __m128 phase, __m128& s, __m128& c)
+{
+  const __m128 x= swrap4(phase);
+  const __m128i k= _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(2/M_PI)));
+  const __m128 y= _mm_sub_ps(x, _mm_mul_ps(_mm_cvtepi32_ps(k),
+                                           _mm_set1_ps(M_PI/2)));
+  const __m128 y2= _mm_mul_ps(y, y);
+
+  __m128 ps= _mm_set1_ps(-1.0f/5040);
+  ps= _mm_add_ps(_mm_mul_ps(ps, y2), _mm_set1_ps(1.0f/120));
+  ps= _mm_add_ps(_mm_mul_ps(ps, y2), _mm_set1_ps(-1.0f/6));
+  ps= _mm_add_ps(_mm_mul_ps(ps, y2), _mm_set1_ps(1));
+  ps= _mm_mul_ps(ps, y);
+  __m128 pc= _mm_set1_ps(1.0f/40320);
+  pc= _mm_add_ps(_mm_mul_ps(pc, y2), _mm_set1_ps(-1.0f/720));
+  pc= _mm_add_ps(_mm_mul_ps(pc, y2), _mm_set1_ps(1.0f/24));
+  pc= _mm_add_ps(_mm_mul_ps(pc, y2), _mm_set1_ps(-0.5f));
+  pc= _mm_add_ps(_mm_mul_ps(pc, y2), _mm_set1_ps(1));
+
+  // sin(y+k pi/2) and cos(y+k pi/2): odd k swaps them, bit 1 of k negates
+  // the sine and bit 1 of k+1 negates the cosine
+  const __m128i one= _mm_set1_epi32(1), two= _mm_set1_epi32(2);
+  const __m128 swap= _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(k, one),
+                                                      one));
+  const __m128 ns= _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(k, two), 30));
+  const __m128 nc= _mm_castsi128_ps(
+                     _mm_slli_epi32(_mm_and_si128(_mm_add_epi32(k, one), two),
+                                    30));
+  s= _mm_xor_ps(select(swap, pc, ps), ns);
+  c= _mm_xor_ps(select(swap, ps, pc), nc);
+}
+
+/**
+ * Arc tangent of y/x in the four quadrants.
+ *
+ * The ratio of the smaller to the larger absolute value is taken into
+ * [0,1], where the polynomial of Abramowitz and Stegun (4.4.49) has an
+ * error below 1e-5.
+ */
+inline __m128 atan2_4(const __m128 y, const __m128 x)
+{
+  const __m128 sign= _mm_set1_ps(-0.0f);
+  const __m128 ax= _mm_andnot_ps(sign, x), ay= _mm_andnot_ps(sign, y);
+  const __m128 mx= _mm_max_ps(_mm_max_ps(ax, ay),
+                              _mm_set1_ps(1e-30f));
+  const __m128 a= _mm_div_ps(_mm_min_ps(ax, ay), mx);
+  const __m128 a2= _mm_mul_ps(a, a);
+
+  __m128 r= _mm_set1_ps(0.0208351f);
+  r= _mm_add_ps(_mm_mul_ps(r, a2), _mm_set1_ps(-0.0851330f));
+  r= _mm_add_ps(_mm_mul_ps(r, a2), _mm_set1_ps(0.1801410f));
+  r= _mm_add_ps(_mm_mul_ps(r, a2), _mm_set1_ps(-0.3302995f));
+  r= _mm_add_ps(_mm_mul_ps(r, a2), _mm_set1_ps(0.9998660f));
+  r= _mm_mul_ps(r, a);
+
+  r= select(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(M_PI/2), r), r);
+  r= select(_mm_cmplt_ps(x, _mm_setzero_ps()),
+            _mm_sub_ps(_mm_set1_ps(M_PI), r), r);
+  return _mm_or_ps(r, _mm_and_ps(sign, y));
+}
+#endif
+
+/** Sine and cosine of a row */
+void sincosRow(const float* phase, float* s, float* c, const int n)
+{
+  int j=0;
+#ifdef __SSE2__
+  __m128 vs, vc;
+  for(; j+4<=n; j+=4){
+    sincos4(_mm_loadu_ps(phase+j), vs, vc);
+    _mm_storeu_ps(s+j, vs);
+    _mm_storeu_ps(c+j, vc);
+  }
+  if(j<n){
+    // The tail through the same approximation
+    float tp[4]={0, 0, 0, 0}, ts[4], tc[4];
+    std::copy(phase+j, phase+n, tp);
+    sincos4(_mm_loadu_ps(tp), vs, vc);
+    _mm_storeu_ps(ts, vs);
+    _mm_storeu_ps(tc, vc);
+    std::copy(ts, ts+n-j, s+j);
+    std::copy(tc, tc+n-j, c+j);
+  }
+#else
+  for(; j<n; j++){
+    s[j]=std::sin(phase[j]);
+    c[j]=std::cos(phase[j]);
+  }
+#endif
+}
+
+/** Angle of the phasors of a row */
+void angleRow(const float* s, const float* c, float* out, const int n)
+{
+  int j=0;
+#ifdef __SSE2__
+  for(; j+4<=n; j+=4)
+    _mm_storeu_ps(out+j, atan2_4(_mm_loadu_ps(s+j), _mm_loadu_ps(c+j)));
+  if(j<n){
+    float ts[4]={0, 0, 0, 0}, tc[4]={1, 1, 1, 1}, to[4];
+    std::copy(s+j, s+n, ts);
+    std::copy(c+j, c+n, tc);
+    _mm_storeu_ps(to, atan2_4(_mm_loadu_ps(ts), _mm_loadu_ps(tc)));
+    std::copy(to, to+n-j, out+j);
+  }
+#else
+  for(; j<n; j++)
+    out[j]=std::atan2(s[j], c[j]);
+#endif
+}
+
+/** Cosine of the angle of the phasors of a row, c/|(s,c)| */
+void cosineRow(const float* s, const float* c, float* out, const int n)
+{
+  for(int j=0; j<n; j++){
+    const float m=std::sqrt(s[j]*s[j] + c[j]*c[j]);
+    out[j]= m>0? c[j]/m:1;
+  }
+}
+
+template<typename T>
+void loadRow(const cv::Mat& mat, const int y, float* row)
+{
+  const T* p=mat.ptr<T>(y);
+  for(int j=0; j<mat.cols; j++)
+    row[j]=(float)p[j];
+}
+
+template<typename T>
+void storeRow(const float* row, cv::Mat& mat, const int y)
+{
+  T* p=mat.ptr<T>(y);
+  for(int j=0; j<mat.cols; j++)
+    p[j]=(T)row[j];
+}
+
+/**
+ * Smooths strips of rows of the wrapped phase.
+ *
+ * Each strip computes the sine and the cosine of its rows and of the
+ * kernel radius around them, blurs them along the columns and then along
+ * the rows, and writes its output rows.
+ */
+class StripSmoother: public cv::ParallelLoopBody
+{
+public:
+  StripSmoother(const cv::Mat& wphase, const std::vector<float>& kernel,
+                const int strip, cv::Mat* smoothed, cv::Mat* path)
+  :m_wphase(wphase), m_kernel(kernel), m_strip(strip), m_smoothed(smoothed),
+   m_path(path)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    for(int k=r.start; k<r.end; k++)
+      smoothStrip(k*m_strip, std::min(m_wphase.rows, (k+1)*m_strip));
+  }
+
+private:
+  const cv::Mat& m_wphase;
+  const std::vector<float>& m_kernel;
+  const int m_strip;
+  cv::Mat* m_smoothed;
+  cv::Mat* m_path;
+
+  void smoothStrip(const int y0, const int y1) const
+  {
+    const int rows=m_wphase.rows, cols=m_wphase.cols;
+    const int ksize=(int)m_kernel.size(), rad=ksize/2;
+    const int h=y1-y0+2*rad;
+    const bool single= m_wphase.type()==CV_32F;
+    std::vector<float> S(h*cols), C(h*cols), row(cols);
+    std::vector<float> vs(cols+2*rad), vc(cols+2*rad), hs(cols), hc(cols);
+
+    for(int k=0; k<h; k++){
+      const int y=cv::borderInterpolate(y0-rad+k, rows,
+                                        cv::BORDER_REFLECT_101);
+      if(single)
+        loadRow<float>(m_wphase, y, &row[0]);
+      else
+        loadRow<double>(m_wphase, y, &row[0]);
+      sincosRow(&row[0], &S[k*cols], &C[k*cols], cols);
+    }
+
+    float* ps=&vs[rad];
+    float* pc=&vc[rad];
+    for(int y=y0; y<y1; y++){
+      std::fill(vs.begin(), vs.end(), 0.0f);
+      std::fill(vc.begin(), vc.end(), 0.0f);
+      for(int k=0; k<ksize; k++){
+        const float w=m_kernel[k];
+        const float* s=&S[(y-y0+k)*cols];
+        const float* c=&C[(y-y0+k)*cols];
+        for(int j=0; j<cols; j++){
+          ps[j]+=w*s[j];
+          pc[j]+=w*c[j];
+        }
+      }
+      for(int j=1; j<=rad; j++){
+        const int l=cv::borderInterpolate(-j, cols, cv::BORDER_REFLECT_101);
+        const int r=cv::borderInterpolate(cols-1+j, cols,
+                                          cv::BORDER_REFLECT_101);
+        ps[-j]=ps[l];
+        pc[-j]=pc[l];
+        ps[cols-1+j]=ps[r];
+        pc[cols-1+j]=pc[r];
+      }
+      for(int j=0; j<cols; j++){
+        float s=0, c=0;
+        for(int k=0; k<ksize; k++){
+          s+=m_kernel[k]*vs[j+k];
+          c+=m_kernel[k]*vc[j+k];
+        }
+        hs[j]=s;
+        hc[j]=c;
+      }
+
+      if(m_smoothed!=NULL){
+        angleRow(&hs[0], &hc[0], &row[0], cols);
+        if(single)
+          storeRow<float>(&row[0], *m_smoothed, y);
+        else
+          storeRow<double>(&row[0], *m_smoothed, y);
+      }
+      if(m_path!=NULL){
+        cosineRow(&hs[0], &hc[0], &row[0], cols);
+        if(single)
+          storeRow<float>(&row[0], *m_path, y);
+        else
+          storeRow<double>(&row[0], *m_path, y);
+      }
+    }
+  }
+};
+
+}
+
+void smoothWrappedPhase(const cv::Mat& wphase, const double sigma,
+                        cv::Mat* smoothed, cv::Mat* path)
+{
+  CV_Assert(wphase.type()==CV_32F || wphase.type()==CV_64F);
+  CV_Assert(sigma>0);
+
+  // The kernel size of cv::GaussianBlur for floating point images
+  const int ksize=cvRound(sigma*4*2 + 1)|1;
+  const cv::Mat k=cv::getGaussianKernel(ksize, sigma, CV_32F);
+  const std::vector<float> kernel(k.ptr<float>(), k.ptr<float>()+ksize);
+  const int rad=ksize/2;
+
+  // The sine and cosine of a strip take about 256 KB, and the strips are
+  // at least twice the kernel so its border does not dominate
+  const int strip=std::max(std::max((1<<15)/std::max(wphase.cols, 1) - 2*rad,
+                                    4*rad), 8);
+  const int nstrips=(wphase.rows + strip - 1)/strip;
+
+  // The outputs are new matrices, the input can be one of them
+  cv::Mat out, cpath;
+  if(smoothed!=NULL)
+    out.create(wphase.rows, wphase.cols, wphase.type());
+  if(path!=NULL)
+    cpath.create(wphase.rows, wphase.cols, wphase.type());
+  cv::parallel_for_(cv::Range(0, nstrips),
+                    StripSmoother(wphase, kernel, strip,
+                                  smoothed? &out:NULL, path? &cpath:NULL));
+  if(smoothed!=NULL)
+    *smoothed=out;
+  if(path!=NULL)
+    *path=cpath;
+}
@@ -0,0 +1,64 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#ifndef PHASE_SMOOTH_H
+#define PHASE_SMOOTH_H
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Smooths a wrapped phase.
+ *
+ * It filters the phasor \f$ e^{i\phi} \f$ with a gaussian and takes its
+ * angle,
+ * \f[
+ * \phi_s = \arctan\frac{G_\sigma * \sin\phi}{G_\sigma * \cos\phi},
+ * \f]
+ * as cv::GaussianBlur with cv::Size(0,0) would do on the sine and cosine
+ * images, with the same kernel size and reflected borders. The sine and the
+ * cosine are computed and blurred in strips of rows that fit in the cache,
+ * and the strips are processed in parallel, so no full image temporaries
+ * are needed.
+ *
+ * With SSE2 the sine, the cosine and the arc tangent are vectorized
+ * polynomial approximations computed in single precision. The error of
+ * the sine and the cosine is below 1e-6 for phases in [-pi,pi], larger
+ * phases add the rounding of their single precision wrap, and the error of
+ * the arc tangent is below 2e-5 radians.
+ *
+ * @param wphase the wrapped phase, single or double precision.
+ * @param sigma the standard deviation of the gaussian.
+ * @param smoothed [output] if not NULL, the smoothed phase, of the type of
+ * wphase.
+ * @param path [output] if not NULL, the cosine of the smoothed phase,
+ * computed as the normalized cosine of the phasor without the arc tangent.
+ */
+void smoothWrappedPhase(const cv::Mat& wphase, const double sigma,
+                        cv::Mat* smoothed, cv::Mat* path=NULL);
+
+#endif // PHASE_SMOOTH_H
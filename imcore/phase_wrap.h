@@ -0,0 +1,152 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#ifndef PHASE_WRAP_H
+#define PHASE_WRAP_H
+
+/**
+ * Phase wrap operator.
+ *
+ * Wraps phases to [-pi,pi] subtracting the nearest multiple of 2pi, that is
+ * \f[
+ * W(x) = x - 2\pi\,\mathrm{round}\left(\frac{x}{2\pi}\right).
+ * \f]
+ * It needs one multiplication and one rounding, without branches nor
+ * transcendental functions. The rounding is made with the SSE2 conversion
+ * instructions when they are available. The inputs must be within the
+ * range of a 32-bit integer times 2pi.
+ *
+ * The functions are inline, so they can be used from C and C++ without
+ * linking imcore.
+ */
+
+#include <stddef.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef __SSE2__
+/**
+ * Wraps four phases (single precision).
+ */
+static inline __m128 swrap4(const __m128 x)
+{
+  const __m128 m= _mm_set1_ps((float)(2 * M_PI));
+  const __m128 im= _mm_set1_ps((float)(0.5 / M_PI));
+
+  return _mm_sub_ps(x, _mm_mul_ps(m, _mm_cvtepi32_ps(
+                                       _mm_cvtps_epi32(_mm_mul_ps(x, im)))));
+}
+
+/**
+ * Wraps two phases (double precision).
+ */
+static inline __m128d dwrap2(const __m128d x)
+{
+  const __m128d m= _mm_set1_pd(2 * M_PI);
+  const __m128d im= _mm_set1_pd(0.5 / M_PI);
+
+  return _mm_sub_pd(x, _mm_mul_pd(m, _mm_cvtepi32_pd(
+                                       _mm_cvtpd_epi32(_mm_mul_pd(x, im)))));
+}
+#endif
+
+/**
+ * Wraps a phase (single precision).
+ */
+static inline float swrap(const float x)
+{
+#ifdef __SSE2__
+  const float n= (float)_mm_cvtss_si32(_mm_set_ss(x * (float)(0.5 / M_PI)));
+#else
+  const float n= floorf(x * (float)(0.5 / M_PI) + 0.5f);
+#endif
+  return x - (float)(2 * M_PI) * n;
+}
+
+/**
+ * Wraps a phase (double precision).
+ */
+static inline double dwrap(const double x)
+{
+#ifdef __SSE2__
+  const double n= (double)_mm_cvtsd_si32(_mm_set_sd(x * (0.5 / M_PI)));
+#else
+  const double n= floor(x * (0.5 / M_PI) + 0.5);
+#endif
+  return x - 2 * M_PI * n;
+}
+
+/**
+ * Wraps an array of phases (single precision).
+ *
+ * @param in the phases.
+ * @param out [output] the wrapped phases, it can be the input.
+ * @param n the number of phases.
+ */
+static inline void swrap_array(const float *in, float *out, const size_t n)
+{
+  size_t i= 0;
+#ifdef __SSE2__
+  for (; i + 4 <= n; i+= 4)
+    _mm_storeu_ps(out + i, swrap4(_mm_loadu_ps(in + i)));
+#endif
+  for (; i < n; i++)
+    out[i]= swrap(in[i]);
+}
+
+/**
+ * Wraps an array of phases (double precision).
+ *
+ * @see swrap_array
+ */
+static inline void dwrap_array(const double *in, double *out, const size_t n)
+{
+  size_t i= 0;
+#ifdef __SSE2__
+  for (; i + 2 <= n; i+= 2)
+    _mm_storeu_pd(out + i, dwrap2(_mm_loadu_pd(in + i)));
+#endif
+  for (; i < n; i++)
+    out[i]= dwrap(in[i]);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PHASE_WRAP_H
@@ -27,6 +27,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 **************************************************************************/
 
 #include "scanner.h"
+#include "scanorder.h"
 #include <algorithm>
 #include <iostream>
 
@@ -36,16 +37,15 @@ Scanner::Scanner()
   m_pixel.x=0;
   m_pixel.y=0;
   m_updateMinFreq=true;
+  m_useFrontier=false;
+  m_static=false;
+  m_stride=0;
+  m_order=NULL;
 }
 
 Scanner::Scanner(const cv::Mat& mat_u, const cv::Mat& mat_v)
 {
-  CV_Assert(mat_u.type()==CV_64F && mat_v.type()==CV_64F);
-
-  m_matu=mat_u;
-  m_matv=mat_v;
-  m_visited = cv::Mat_<bool>::zeros(mat_u.rows, mat_u.cols);
-  m_mask = cv::Mat_<bool>::ones(mat_u.rows, mat_u.cols);
+  init(mat_u, mat_v);
   m_pixel.x=0;
   m_pixel.y=0;
   insertPixelToPath(m_pixel);
@@ -54,18 +54,28 @@ Scanner::Scanner(const cv::Mat& mat_u, const cv::Mat& mat_v)
 }
 Scanner::Scanner(const cv::Mat& mat_u, const cv::Mat& mat_v, cv::Point pixel)
 {
-  CV_Assert(mat_u.type()==CV_64F && mat_v.type()==CV_64F);
-
-  m_matu=mat_u;
-  m_matv=mat_v;
-  m_visited = cv::Mat_<bool>::zeros(mat_u.rows, mat_u.cols);
-  m_mask = cv::Mat_<bool>::ones(mat_u.rows, mat_u.cols);
+  init(mat_u, mat_v);
   m_pixel=pixel;
   insertPixelToPath(m_pixel);
   m_freqmin=0.6;
   m_updateMinFreq=true;
 }
 
+void Scanner::init(const cv::Mat& mat_u, const cv::Mat& mat_v)
+{
+  CV_Assert(mat_u.type()==mat_v.type() &&
+            (mat_u.type()==CV_32F || mat_u.type()==CV_64F));
+
+  m_matu=mat_u;
+  m_matv=mat_v;
+  m_visited.create(mat_u.rows, mat_u.cols);
+  m_mask.create(mat_u.rows, mat_u.cols, true);
+  m_useFrontier=false;
+  m_static=false;
+  m_stride=0;
+  m_order=NULL;
+}
+
 void Scanner::setFreqMin(double freq)
 {
   m_freqmin = freq;
@@ -73,26 +83,62 @@ void Scanner::setFreqMin(double freq)
 
 void Scanner::setMask(cv::Mat mask)
 {
+  setMask(BitImage(mask));
+}
+
+void Scanner::setMask(const BitImage& mask)
+{
+  CV_Assert(mask.rows()==m_matu.rows && mask.cols()==m_matu.cols);
   m_mask = mask;
+  if(m_static)
+    buildMagnitudes();
+  if(m_useFrontier)
+    useFrontier(true);
+}
+
+void Scanner::useStaticField(bool use)
+{
+  m_static=use;
+  if(m_static)
+    buildMagnitudes();
+  else
+    m_magn.clear();
+}
+
+void Scanner::buildMagnitudes()
+{
+  const int M=m_matu.rows, N=m_matu.cols;
+  m_stride=N+2;
+  m_magn.assign((M+2)*m_stride, -1.0);
+  for(int y=0; y<M; y++)
+    for(int x=0; x<N; x++)
+      if(!m_visited(y,x) && m_mask(y,x))
+        m_magn[(y+1)*m_stride + x+1]=fieldPow(y, x);
+  for(int k=0; k<8; k++)
+    m_offsets[k]=NB_DY[k]*m_stride + NB_DX[k];
 }
 
 bool Scanner::next()
 {
-  if(!next(m_freqmin*m_freqmin)){
-    m_pixel=findPixel();
+  const double fpow=m_freqmin*m_freqmin;
+  if(!(m_static? nextStatic(fpow):next(fpow))){
+    m_pixel= m_useFrontier? findFrontier():findPixel();
     if(m_pixel.x>=0 && m_pixel.y>=0 && m_updateMinFreq){
       //std::cout<<"Frequencia actual: "<<m_freqmin;
-      m_freqmin=sqrt(m_matu(m_pixel.y,m_pixel.x)*m_matu(m_pixel.y,m_pixel.x)
-        + m_matv(m_pixel.y,m_pixel.x)*m_matv(m_pixel.y,m_pixel.x));
+      m_freqmin=sqrt(freqPow(m_pixel.y, m_pixel.x));
       //m_freqmin-=0.01;
       //std::cout<<", Frecuencia ajustada: "<<m_freqmin<<std::endl;
       //std::cout<<"Nuevo punto inicial: (" << m_pixel.x << ", " <<m_pixel.y
       //         << ")" << std::endl;
       insertPixelToPath(m_pixel);
+      if(m_order!=NULL)
+        m_order->push(m_pixel);
       return true;//next(m_freqmin*m_freqmin);
     }
     return false;
   }
+  if(m_order!=NULL)
+    m_order->push(m_pixel);
   return true;
 
   //return next(m_freqmin*m_freqmin);
@@ -102,32 +148,8 @@ bool Scanner::checkNeighbor(cv::Point pixel)
 {
   int y=pixel.y, x=pixel.x;
 
-  if(!m_visited(y,x) && m_mask(y,x)){
-    if(x-1>=0)
-      if(m_visited(y,x-1) && m_mask(y,x-1))
-        return true;
-    if(x+1<m_matu.cols)
-      if(m_visited(y,x+1) && m_mask(y,x+1))
-        return true;
-    if(y-1>=0)
-      if(m_visited(y-1,x) && m_mask(y-1,x))
-        return true;
-    if(y+1<m_matu.rows)
-      if(m_visited(y+1,x) && m_mask(y+1,x))
-        return true;
-    if(x-1>=0 && y-1>=0)
-      if(m_visited(y-1,x-1) && m_mask(y-1,x-1))
-        return true;
-    if(x+1<m_matu.cols && y-1>=0)
-      if(m_visited(y-1,x+1) && m_mask(y-1,x+1))
-        return true;
-    if(x+1<m_matu.cols && y+1<m_matu.rows)
-      if(m_visited(y+1,x+1) && m_mask(y+1,x+1))
-        return true;
-    if(x-1>=0 && y+1<m_matu.rows)
-      if(m_visited(y+1,x-1) && m_mask(y+1,x-1))
-        return true;
-  }
+  if(!m_visited(y,x) && m_mask(y,x))
+    return (m_visited.neighbors8(y,x) & m_mask.neighbors8(y,x))!=0;
   return false;
 }
 
@@ -135,17 +157,17 @@ cv::Point Scanner::findPixel()
 {
   cv::Point pixel;
   int &x=pixel.x, &y=pixel.y;
-  m_pixel.x=(m_pixel.x>=0 && m_pixel.x<m_visited.cols)? m_pixel.x:0;
-  m_pixel.y=(m_pixel.y>=0 && m_pixel.y<m_visited.rows)? m_pixel.y:0;
+  m_pixel.x=(m_pixel.x>=0 && m_pixel.x<m_visited.cols())? m_pixel.x:0;
+  m_pixel.y=(m_pixel.y>=0 && m_pixel.y<m_visited.rows())? m_pixel.y:0;
 
-  for(y=m_pixel.y; y<m_visited.rows; y++)
-    for(x=m_pixel.x; x<m_visited.cols; x++){
+  for(y=m_pixel.y; y<m_visited.rows(); y++)
+    for(x=m_pixel.x; x<m_visited.cols(); x++){
       if(checkNeighbor(pixel)){
         return pixel;
       }
     }
   for(y=m_pixel.y; y>=0; y--)
-    for(x=m_pixel.x; x<m_visited.cols; x++){
+    for(x=m_pixel.x; x<m_visited.cols(); x++){
       if(checkNeighbor(pixel)){
         return pixel;
       }
@@ -156,7 +178,7 @@ cv::Point Scanner::findPixel()
         return pixel;
       }
     }
-  for(y=m_pixel.y; y<m_visited.rows; y++)
+  for(y=m_pixel.y; y<m_visited.rows(); y++)
     for(x=m_pixel.x; x>=0; x--){
       if(checkNeighbor(pixel)){
         return pixel;
@@ -169,55 +191,13 @@ inline
 bool Scanner::next(double fpow)
 {
   cv::Vec<double, 8> magn;
-  std::vector<cv::Point> pixel(8,cv::Point(0,0));
   while(!m_path.empty()){
     m_pixel=m_path.back();
-    for(int i=0; i<8; i++) magn[i]=-1;
-    int x=m_pixel.x, y=m_pixel.y;
-    if(x-1>=0)
-      if(!m_visited(y,x-1) && m_mask(y,x-1)){
-        pixel[0]=cv::Point(x-1,y);
-        magn[0]=m_matu(y,x-1)*m_matu(y,x-1) + m_matv(y,x-1)*m_matv(y,x-1);
-      }
-    if(x+1<m_matu.cols)
-      if(!m_visited(y,x+1) && m_mask(y,x+1)){
-        pixel[1]=cv::Point(x+1,y);
-        magn[1]=m_matu(y,x+1)*m_matu(y,x+1) + m_matv(y,x+1)*m_matv(y,x+1);
-      }
-    if(y-1>=0)
-      if(!m_visited(y-1,x) && m_mask(y-1,x)){
-        pixel[2]=cv::Point(x,y-1);
-        magn[2]=m_matu(y-1,x)*m_matu(y-1,x) + m_matv(y-1,x)*m_matv(y-1,x);
-      }
-    if(y+1<m_matu.rows)
-      if(!m_visited(y+1,x) && m_mask(y+1,x)){
-        pixel[3]=cv::Point(x,y+1);
-        magn[3]=m_matu(y+1,x)*m_matu(y+1,x) + m_matv(y+1,x)*m_matv(y+1,x);
-      }
-    if(x-1>=0 && y-1>=0)
-      if(!m_visited(y-1,x-1) && m_mask(y-1,x-1)){
-        pixel[4]=cv::Point(x-1,y-1);
-        magn[4]=m_matu(y-1,x-1)*m_matu(y-1,x-1) +
-            m_matv(y-1,x-1)*m_matv(y-1,x-1);
-      }
-    if(x+1<m_matu.cols && y-1>=0)
-      if(!m_visited(y-1,x+1) && m_mask(y-1,x+1)){
-        pixel[5]=cv::Point(x+1,y-1);
-        magn[5]=m_matu(y-1,x+1)*m_matu(y-1,x+1) +
-            m_matv(y-1,x+1)*m_matv(y-1,x+1);
-      }
-    if(x+1<m_matu.cols && y+1<m_matu.rows)
-      if(!m_visited(y+1,x+1) && m_mask(y+1,x+1)){
-        pixel[6]=cv::Point(x+1,y+1);
-        magn[6]=m_matu(y+1,x+1)*m_matu(y+1,x+1) +
-            m_matv(y+1,x+1)*m_matv(y+1,x+1);
-      }
-    if(x-1>=0 && y+1<m_matu.rows)
-      if(!m_visited(y+1,x-1) && m_mask(y+1,x-1)){
-        pixel[7]=cv::Point(x-1,y+1);
-        magn[7]=m_matu(y+1,x-1)*m_matu(y+1,x-1) +
-            m_matv(y+1,x-1)*m_matv(y+1,x-1);
-      }
+    const int x=m_pixel.x, y=m_pixel.y;
+    // Unvisited neighbors inside the mask and the image
+    const unsigned int nb=m_mask.neighbors8(y,x) & ~m_visited.neighbors8(y,x);
+    for(int i=0; i<8; i++)
+      magn[i]= (nb>>i)&1? freqPow(y+NB_DY[i], x+NB_DX[i]):-1;
 
     int idx=0;
     double mayor=magn[0];
@@ -229,7 +209,7 @@ bool Scanner::next(double fpow)
         found=true;
       }
     if(found){
-      m_pixel=pixel[idx];
+      m_pixel=cv::Point(x+NB_DX[idx], y+NB_DY[idx]);
       insertPixelToPath(m_pixel);
       //CompPoints compara(m_matu, m_matv);
       //m_path.sort(compara);
@@ -242,6 +222,38 @@ bool Scanner::next(double fpow)
   return false;
 }
 
+inline
+bool Scanner::nextStatic(double fpow)
+{
+  while(!m_path.empty()){
+    m_pixel=m_path.back();
+    const double* p=&m_magn[(m_pixel.y+1)*m_stride + m_pixel.x+1];
+
+    // Same selection as next(double): the largest magnitude, the last
+    // neighbor wins the ties.
+    int idx=0;
+    double mayor=p[m_offsets[0]];
+    bool found=mayor>=fpow;
+    for(int i=1; i<8; i++){
+      const double magn=p[m_offsets[i]];
+      if(mayor<=magn && magn>=fpow){
+        mayor=magn;
+        idx=i;
+        found=true;
+      }
+    }
+    if(found){
+      m_pixel.x+=NB_DX[idx];
+      m_pixel.y+=NB_DY[idx];
+      insertPixelToPath(m_pixel);
+      return true;
+    }
+    else
+      m_path.pop_back();
+  }
+  return false;
+}
+
 void Scanner::setInitPosition(cv::Point pixel)
 {
   m_pixel=pixel;
@@ -253,16 +265,96 @@ cv::Point2i Scanner::getPosition()
   return m_pixel;
 }
 
+inline
+double Scanner::freqPow(const int y, const int x)
+{
+  if(m_static)
+    return m_magn[(y+1)*m_stride + x+1];
+  return fieldPow(y, x);
+}
+
+double Scanner::fieldPow(const int y, const int x)
+{
+  if(m_matu.type()==CV_32F){
+    const float u=m_matu.at<float>(y,x), v=m_matv.at<float>(y,x);
+    return u*u + v*v;
+  }
+  const double u=m_matu.at<double>(y,x), v=m_matv.at<double>(y,x);
+  return u*u + v*v;
+}
+
 inline
 void Scanner::insertPixelToPath(const cv::Point& pixel)
 {
   if(m_mask(pixel.y, pixel.x)){
-    m_visited(pixel.y, pixel.x)=true;
+    m_visited.set(pixel.y, pixel.x);
     m_path.push_back(pixel);
+    if(m_static)
+      m_magn[(pixel.y+1)*m_stride + pixel.x+1]=-1;
+    if(m_useFrontier)
+      updateFrontier(pixel);
   }
 }
 
+void Scanner::updateFrontier(const cv::Point& pixel)
+{
+  m_frontier.reset(pixel.y, pixel.x);
+  for(int y=std::max(pixel.y-1, 0); y<=std::min(pixel.y+1, m_matu.rows-1);
+      y++)
+    for(int x=std::max(pixel.x-1, 0); x<=std::min(pixel.x+1, m_matu.cols-1);
+        x++)
+      if(!m_visited(y,x) && m_mask(y,x))
+        m_frontier.set(y, x);
+}
+
+cv::Point Scanner::findFrontier()
+{
+  // The quadrants of findPixel, each row is searched by words.
+  const int rows=m_frontier.rows();
+  const int px=(m_pixel.x>=0 && m_pixel.x<m_frontier.cols())? m_pixel.x:0;
+  const int py=(m_pixel.y>=0 && m_pixel.y<rows)? m_pixel.y:0;
+  int x;
+
+  for(int y=py; y<rows; y++)
+    if((x=m_frontier.findNext(y, px))>=0)
+      return cv::Point(x, y);
+  for(int y=py; y>=0; y--)
+    if((x=m_frontier.findNext(y, px))>=0)
+      return cv::Point(x, y);
+  for(int y=py; y>=0; y--)
+    if((x=m_frontier.findPrev(y, px))>=0)
+      return cv::Point(x, y);
+  for(int y=py; y<rows; y++)
+    if((x=m_frontier.findPrev(y, px))>=0)
+      return cv::Point(x, y);
+  return cv::Point(-1,-1);
+}
+
 void Scanner::updateFreqMin(bool update)
 {
   m_updateMinFreq=update;
 }
+
+void Scanner::useFrontier(bool use)
+{
+  m_useFrontier=use;
+  m_frontier=BitImage();
+  if(!m_useFrontier || m_matu.empty())
+    return;
+
+  // The border points of the pixels visited so far
+  m_frontier.create(m_matu.rows, m_matu.cols);
+  for(int y=0; y<m_matu.rows; y++)
+    for(int x=0; x<m_matu.cols; x++)
+      if(checkNeighbor(cv::Point(x, y)))
+        m_frontier.set(y, x);
+}
+
+void Scanner::recordTo(ScanOrder* order)
+{
+  m_order=order;
+  if(m_order!=NULL){
+    m_order->create(m_matu.rows, m_matu.cols);
+    m_order->push(m_pixel);
+  }
+}
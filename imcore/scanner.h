@@ -34,9 +34,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <opencv2/core/core.hpp>
 #include <list>
 #include <vector>
+#include "bitimage.h"
 
 #endif
 
+class ScanOrder;
+
 /**
  * Scans sequentially the matrix pixels folloging the magnitude of the gradient.
  *
@@ -48,7 +51,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * the flexibility to update these fields outside the class. For example, we
  * can ask a pixel to objects of this class, process data, update
  * the x- and y-direction fields and in the following pixel asking it will
- * use the updated fields automatically.
+ * use the updated fields automatically. The fields can be single or double
+ * precision (CV_32F or CV_64F), both of the same type.
  *
  * @author Julio C. Estrada
  */
@@ -78,6 +82,12 @@ public:
   Scanner(const cv::Mat& mat_u, const cv::Mat& mat_v, cv::Point pixel);
 
   void setMask(cv::Mat mask);
+  /**
+   * Sets the mask of the pixels to scan.
+   *
+   * @param mask the pixels to scan are set, it shares the data.
+   */
+  void setMask(const BitImage& mask);
 #endif
   /**
    * Determines the next pixel point in the sequence.
@@ -121,15 +131,56 @@ public:
    *        be updated.
    */
   void updateFreqMin(bool update);
+  /**
+   * Specifies how the next pixel is found when the path is exhausted.
+   *
+   * When the scanner reaches a dead end, it continues from a border
+   * point, an unvisited pixel next to a visited one. By default the image
+   * is rescanned from the last pixel looking for the first border point,
+   * which costs O(M*N) for each dead end. With the frontier, the scanner
+   * keeps the border points in a bit image, updated as the pixels are
+   * visited, and searches it in the same quadrant order as the rescan,
+   * 64 pixels per word. The border point found, and then the pixel
+   * sequence and the minimum frequency, are the same as without the
+   * frontier. The frontier is disabled by default.
+   *
+   * @param use true to use the frontier, false to rescan the image.
+   */
+  void useFrontier(bool use);
+  /**
+   * Specifies if the frequencies are fixed during the scanning.
+   *
+   * When the frequencies do not change while the scanner is used, as in
+   * the phase unwrapping, the squared magnitudes can be computed once. The
+   * scanner then keeps them in a map with a border of one pixel, where the
+   * visited, masked and border pixels are marked with -1, so the neighbors
+   * are read with a fixed offset table and without bounds checks. The map
+   * holds the same values that are computed from the fields, so the pixel
+   * sequence does not change. It must not be used when the frequencies are
+   * updated outside the scanner, as in the demodulation. It is disabled by
+   * default.
+   *
+   * @param use true if the frequencies are fixed.
+   */
+  void useStaticField(bool use);
+  /**
+   * Records the pixel sequence.
+   *
+   * The sequence is cleared and the current pixel is appended, then each
+   * pixel reached by next is appended.
+   *
+   * @param order where the sequence is recorded, NULL stops recording.
+   */
+  void recordTo(ScanOrder* order);
 
 private:
-  /** The frequencies or differences in x-direction */
-  cv::Mat_<double> m_matu;
-  /** The frequencies or differences in y-direction */
-  cv::Mat_<double> m_matv;
-  cv::Mat_<char> m_mask;
+  /** The frequencies or differences in x-direction, CV_32F or CV_64F */
+  cv::Mat m_matu;
+  /** The frequencies or differences in y-direction, CV_32F or CV_64F */
+  cv::Mat m_matv;
+  BitImage m_mask;
   /** Label field that marks whith true the already visited pixels. */
-  cv::Mat_<bool> m_visited;
+  BitImage m_visited;
   /** The current pixel in the scanning sequence */
   cv::Point m_pixel;
   /** Stores the pixel sequence */
@@ -138,9 +189,49 @@ private:
   double m_freqmin;
   /** Indicates if the minimum frequency to scan is updated*/
   bool m_updateMinFreq;
+  /** Indicates if the border points are taken from the frontier */
+  bool m_useFrontier;
+  /** Marks the border points when the frontier is used */
+  BitImage m_frontier;
+  /** Indicates if the frequencies are fixed */
+  bool m_static;
+  /**
+   * Squared magnitudes of the fixed frequencies with a border of one
+   * pixel, -1 marks the pixels that can not be visited.
+   */
+  std::vector<double> m_magn;
+  /** Row step of m_magn */
+  int m_stride;
+  /** Offsets of the 8 neighbors in m_magn */
+  int m_offsets[8];
+  /** Where the sequence is recorded, it can be NULL */
+  ScanOrder* m_order;
+
+  /** Computes the map of squared magnitudes */
+  void buildMagnitudes();
+  /** Computes the squared frequency magnitude at (x,y) from the fields */
+  double fieldPow(const int y, const int x);
+  /** next(double) for fixed frequencies */
+  bool nextStatic(double magn);
+
+  /** Allocates the visited field and the frontier */
+  void init(const cv::Mat& mat_u, const cv::Mat& mat_v);
+  /**
+   * Removes the visited pixel from the frontier and adds its unvisited
+   * neighbors.
+   */
+  void updateFrontier(const cv::Point& pixel);
+  /**
+   * Finds in the frontier the border point that findPixel returns.
+   *
+   * @return the border point or (-1,-1) if there is none.
+   */
+  cv::Point findFrontier();
 
   /** Inserts the pixel to the path and marks it as visited*/
   void insertPixelToPath(const cv::Point& pixel);
+  /** Returns the squared frequency magnitude at (x,y) */
+  double freqPow(const int y, const int x);
   /** }
    * Moves to the next pixel in the path.
    *
@@ -0,0 +1,133 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <fstream>
+#include "scanorder.h"
+
+namespace{
+
+/** First word of the files, "FPSO" */
+const uint32_t SCANORDER_MAGIC=0x4f535046;
+const uint32_t SCANORDER_VERSION=1;
+
+void throwError(const std::string& msg, const std::string& func,
+                const int line) throw(cv::Exception)
+{
+  cv::Exception e(1000, msg, func, std::string(__FILE__), line);
+  throw(e);
+}
+
+}
+
+ScanOrder::ScanOrder()
+:m_rows(0), m_cols(0)
+{
+}
+
+ScanOrder::ScanOrder(const int rows, const int cols)
+:m_rows(0), m_cols(0)
+{
+  create(rows, cols);
+}
+
+void ScanOrder::create(const int rows, const int cols)
+{
+  CV_Assert(rows>=0 && cols>=0 &&
+            (double)rows*cols<=(double)0xffffffffu);
+  m_rows=rows;
+  m_cols=cols;
+  m_indices.clear();
+}
+
+void ScanOrder::push(const cv::Point pixel)
+{
+  m_indices.push_back((uint32_t)pixel.y*m_cols + pixel.x);
+}
+
+int ScanOrder::size() const
+{
+  return (int)m_indices.size();
+}
+
+int ScanOrder::rows() const
+{
+  return m_rows;
+}
+
+int ScanOrder::cols() const
+{
+  return m_cols;
+}
+
+void ScanOrder::save(const std::string& filename) const
+  throw(cv::Exception)
+{
+  std::ofstream file(filename.c_str(), std::ios::binary);
+  if(!file)
+    throwError("Can not open " + filename, "ScanOrder::save", __LINE__);
+
+  const uint32_t header[5]={SCANORDER_MAGIC, SCANORDER_VERSION,
+                            (uint32_t)m_rows, (uint32_t)m_cols,
+                            (uint32_t)m_indices.size()};
+  file.write((const char*)header, sizeof(header));
+  if(!m_indices.empty())
+    file.write((const char*)&m_indices[0],
+               m_indices.size()*sizeof(uint32_t));
+  if(!file)
+    throwError("Can not write " + filename, "ScanOrder::save", __LINE__);
+}
+
+void ScanOrder::load(const std::string& filename) throw(cv::Exception)
+{
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if(!file)
+    throwError("Can not open " + filename, "ScanOrder::load", __LINE__);
+
+  uint32_t header[5];
+  file.read((char*)header, sizeof(header));
+  if(!file || header[0]!=SCANORDER_MAGIC || header[1]!=SCANORDER_VERSION)
+    throwError(filename + " is not a scan order", "ScanOrder::load",
+               __LINE__);
+
+  const uint32_t count=header[4];
+  const double total=(double)header[2]*header[3];
+  if(header[2]>0x7fffffff || header[3]>0x7fffffff ||
+     total>(double)0xffffffffu || (double)count>total)
+    throwError(filename + " is corrupted", "ScanOrder::load", __LINE__);
+  std::vector<uint32_t> indices(count);
+  if(count>0)
+    file.read((char*)&indices[0], count*sizeof(uint32_t));
+  if(!file)
+    throwError(filename + " is truncated", "ScanOrder::load", __LINE__);
+  for(uint32_t k=0; k<count; k++)
+    if((double)indices[k]>=total)
+      throwError(filename + " is corrupted", "ScanOrder::load", __LINE__);
+
+  create((int)header[2], (int)header[3]);
+  m_indices.swap(indices);
+}
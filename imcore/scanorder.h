@@ -0,0 +1,146 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#ifndef SCANORDER_H
+#define SCANORDER_H
+
+#ifndef SWIG
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#endif
+
+/**
+ * A recorded pixel sequence of a scanner.
+ *
+ * The scanning path depends only on the frequencies and the mask, so when
+ * many frames with the same mask and similar fringes are processed, the
+ * path found for one frame can be used for the others. The pixels are
+ * stored as 32-bit linear indexes, y*cols + x, and the sequence can be
+ * saved to a file and loaded later.
+ *
+ * The sequence is recorded with Scanner::recordTo, or with the record
+ * methods of DemodGabor and Unwrap, and it is followed with their replay
+ * methods.
+ *
+ * @author Julio C. Estrada
+ */
+class ScanOrder
+{
+public:
+  /**
+   * Distance, in pixels of the sequence, at which the data of the next
+   * pixels is requested to the cache while replaying.
+   */
+  enum { PREFETCH_DISTANCE=8 };
+
+  /**
+   * Default constructor, builds an empty sequence.
+   */
+  ScanOrder();
+  /**
+   * Builds an empty sequence for images of the given size.
+   *
+   * @param rows the number of rows of the images.
+   * @param cols the number of columns of the images.
+   */
+  ScanOrder(const int rows, const int cols);
+
+  /**
+   * Removes the pixels and sets the size of the images.
+   *
+   * @param rows the number of rows of the images.
+   * @param cols the number of columns of the images.
+   */
+  void create(const int rows, const int cols);
+  /**
+   * Appends a pixel to the sequence.
+   *
+   * @param pixel the pixel position.
+   */
+  void push(const cv::Point pixel);
+  /**
+   * Returns the number of pixels in the sequence.
+   */
+  int size() const;
+  int rows() const;
+  int cols() const;
+  /**
+   * Returns the k-th pixel of the sequence.
+   */
+  cv::Point point(const int k) const;
+
+  /**
+   * Saves the sequence to a binary file.
+   *
+   * The file stores the image size and the indexes in the byte order of
+   * the machine.
+   *
+   * @param filename the file name.
+   * @throw Exception if the file can not be written.
+   */
+  void save(const std::string& filename) const throw(cv::Exception);
+  /**
+   * Loads a sequence saved with save.
+   *
+   * @param filename the file name.
+   * @throw Exception if the file can not be read or it is not a sequence.
+   */
+  void load(const std::string& filename) throw(cv::Exception);
+
+#ifndef SWIG
+  /**
+   * Requests to the cache the element (x,y) of the matrix.
+   */
+  static void prefetch(const cv::Mat& mat, const cv::Point pixel);
+#endif
+
+private:
+  std::vector<uint32_t> m_indices;
+  int m_rows, m_cols;
+};
+
+#ifndef SWIG
+inline
+cv::Point ScanOrder::point(const int k) const
+{
+  const uint32_t idx=m_indices[k];
+  return cv::Point(idx%m_cols, idx/m_cols);
+}
+
+inline
+void ScanOrder::prefetch(const cv::Mat& mat, const cv::Point pixel)
+{
+#ifdef __GNUC__
+  __builtin_prefetch(mat.ptr(pixel.y) + pixel.x*mat.elemSize());
+#endif
+}
+#endif
+
+#endif
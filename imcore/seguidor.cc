@@ -28,6 +28,264 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "seguidor.h"
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace{
+
+/**Numero de puntos de cada bloque del arena*/
+const int TAM_BLOQUE=1024;
+
+/**Posicion del bit encendido mas bajo, la palabra no debe ser cero*/
+inline
+int bitBajo(uint64_t palabra)
+{
+#ifdef __GNUC__
+  return __builtin_ctzll(palabra);
+#else
+  int b=0;
+  while(!(palabra&1)){
+    palabra>>=1;
+    b++;
+  }
+  return b;
+#endif
+}
+
+/**Posicion del bit encendido mas alto, la palabra no debe ser cero*/
+inline
+int bitAlto(uint64_t palabra)
+{
+#ifdef __GNUC__
+  return 63-__builtin_clzll(palabra);
+#else
+  int b=0;
+  while(palabra>>=1)
+    b++;
+  return b;
+#endif
+}
+
+/**
+ *Clave de la ColaRadix para una calidad.
+ *Los bits del flotante se transforman para que el orden de los enteros sea
+ *el de los flotantes y se invierten, asi la mayor calidad tiene la menor
+ *clave. Los NaN tienen la mayor clave.
+ */
+inline
+uint32_t claveCalidad(const float q)
+{
+  if(q!=q)
+    return 0xffffffffu;
+  uint32_t u;
+  std::memcpy(&u, &q, sizeof(u));
+  u= (u&0x80000000u)? ~u:(u|0x80000000u);
+  return ~u;
+}
+
+/**
+ *Minimo y maximo de un renglon de n>0 valores.
+ */
+inline
+void minMaxRenglon(const float* p, const int n, float& mn, float& mx)
+{
+  int j=0;
+  mn=p[0];
+  mx=p[0];
+#ifdef __SSE2__
+  if(n>=4){
+    __m128 vmn=_mm_loadu_ps(p), vmx=vmn;
+    for(j=4; j+4<=n; j+=4){
+      const __m128 v=_mm_loadu_ps(p+j);
+      vmn=_mm_min_ps(vmn, v);
+      vmx=_mm_max_ps(vmx, v);
+    }
+    float tmn[4], tmx[4];
+    _mm_storeu_ps(tmn, vmn);
+    _mm_storeu_ps(tmx, vmx);
+    for(int k=0; k<4; k++){
+      mn=std::min(mn, tmn[k]);
+      mx=std::max(mx, tmx[k]);
+    }
+  }
+#endif
+  for(; j<n; j++){
+    mn=std::min(mn, p[j]);
+    mx=std::max(mx, p[j]);
+  }
+}
+
+/**
+ *Maximo de un renglon de n>0 valores.
+ */
+inline
+float maxRenglon(const float* p, const int n)
+{
+  int j=0;
+  float mx=p[0];
+#ifdef __SSE2__
+  if(n>=4){
+    __m128 vmx=_mm_loadu_ps(p);
+    for(j=4; j+4<=n; j+=4)
+      vmx=_mm_max_ps(vmx, _mm_loadu_ps(p+j));
+    float tmx[4];
+    _mm_storeu_ps(tmx, vmx);
+    for(int k=0; k<4; k++)
+      mx=std::max(mx, tmx[k]);
+  }
+#endif
+  for(; j<n; j++)
+    mx=std::max(mx, p[j]);
+  return mx;
+}
+
+/**
+ *Reduce los minimos y maximos de los renglones.
+ */
+void reduceMinMax(const std::vector<float>& minimos,
+                  const std::vector<float>& maximos, float& a, float& b)
+{
+  a=0;
+  b=0;
+  if(minimos.empty())
+    return;
+  a=*std::min_element(minimos.begin(), minimos.end());
+  b=*std::max_element(maximos.begin(), maximos.end());
+}
+
+/**
+ *Calcula por renglones la magnitud al cuadrado del gradiente de la imagen
+ *y el maximo de cada renglon. El minimo no se necesita porque los niveles
+ *de calcQualityMap empiezan en cero.
+ *
+ *Las diferencias son hacia atras, excepto en el primer renglon y la primera
+ *columna donde son hacia adelante. Como se toma el cuadrado, el signo de la
+ *diferencia no importa.
+ */
+class MagnitudGradiente: public cv::ParallelLoopBody
+{
+public:
+  MagnitudGradiente(const cv::Mat& g, cv::Mat& path,
+                    std::vector<float>& maximos)
+  :m_g(g), m_path(path), m_maximos(&maximos)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    const int nr=m_g.rows, nc=m_g.cols;
+    cv::Mat g=m_g, path=m_path;
+    for(int i=r.start; i<r.end; i++){
+      const float* p=g.ptr<float>(i);
+      const float* q=g.ptr<float>(i>0? i-1:std::min(1, nr-1));
+      float* m=path.ptr<float>(i);
+
+      //Primera columna
+      const float dx0=p[0]-q[0], dy0= nc>1? p[0]-p[1]:0;
+      m[0]=dx0*dx0 + dy0*dy0;
+      int j=1;
+#ifdef __SSE2__
+      for(; j+4<=nc; j+=4){
+        const __m128 v=_mm_loadu_ps(p+j);
+        const __m128 dx=_mm_sub_ps(v, _mm_loadu_ps(q+j));
+        const __m128 dy=_mm_sub_ps(v, _mm_loadu_ps(p+j-1));
+        _mm_storeu_ps(m+j, _mm_add_ps(_mm_mul_ps(dx, dx),
+                                      _mm_mul_ps(dy, dy)));
+      }
+#endif
+      for(; j<nc; j++){
+        const float dx=p[j]-q[j], dy=p[j]-p[j-1];
+        m[j]=dx*dx + dy*dy;
+      }
+      (*m_maximos)[i]=maxRenglon(m, nc);
+    }
+  }
+
+private:
+  const cv::Mat m_g;
+  cv::Mat m_path;
+  std::vector<float>* m_maximos;
+};
+
+/**
+ *Calcula el minimo y maximo de cada renglon de un mapa.
+ */
+class MinMaxRenglones: public cv::ParallelLoopBody
+{
+public:
+  MinMaxRenglones(const cv::Mat& map, std::vector<float>& minimos,
+                  std::vector<float>& maximos)
+  :m_map(map), m_minimos(&minimos), m_maximos(&maximos)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    for(int i=r.start; i<r.end; i++)
+      minMaxRenglon(m_map.ptr<float>(i), m_map.cols, (*m_minimos)[i],
+                    (*m_maximos)[i]);
+  }
+
+private:
+  const cv::Mat m_map;
+  std::vector<float>* m_minimos;
+  std::vector<float>* m_maximos;
+};
+
+/**
+ *Cuantiza un mapa en niveles de ancho (b-a)/levels.
+ *
+ *El nivel de un valor p es min(floor((p-a)/step), levels-1), que es el
+ *intervalo [a+l*step, a+(l+1)*step) que lo contiene, o el ultimo nivel si
+ *p==b, asi que no hay que probar cada nivel.
+ */
+class Cuantizador: public cv::ParallelLoopBody
+{
+public:
+  Cuantizador(const cv::Mat& path, cv::Mat& qmap, const double a,
+              const double b, const int levels)
+  :m_path(path), m_qmap(qmap), m_a((float)a),
+   m_escala((float)(levels/(b-a))), m_tope((float)(levels-1))
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    const int nc=m_path.cols;
+    cv::Mat qmap=m_qmap;
+    for(int i=r.start; i<r.end; i++){
+      const float* p=m_path.ptr<float>(i);
+      uchar* q=qmap.ptr<uchar>(i);
+      int j=0;
+#ifdef __SSE2__
+      const __m128 a=_mm_set1_ps(m_a), escala=_mm_set1_ps(m_escala);
+      const __m128 cero=_mm_setzero_ps(), tope=_mm_set1_ps(m_tope);
+      for(; j+16<=nc; j+=16){
+        __m128i l[4];
+        for(int k=0; k<4; k++){
+          __m128 v=_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p+j+4*k), a), escala);
+          v=_mm_min_ps(_mm_max_ps(v, cero), tope);
+          l[k]=_mm_cvttps_epi32(v);
+        }
+        const __m128i l16a=_mm_packs_epi32(l[0], l[1]);
+        const __m128i l16b=_mm_packs_epi32(l[2], l[3]);
+        _mm_storeu_si128((__m128i*)(q+j), _mm_packus_epi16(l16a, l16b));
+      }
+#endif
+      for(; j<nc; j++){
+        const float v=(p[j]-m_a)*m_escala;
+        q[j]=(uchar)std::min(std::max(v, 0.f), m_tope);
+      }
+    }
+  }
+
+private:
+  const cv::Mat m_path;
+  cv::Mat m_qmap;
+  const float m_a, m_escala, m_tope;
+};
+
+}
 
 Punto::Punto(int row, int col)
 {
@@ -59,38 +317,29 @@ Punto::Punto(const Punto& cpy)
 
 void Seguidor::calcQualityMap(int levels)
 {
-  int nr=_I.rows;
-  int nc=_I.cols;
-  cv::Mat dx(nr,nc, CV_32FC1);
-  cv::Mat dy(nr,nc, CV_32FC1);
+  const int nr=_I.rows;
   cv::Mat g=_I;
+  cv::Mat path(nr, _I.cols, CV_32FC1);
+  std::vector<float> maximos(nr);
 
-  cv::Mat qmap=_qmap;
-  cv::Mat path(nr,nc, CV_32FC1);
-
-  double a=0,b=0;
-  for(int i=0; i<nr; i++)
-    for(int j=0; j<nc; j++){
-      if(i-1>=0)
-        dx.at<float>(i,j)=g.at<float>(i,j) - g.at<float>(i-1,j);
-      else
-        dx.at<float>(i,j)=g.at<float>(i+1,j) - g.at<float>(i,j);
-      if(j-1>=0)
-        dy.at<float>(i,j)=g.at<float>(i,j) - g.at<float>(i,j-1);
-      else
-        dy.at<float>(i,j)=g.at<float>(i,j+1) - g.at<float>(i,j);
-      path.at<float>(i,j)=dx.at<float>(i,j)*dx.at<float>(i,j) +
-          dy.at<float>(i,j)*dy.at<float>(i,j);
-      a=(a>path.at<float>(i,j))? path.at<float>(i,j):a;
-      b=(b<path.at<float>(i,j))? path.at<float>(i,j):b;
-    }
-    double step=(b-a)/levels;
-    for(int i=0; i<nr; i++)
-      for(int j=0; j<nc; j++){
-        for(int l=0; l<levels; l++)
-          if(path.at<float>(i,j)>=(a+l*step) && path.at<float>(i,j)<=((l+1)*step))
-            qmap.at<uchar>(i,j)=l;
-      }
+  cv::parallel_for_(cv::Range(0, nr), MagnitudGradiente(g, path, maximos));
+  const float b= nr>0? *std::max_element(maximos.begin(), maximos.end()):0;
+  //Los niveles empiezan en cero como en la definicion de M_n, no en el
+  //minimo del mapa
+  cuantiza(path, 0, b, levels);
+}
+
+void Seguidor::cuantiza(const cv::Mat& path, const double a, const double b,
+                        const int levels)
+{
+  CV_Assert(levels>0 && levels<=256);
+  if(!(b>a)){
+    //Mapa constante, todos los puntos caen en el ultimo nivel
+    _qmap.setTo(cv::Scalar(levels-1));
+    return;
+  }
+  cv::parallel_for_(cv::Range(0, path.rows),
+                    Cuantizador(path, _qmap, a, b, levels));
 }
 
 void Seguidor::set_inicio()
@@ -112,7 +361,7 @@ void Seguidor::set_inicio()
        }
      }
    _punto.set(i_init,j_init);
-   _colas[qmap.at<uchar>(i_init,j_init)].push_back(_punto);
+   mete(qmap.at<uchar>(i_init,j_init), i_init, j_init);
    _caminado.at<uchar>(i_init,j_init)=true;
 }
 
@@ -252,14 +501,118 @@ void Seguidor::cargaVecinos()
   ordenaVecinos(vecinos);
   for(int k=0; k<8; k++)
     if(vecinos[k].valid){
-      _colas[_qmap.at<uchar>(vecinos[k].r,vecinos[k].c)].push_back(vecinos[k]);
+      encola(vecinos[k].r, vecinos[k].c);
     }
 }
 
+inline
+void Seguidor::encola(const int r, const int c)
+{
+  if(_continuo)
+    _radix.mete(claveCalidad(_qmap.at<float>(r,c)), r*_I.cols + c);
+  else
+    mete(_qmap.at<uchar>(r,c), r, c);
+}
+
+void Seguidor::iniciaColas(int levels)
+{
+  Cola vacia;
+  vacia.cabeza=-1;
+  vacia.lectura=0;
+  vacia.ultimo=-1;
+  vacia.escritura=0;
+  _colas.assign(levels, vacia);
+  _noVacios.assign((levels+63)/64, 0);
+  _arena.clear();
+  _enlaces.clear();
+  _libres.clear();
+}
+
+int Seguidor::nuevoBloque()
+{
+  int b;
+  if(!_libres.empty()){
+    b=_libres.back();
+    _libres.pop_back();
+  }
+  else{
+    b=(int)_enlaces.size();
+    _enlaces.push_back(-1);
+    _arena.resize(_enlaces.size()*TAM_BLOQUE);
+  }
+  _enlaces[b]=-1;
+  return b;
+}
+
+inline
+void Seguidor::mete(const int nivel, const int r, const int c)
+{
+  Cola& cola=_colas[nivel];
+  if(cola.cabeza<0){
+    cola.cabeza=cola.ultimo=nuevoBloque();
+    cola.lectura=cola.escritura=0;
+    _noVacios[nivel/64]|= (uint64_t)1<<(nivel%64);
+  }
+  else if(cola.escritura==TAM_BLOQUE){
+    const int b=nuevoBloque();
+    _enlaces[cola.ultimo]=b;
+    cola.ultimo=b;
+    cola.escritura=0;
+  }
+  _arena[cola.ultimo*TAM_BLOQUE + cola.escritura++]=r*_I.cols + c;
+}
+
+inline
+unsigned int Seguidor::saca(const int nivel)
+{
+  Cola& cola=_colas[nivel];
+  const unsigned int idx=_arena[cola.cabeza*TAM_BLOQUE + cola.lectura++];
+
+  if(cola.cabeza==cola.ultimo && cola.lectura==cola.escritura){
+    //La cola queda vacia y su bloque se puede reutilizar
+    _libres.push_back(cola.cabeza);
+    cola.cabeza=-1;
+    _noVacios[nivel/64]&= ~((uint64_t)1<<(nivel%64));
+  }
+  else if(cola.lectura==TAM_BLOQUE){
+    const int b=_enlaces[cola.cabeza];
+    _libres.push_back(cola.cabeza);
+    cola.cabeza=b;
+    cola.lectura=0;
+  }
+  return idx;
+}
+
+int Seguidor::nivelSiguiente(int nivel) const
+{
+  const int nw=(int)_noVacios.size();
+  nivel=std::min(std::max(nivel, 0), _levels-1);
+
+  //Primero el nivel no vacio mas bajo por encima del nivel dado
+  const int arriba=nivel+1;
+  for(int w=arriba/64; w<nw; w++){
+    uint64_t palabra=_noVacios[w];
+    if(w==arriba/64)
+      palabra&= ~(((uint64_t)1<<(arriba%64)) - 1);
+    if(palabra)
+      return w*64 + bitBajo(palabra);
+  }
+  //Despues el nivel no vacio mas alto que no pasa del nivel dado
+  for(int w=nivel/64; w>=0; w--){
+    uint64_t palabra=_noVacios[w];
+    if(w==nivel/64 && nivel%64<63)
+      palabra&= ((uint64_t)2<<(nivel%64)) - 1;
+    if(palabra)
+      return w*64 + bitAlto(palabra);
+  }
+  return -1;
+}
+
 Seguidor::Seguidor(const cv::Mat& I,int levels)
 {
   _I=I;
-  _colas=new std::list<Punto>[levels];
+  _continuo=false;
+  iniciaColas(levels);
   _m=cv::Mat::zeros(_I.rows, _I.cols, CV_8U);
   _caminado=cv::Mat::zeros(_I.rows, _I.cols, CV_8U);
   _qmap=cv::Mat::zeros(_I.rows, _I.cols, CV_8U);
@@ -274,7 +627,8 @@ Seguidor::Seguidor(const cv::Mat& I,int levels)
 Seguidor::Seguidor(const cv::Mat& I,int r, int c, int levels)
 {
   _I=I;
-  _colas=new std::list<Punto>[(int)levels];
+  _continuo=false;
+  iniciaColas(levels);
   _m=cv::Mat::zeros(_I.rows, _I.cols, CV_8U);
   _caminado=cv::Mat::zeros(_I.rows, _I.cols, CV_8U);
   _qmap=cv::Mat::zeros(_I.rows, _I.cols, CV_8U);
@@ -284,11 +638,44 @@ Seguidor::Seguidor(const cv::Mat& I,int r, int c, int levels)
   calcQualityMap(levels);
   //Finalmente establecemos el punto inicial
   _punto.set(r,c);
-  _colas[_qmap.at<uchar>(r,c)].push_back(_punto);
+  mete(_qmap.at<uchar>(r,c), r, c);
+  _caminado.at<uchar>(r,c)=1;
+  cargaVecinos();
+}
+
+Seguidor::Seguidor(const cv::Mat& calidad)
+{
+  iniciaContinuo(calidad);
+  //El punto inicial es el de mayor calidad
+  cv::Point inicio;
+  cv::minMaxLoc(_qmap, NULL, NULL, NULL, &inicio);
+  _punto.set(inicio.y, inicio.x);
+  encola(inicio.y, inicio.x);
+  _caminado.at<uchar>(inicio.y, inicio.x)=1;
+  cargaVecinos();
+}
+
+Seguidor::Seguidor(const cv::Mat& calidad, int r, int c)
+{
+  iniciaContinuo(calidad);
+  _punto.set(r,c);
+  encola(r, c);
   _caminado.at<uchar>(r,c)=1;
   cargaVecinos();
 }
 
+void Seguidor::iniciaContinuo(const cv::Mat& calidad)
+{
+  CV_Assert(calidad.channels()==1);
+  _continuo=true;
+  _levels=0;
+  calidad.convertTo(_qmap, CV_32F);
+  _I=_qmap;
+  _m=cv::Mat::zeros(_I.rows, _I.cols, CV_8U);
+  _caminado=cv::Mat::zeros(_I.rows, _I.cols, CV_8U);
+  _radix.limpia();
+}
+
 int Seguidor::get_c()
 {
   return _punto.c;
@@ -306,21 +693,21 @@ cv::Mat Seguidor::get_qmap()
 
 bool Seguidor::siguiente()
 {
-  std::list<Punto>* cola=NULL;
-  int level=_qmap.at<char>(_punto.r, _punto.c);
-  for(int i=level; i>=0; i--)
-    if(_colas[i].begin()!=_colas[i].end()){
-      cola=_colas+i;
-      break;
+  if(_continuo){
+    if(_radix.vacia()){
+      _punto.valid=false;
+      return false;
     }
-  for(int i=level+1; i<_levels; i++)
-    if(_colas[i].begin()!=_colas[i].end()){
-      cola=_colas+i;
-      break;
-    }
-  if(cola!=NULL){
-    _punto=cola->front();
-    cola->pop_front();
+    const unsigned int idx=_radix.saca();
+    _punto.set(idx/_I.cols, idx%_I.cols);
+    cargaVecinos();
+    return true;
+  }
+
+  const int nivel=nivelSiguiente(_qmap.at<uchar>(_punto.r, _punto.c));
+  if(nivel>=0){
+    const unsigned int idx=saca(nivel);
+    _punto.set(idx/_I.cols, idx%_I.cols);
     cargaVecinos();
     return true;
   }
@@ -330,28 +717,87 @@ bool Seguidor::siguiente()
 
 void Seguidor::setQMap(const cv::Mat& qmap)
 {
+  if(_continuo){
+    //El mapa continuo no se cuantiza
+    qmap.convertTo(_qmap, CV_32F);
+    return;
+  }
+  const int nr=qmap.rows;
   _qmap.create(qmap.rows, qmap.cols, CV_8U);
-  cv::Mat map=qmap;
-
-  double a,b;
-  a=map.at<uchar>(0,0);
-  b=a;
-  for(int i=0; i<_qmap.rows; i++)
-    for(int j=0; j<_qmap.cols; j++){
-      a=(a>map.at<uchar>(i,j))? map.at<uchar>(i,j):a;
-      b=(b<map.at<uchar>(i,j))? map.at<uchar>(i,j):b;
-    }
-  int levels=_levels;
-  double step=(b-a)/levels;
-  for(int i=0; i<_qmap.rows; i++)
-    for(int j=0; j<_qmap.cols; j++){
-      for(int l=0; l<levels; l++)
-        if(map.at<uchar>(i,j)>=(a+l*step) && map.at<uchar>(i,j)<=((l+1)*step))
-          _qmap.at<uchar>(i,j)=l;
-    }
+  cv::Mat map;
+  qmap.convertTo(map, CV_32F);
+  std::vector<float> minimos(nr), maximos(nr);
+
+  cv::parallel_for_(cv::Range(0, nr), MinMaxRenglones(map, minimos, maximos));
+  float a, b;
+  reduceMinMax(minimos, maximos, a, b);
+  cuantiza(map, a, b, _levels);
 }
 
 Seguidor::~Seguidor()
 {
-  delete []_colas;
+}
+
+ColaRadix::ColaRadix()
+:_lectura(0), _noVacias(0), _ultima(0), _tam(0)
+{
+}
+
+inline
+int ColaRadix::cubeta(uint32_t clave) const
+{
+  return clave==_ultima? 0:bitAlto(clave^_ultima) + 1;
+}
+
+void ColaRadix::mete(uint32_t clave, uint32_t valor)
+{
+  //La cola es monotona, no puede salir una clave menor que la ultima
+  if(clave<_ultima)
+    clave=_ultima;
+  const int b=cubeta(clave);
+  const Elemento e={clave, valor};
+  _cubetas[b].push_back(e);
+  _noVacias|= (uint64_t)1<<b;
+  _tam++;
+}
+
+uint32_t ColaRadix::saca()
+{
+  if(_lectura==_cubetas[0].size()){
+    //La cubeta 0 se agoto, la primera cubeta no vacia tiene la menor
+    //clave y sus elementos se reparten en las cubetas de abajo
+    _cubetas[0].clear();
+    _lectura=0;
+    _noVacias&= ~(uint64_t)1;
+    const int i=bitBajo(_noVacias);
+    std::vector<Elemento>& cub=_cubetas[i];
+    uint32_t minimo=cub[0].clave;
+    for(size_t k=1; k<cub.size(); k++)
+      minimo=std::min(minimo, cub[k].clave);
+    _ultima=minimo;
+    for(size_t k=0; k<cub.size(); k++){
+      const int b=cubeta(cub[k].clave);
+      _cubetas[b].push_back(cub[k]);
+      _noVacias|= (uint64_t)1<<b;
+    }
+    cub.clear();
+    _noVacias&= ~((uint64_t)1<<i);
+  }
+  _tam--;
+  return _cubetas[0][_lectura++].valor;
+}
+
+bool ColaRadix::vacia() const
+{
+  return _tam==0;
+}
+
+void ColaRadix::limpia()
+{
+  for(int i=0; i<33; i++)
+    _cubetas[i].clear();
+  _lectura=0;
+  _noVacias=0;
+  _ultima=0;
+  _tam=0;
 }
@@ -30,7 +30,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define SEGUIDOR_H_
 
 #include <opencv2/core/core.hpp>
-#include <list>
+#include <stdint.h>
+#include <vector>
 
 class Punto{
   friend class Seguidor;
@@ -45,6 +46,48 @@ private:
    bool valid;
 };
 
+/**
+ * Cola de prioridad monotona (radix heap) de claves de 32 bits.
+ *
+ * Saca los elementos de menor clave. Como en las colas jerarquicas, las
+ * claves que se meten no pueden ser menores que la ultima clave sacada;
+ * una clave menor se toma igual a la ultima y el elemento sale en seguida.
+ * Los elementos se guardan en 33 cubetas segun el bit mas alto en el que
+ * su clave difiere de la ultima clave sacada, cada elemento cambia de
+ * cubeta a lo mas 32 veces, asi que meter y sacar cuesta O(1) amortizado.
+ *
+ * @author Julio Cesar Estrada Rico
+ */
+class ColaRadix{
+ public:
+    ColaRadix();
+    /**Mete un elemento con la clave dada.*/
+    void mete(uint32_t clave, uint32_t valor);
+    /**Saca el elemento de menor clave, la cola no debe estar vacia.*/
+    uint32_t saca();
+    /**Regresa true si la cola esta vacia.*/
+    bool vacia() const;
+    /**Vacia la cola.*/
+    void limpia();
+ private:
+    struct Elemento{
+      uint32_t clave;
+      uint32_t valor;
+    };
+    /**Cubeta 0: claves iguales a la ultima. Cubeta i>0: claves cuyo bit
+       mas alto distinto de la ultima clave es el bit i-1*/
+    std::vector<Elemento> _cubetas[33];
+    /**Posicion de lectura de la cubeta 0*/
+    size_t _lectura;
+    /**Un bit por cubeta, encendido si no esta vacia*/
+    uint64_t _noVacias;
+    /**La ultima clave sacada*/
+    uint32_t _ultima;
+    size_t _tam;
+
+    int cubeta(uint32_t clave) const;
+};
+
 /**
  * Esta clase implementa los mecanismos para seguir las franjas de una im?gen
  * con patrones de franjas dado.
@@ -146,8 +189,36 @@ class Seguidor{
        gradiente como se explico anteriormente.
      */
     cv::Mat _qmap;
+    /**Cola FIFO de un nivel, formada por bloques del arena.*/
+    struct Cola{
+      /**Bloque de donde se sacan los puntos, -1 si la cola esta vacia*/
+      int cabeza;
+      /**Posicion de lectura en el bloque cabeza*/
+      int lectura;
+      /**Bloque donde se meten los puntos*/
+      int ultimo;
+      /**Posicion de escritura en el ultimo bloque*/
+      int escritura;
+    };
     /**Es un arrglo de registros para cada nivel de cauntizaci?n.*/
-    std::list<Punto>* _colas;
+    std::vector<Cola> _colas;
+    /**Arena de bloques que comparten las colas.
+
+       Los puntos se guardan como indices lineales r*cols + c. Cuando un
+       bloque se vacia regresa a la lista de libres, asi que solo se pide
+       memoria cuando crece el numero de puntos encolados.
+     */
+    std::vector<unsigned int> _arena;
+    /**Siguiente bloque de cada bloque dentro de su cola, -1 si es el ultimo*/
+    std::vector<int> _enlaces;
+    /**Bloques libres del arena*/
+    std::vector<int> _libres;
+    /**Un bit por nivel, encendido si la cola del nivel no esta vacia*/
+    std::vector<uint64_t> _noVacios;
+    /**Indica si el mapa de calidad es continuo en lugar de niveles*/
+    bool _continuo;
+    /**Cola de los puntos cuando el mapa de calidad es continuo*/
+    ColaRadix _radix;
     /**Es el punto que actualmente es recorrido.*/
     Punto _punto;
     /**Numero de niveles del mapa de calidad*/
@@ -176,6 +247,18 @@ class Seguidor{
      *@todo Considerar el uso de m?scara sobre el dominio.
      */
      void calcQualityMap(int levels);
+     /**
+      *Cuantiza un mapa de calidad en el numero de niveles dado.
+      *Los niveles dividen el intervalo [a,b] en partes iguales y el nivel
+      *de cada punto se calcula directamente, sin probar cada nivel. Lo usan
+      *calcQualityMap y setQMap.
+      *@param path el mapa de calidad de tipo CV_32F
+      *@param a el inicio del primer nivel
+      *@param b el final del ultimo nivel
+      *@param levels el numero de niveles, a lo mas 256
+      */
+     void cuantiza(const cv::Mat& path, const double a, const double b,
+                   const int levels);
 
      /**
      *Establece autom?ticamente el punto incial.
@@ -186,6 +269,39 @@ class Seguidor{
      *@todo Considerar el uso de m?scara sobre el dominio.
      **/
      void set_inicio();
+     /**
+      *Prepara las colas vacias para el numero de niveles dado.
+      */
+     void iniciaColas(int levels);
+     /**
+      *Mete el punto (r,c) al final de la cola del nivel dado.
+      */
+     void mete(const int nivel, const int r, const int c);
+     /**
+      *Saca el primer punto de la cola del nivel dado, la cola no debe estar
+      *vacia.
+      *@return el indice lineal del punto
+      */
+     unsigned int saca(const int nivel);
+     /**
+      *Toma un bloque libre del arena o agrega uno nuevo.
+      */
+     int nuevoBloque();
+     /**
+      *Busca la cola de donde se saca el siguiente punto.
+      *Es el nivel no vacio mas bajo por encima del nivel dado, o si no lo
+      *hay, el nivel no vacio mas alto que no pasa del nivel dado.
+      *@return el nivel o -1 si todas las colas estan vacias
+      */
+     int nivelSiguiente(int nivel) const;
+     /**
+      *Encola el punto (r,c) segun su calidad.
+      */
+     void encola(const int r, const int c);
+     /**
+      *Prepara el seguidor con un mapa de calidad continuo.
+      */
+     void iniciaContinuo(const cv::Mat& calidad);
      /**
      *Carga los vecinos m?s pr?ximos del punto actual que se est? recorriendo.
      *@todo Considerar el uso de m?scara sobre el dominio.
@@ -229,6 +345,24 @@ class Seguidor{
      * m?scara que ser? plicada al dominio del seguidor.
      */
     Seguidor(const cv::Mat& I,int r, int c, int levels);
+    /** Crea un seguidor guiado por un mapa de calidad continuo.
+     * La calidad no se cuantiza, los puntos se siguen de mayor a menor
+     * calidad usando una ColaRadix, asi que se conserva el orden de los
+     * valores sin el costo O(log n) de un monticulo. Como en las colas por
+     * niveles, un vecino con mejor calidad que el ultimo punto sacado se
+     * sigue en seguida. El punto de inicio es el de mayor calidad.
+     * @param calidad es el mapa de calidad de un canal, por ejemplo la
+     *        magnitud del filtro de Gabor. Los valores NaN se siguen al
+     *        final.
+     */
+    explicit Seguidor(const cv::Mat& calidad);
+    /** Crea un seguidor guiado por un mapa de calidad continuo a partir del
+     * punto dado.
+     * @param calidad es el mapa de calidad de un canal
+     * @param r renglon del punto
+     * @param c columna del punto
+     */
+    Seguidor(const cv::Mat& calidad, int r, int c);
 
     ~Seguidor();
     /**
@@ -245,7 +379,7 @@ class Seguidor{
     int get_c();
     /**
      *Regresa el mapa de calidad que se esta utilizando.
-     *@return double[][] el mapa de calidad
+     *@return el mapa de calidad, cuantizado (CV_8U) o continuo (CV_32F)
      **/
     cv::Mat get_qmap();
     /**
@@ -31,12 +31,39 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <utils/utils.h>
 #include "unwrap.h"
 #include "unwrap_gears.h"
+#include "scanorder.h"
+#include "phase_smooth.h"
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <vector>
 
 inline
-void sunwrap_neighborhood(const int ii, const int jj, const cv::Mat& wp,
-                          const cv::Mat& mask,
-                          cv::Mat& pp, cv::Mat& visited,
-                          float tao, const int N)
+float unwrap_pixel_nb(const size_t idx, const float* phase,
+                      const float* uphase, const unsigned int nb, double tao,
+                      const size_t N)
+{
+  return sunwrap_pixel_nb(idx, phase, uphase, nb, (float)tao, N);
+}
+
+inline
+double unwrap_pixel_nb(const size_t idx, const double* phase,
+                       const double* uphase, const unsigned int nb,
+                       double tao, const size_t N)
+{
+  return dunwrap_pixel_nb(idx, phase, uphase, nb, tao, N);
+}
+
+/**
+ * Unwraps the neighborhood of (jj,ii) in place, used by the interactive
+ * mode.
+ */
+template<typename T>
+inline
+void unwrap_neighborhood(const int ii, const int jj, const cv::Mat& wp,
+                         const BitImage& mask,
+                         cv::Mat& pp, BitImage& visited,
+                         double tao, const int N)
 {
   int low_i = (ii-N/2)>=0? (ii-N/2):0;
   int hig_i = (ii+N/2)<(wp.rows)? (ii+N/2):(wp.rows-1);
@@ -46,79 +73,168 @@ void sunwrap_neighborhood(const int ii, const int jj, const cv::Mat& wp,
   for(int i=low_i; i<=hig_i; i++){
     if(i%2==0)
       for(int j=low_j; j<=hig_j; j++){
-        if(mask.at<char>(i,j)){
-          pp.at<float>(i,j)=sunwrap_pixel(i*wp.cols+j, j, i,
-                                          wp.ptr<float>(),
-                                          mask.ptr<char>(),
-                                          pp.ptr<float>(),
-                                          visited.ptr<uchar>(),
-                                          tao, wp.rows, wp.cols);
-          visited.at<uchar>(i,j)=1;
+        if(mask(i,j)){
+          pp.at<T>(i,j)=unwrap_pixel_nb(i*wp.cols+j, wp.ptr<T>(),
+                                        pp.ptr<T>(),
+                                        visited.neighbors8(i,j) &
+                                        mask.neighbors8(i,j),
+                                        tao, wp.cols);
+          visited.set(i,j);
         }
       }
     else
       for(int j=hig_j; j>=low_j; j--){
-        if(mask.at<char>(i,j)){
-          pp.at<float>(i,j)=sunwrap_pixel(i*wp.cols+j, j, i,
-                                          wp.ptr<float>(),
-                                          mask.ptr<char>(),
-                                          pp.ptr<float>(),
-                                          visited.ptr<uchar>(),
-                                          tao, wp.rows, wp.cols);
-          visited.at<uchar>(i,j)=1;
+        if(mask(i,j)){
+          pp.at<T>(i,j)=unwrap_pixel_nb(i*wp.cols+j, wp.ptr<T>(),
+                                        pp.ptr<T>(),
+                                        visited.neighbors8(i,j) &
+                                        mask.neighbors8(i,j),
+                                        tao, wp.cols);
+          visited.set(i,j);
         }
       }
   }
 }
 
+/**
+ * Unwraps the neighborhood of (jj,ii) in the precision of the phase.
+ */
+inline
+void unwrap_neighborhood(const int ii, const int jj, const cv::Mat& wp,
+                         const BitImage& mask,
+                         cv::Mat& pp, BitImage& visited,
+                         double tao, const int N)
+{
+  if(wp.type()==CV_32F)
+    unwrap_neighborhood<float>(ii, jj, wp, mask, pp, visited, tao, N);
+  else
+    unwrap_neighborhood<double>(ii, jj, wp, mask, pp, visited, tao, N);
+}
+
+inline
+float unwrap_pixel_pad(const float* phase, const float* uphase,
+                       const unsigned int nb, double tao, const size_t stride)
+{
+  return sunwrap_pixel_pad(phase, uphase, nb, (float)tao, stride);
+}
+
+inline
+double unwrap_pixel_pad(const double* phase, const double* uphase,
+                        const unsigned int nb, double tao, const size_t stride)
+{
+  return dunwrap_pixel_pad(phase, uphase, nb, tao, stride);
+}
+
+/** Marks the pixels of the incremental mode whose neighbors are complete */
+const ushort COMPLETE_PIXEL=0x100;
+/**
+ * The change of its neighbors above which a pixel of the incremental mode
+ * is unwrapped again.
+ */
+const double STALE_CHANGE=5e-3;
+
+/**
+ * The state of the incremental mode.
+ */
+struct IncrementalState
+{
+  IncrementalState(const int rows, const int cols)
+  :used(cv::Mat::zeros(rows, cols, CV_16U)),
+   moved(cv::Mat::zeros(rows+2, cols+3, CV_32F))
+  {}
+
+  /** The neighbors used the last time each pixel was unwrapped */
+  cv::Mat used;
+  /** The change of the neighbors of each pixel since then, padded as the
+      phases */
+  cv::Mat moved;
+};
+
+/**
+ * Unwraps the neighborhood of (jj,ii) over padded phases.
+ *
+ * The phases are padded by padPhase, so the pixel (j,i) is at (j+1,i+1) of
+ * wpad and upad and its 8 neighbors are read without bounds checks.
+ *
+ * A pixel is a function of its neighbors only, so unwrapping it again
+ * gives the same value until they change. If inc is given, each update
+ * adds its change to the 8 neighbors of the pixel, and a visited pixel is
+ * skipped while it has the same neighbors and they changed by at most
+ * STALE_CHANGE since it was unwrapped. A pixel that used all its
+ * neighbors of the mask is skipped without reading the label fields. As
+ * the scanner moves one pixel at a time, most of the window is skipped.
+ */
+template<typename T>
 inline
-void dunwrap_neighborhood(const int ii, const int jj, const cv::Mat& wp,
-                          const cv::Mat& mask,
-                          cv::Mat& pp, cv::Mat& visited,
-                          double tao, const int N)
+void unwrap_neighborhood_pad(const int ii, const int jj, const cv::Mat& wpad,
+                             const BitImage& mask, cv::Mat& upad,
+                             BitImage& visited, double tao, const int N,
+                             IncrementalState* inc=NULL)
 {
+  const int rows=mask.rows(), cols=mask.cols();
+  const size_t stride=wpad.step1();
   int low_i = (ii-N/2)>=0? (ii-N/2):0;
-  int hig_i = (ii+N/2)<(wp.rows)? (ii+N/2):(wp.rows-1);
+  int hig_i = (ii+N/2)<rows? (ii+N/2):(rows-1);
   int low_j = (jj-N/2)>=0? (jj-N/2):0;
-  int hig_j = (jj+N/2)<(wp.cols)? (jj+N/2):(wp.cols-1);
+  int hig_j = (jj+N/2)<cols? (jj+N/2):(cols-1);
 
   for(int i=low_i; i<=hig_i; i++){
-    if(i%2==0)
-      for(int j=low_j; j<=hig_j; j++){
-        if(mask.at<char>(i,j)){
-          pp.at<double>(i,j)=dunwrap_pixel(i*wp.cols+j, j, i,
-                                           wp.ptr<double>(),
-                                           mask.ptr<char>(),
-                                           pp.ptr<double>(),
-                                           visited.ptr<uchar>(),
-                                           tao, wp.rows, wp.cols);
-          visited.at<uchar>(i,j)=1;
-        }
-      }
-    else
-      for(int j=hig_j; j>=low_j; j--){
-        if(mask.at<char>(i,j)){
-          pp.at<double>(i,j)=dunwrap_pixel(i*wp.cols+j, j, i,
-                                           wp.ptr<double>(),
-                                           mask.ptr<char>(),
-                                           pp.ptr<double>(),
-                                           visited.ptr<uchar>(),
-                                           tao, wp.rows, wp.cols);
-          visited.at<uchar>(i,j)=1;
+    const T* wp=wpad.ptr<T>(i+1) + 1;
+    T* pp=upad.ptr<T>(i+1) + 1;
+    const int dj= (i%2==0)? 1:-1;
+    const int first= (i%2==0)? low_j:hig_j;
+    const int n=hig_j - low_j + 1;
+    ushort* used= inc? inc->used.ptr<ushort>(i):NULL;
+    float* moved= inc? inc->moved.ptr<float>(i+1) + 1:NULL;
+    const size_t mstride= inc? inc->moved.step1():0;
+    for(int k=0, j=first; k<n; k++, j+=dj)
+      if(mask(i,j)){
+        if(inc && (used[j] & COMPLETE_PIXEL) && moved[j]<=STALE_CHANGE)
+          continue;
+        const unsigned int inside=mask.neighbors8(i,j);
+        const unsigned int nb=visited.neighbors8(i,j) & inside;
+        if(inc && visited(i,j) && used[j]==nb && moved[j]<=STALE_CHANGE)
+          continue;
+        const T before=pp[j];
+        pp[j]=unwrap_pixel_pad(wp + j, pp + j, nb, tao, stride);
+        if(inc){
+          const float change=(float)std::abs(pp[j]-before);
+          float* up=moved + j - mstride;
+          float* dn=moved + j + mstride;
+          up[-1]+=change; up[0]+=change; up[1]+=change;
+          moved[j-1]+=change; moved[j+1]+=change;
+          dn[-1]+=change; dn[0]+=change; dn[1]+=change;
+          moved[j]=0;
+          used[j]=(ushort)(nb==inside? nb|COMPLETE_PIXEL:nb);
         }
+        visited.set(i,j);
       }
   }
 }
 
+/**
+ * Copies the phase into a buffer with a zero border of one pixel, and of
+ * two pixels on the right, where the SSE2 kernel of single precision reads
+ * one element past the right neighbor.
+ */
+cv::Mat padPhase(const cv::Mat& phase)
+{
+  cv::Mat pad;
+  cv::copyMakeBorder(phase, pad, 1, 1, 1, 2, cv::BORDER_CONSTANT,
+                     cv::Scalar(0));
+  return pad;
+}
+
 /**
  * Phase unwrapping method
  */
 template<typename T>
-void unwrap2D_engine(cv::Mat wphase, cv::Mat mask, cv::Mat uphase,
-                     double tao, double smooth_path, int n, cv::Point pixel)
+void unwrap2D_engine(cv::Mat wphase, const BitImage& mask, cv::Mat uphase,
+                     double tao, double smooth_path, int n, cv::Point pixel,
+                     ScanOrder* order, bool incremental)
 {
   const int M=wphase.rows, N=wphase.cols;
-  cv::Mat visited = cv::Mat::zeros(M, N, CV_8U);
+  BitImage visited(M, N);
   cv::Mat path, dx, dy;
 
   if(smooth_path>0){
@@ -128,25 +244,24 @@ void unwrap2D_engine(cv::Mat wphase, cv::Mat mask, cv::Mat uphase,
 
   Scanner scan(dx, dy, pixel);
   scan.setMask(mask);
-  int i,j;
-  if(wphase.type()==CV_32F)
-    do{
-      pixel = scan.getPosition();
-      i=pixel.y;
-      j=pixel.x;
-      sunwrap_neighborhood(i, j, wphase, mask, uphase, visited, tao, n);
-    }while(scan.next());
-  else
-    do{
-      i=pixel.y;
-      j=pixel.x;
-      dunwrap_neighborhood(i, j, wphase, mask, uphase, visited, tao, n);
-    }while(scan.next());
+  scan.useStaticField(true);
+  scan.recordTo(order);
+  const cv::Mat wpad=padPhase(wphase);
+  cv::Mat upad=padPhase(uphase);
+  IncrementalState state(incremental? M:0, incremental? N:0);
+  do{
+    pixel = scan.getPosition();
+    unwrap_neighborhood_pad<T>(pixel.y, pixel.x, wpad, mask, upad, visited,
+                               tao, n, incremental? &state:NULL);
+  }while(scan.next());
 
+  upad(cv::Rect(1, 1, N, M)).copyTo(uphase);
 }
 
-void unwrap2D(cv::Mat wphase, cv::Mat mask, cv::Mat uphase, double tao,
-              double smooth_path, int N, cv::Point pixel) throw(cv::Exception)
+void unwrap2D(cv::Mat wphase, const BitImage& mask, cv::Mat uphase,
+              double tao, double smooth_path, int N, cv::Point pixel,
+              ScanOrder* order=NULL, bool incremental=false)
+throw(cv::Exception)
 {
   if(wphase.type()!=CV_32F && wphase.type()!=CV_64F){
     cv::Exception e(1000,
@@ -159,23 +274,460 @@ void unwrap2D(cv::Mat wphase, cv::Mat mask, cv::Mat uphase, double tao,
     uphase.create(wphase.rows, wphase.cols, wphase.type());
 
   if(wphase.type()==CV_32F)
-    unwrap2D_engine<float>(wphase, mask, uphase, tao, smooth_path, N, pixel);
+    unwrap2D_engine<float>(wphase, mask, uphase, tao, smooth_path, N, pixel,
+                           order, incremental);
   else
-    unwrap2D_engine<double>(wphase, mask, uphase, tao, smooth_path, N, pixel);
+    unwrap2D_engine<double>(wphase, mask, uphase, tao, smooth_path, N, pixel,
+                            order, incremental);
+}
+
+/**
+ * Phase unwrapping following a recorded pixel sequence.
+ */
+void unwrap2D_replay(cv::Mat wphase, const BitImage& mask, cv::Mat uphase,
+                     double tao, int n, const ScanOrder& order,
+                     bool incremental)
+{
+  BitImage visited(wphase.rows, wphase.cols);
+  const int count=order.size(), d=ScanOrder::PREFETCH_DISTANCE;
+  const cv::Mat wpad=padPhase(wphase);
+  cv::Mat upad=padPhase(uphase);
+  const bool single= wphase.type()==CV_32F;
+  IncrementalState state(incremental? wphase.rows:0,
+                         incremental? wphase.cols:0);
+
+  for(int k=0; k<count; k++){
+    if(k+d<count){
+      const cv::Point ahead=order.point(k+d) + cv::Point(1,1);
+      ScanOrder::prefetch(wpad, ahead);
+      ScanOrder::prefetch(upad, ahead);
+    }
+    const cv::Point pixel=order.point(k);
+    if(single)
+      unwrap_neighborhood_pad<float>(pixel.y, pixel.x, wpad, mask, upad,
+                                     visited, tao, n,
+                                     incremental? &state:NULL);
+    else
+      unwrap_neighborhood_pad<double>(pixel.y, pixel.x, wpad, mask, upad,
+                                      visited, tao, n,
+                                      incremental? &state:NULL);
+  }
+  upad(cv::Rect(1, 1, wphase.cols, wphase.rows)).copyTo(uphase);
+}
+
+namespace{
+
+/** A tile of the parallel mode and its unwrapped phase */
+struct UnwrapTile{
+  /** The pixels of the output taken from this tile */
+  cv::Rect core;
+  /** The core extended by the overlap, the pixels unwrapped */
+  cv::Rect ext;
+  /** The unwrapped phase in double precision, NaN where the tile did not
+      reach */
+  cv::Mat uphase;
+  /** The 2pi multiple added to the tile */
+  int offset;
+};
+
+/** An edge between two neighbor tiles of the parallel mode */
+struct TileEdge{
+  int a, b;
+  /** The 2pi multiple to add to tile b to match tile a */
+  int k;
+  /** The number of overlap pixels that agree with k */
+  int votes;
+
+  bool operator<(const TileEdge& e) const
+  {
+    return votes>e.votes;
+  }
+};
+
+/**
+ * Finds the 2pi multiple that matches tile b to tile a in their overlap.
+ *
+ * Each overlap pixel reached by both tiles votes for the multiple nearest
+ * to the difference of their phases, the most voted one is taken.
+ */
+TileEdge matchOffset(const std::vector<UnwrapTile>& tiles, const int a,
+                     const int b, const BitImage& mask)
+{
+  const UnwrapTile& ta=tiles[a];
+  const UnwrapTile& tb=tiles[b];
+  const cv::Rect inter = ta.ext & tb.ext;
+  std::map<int, int> votes;
+
+  for(int i=inter.y; i<inter.y+inter.height; i++){
+    const double* ua=ta.uphase.ptr<double>(i-ta.ext.y) - ta.ext.x;
+    const double* ub=tb.uphase.ptr<double>(i-tb.ext.y) - tb.ext.x;
+    for(int j=inter.x; j<inter.x+inter.width; j++)
+      if(mask(i,j) && ua[j]==ua[j] && ub[j]==ub[j])
+        votes[cvRound((ua[j]-ub[j])/(2*M_PI))]++;
+  }
+
+  TileEdge e={a, b, 0, 0};
+  for(std::map<int, int>::const_iterator it=votes.begin(); it!=votes.end();
+      ++it)
+    if(it->second>e.votes){
+      e.k=it->first;
+      e.votes=it->second;
+    }
+  return e;
+}
+
+/** Returns the root of the set of k, compressing the path */
+int findSet(std::vector<int>& parent, int k)
+{
+  while(parent[k]!=k){
+    parent[k]=parent[parent[k]];
+    k=parent[k];
+  }
+  return k;
 }
 
-Unwrap::Unwrap(cv::Mat_<double> wphase, double tau, double smooth, int N)
-: _wphase(wphase)
+/**
+ * Sets the 2pi offsets of the tiles.
+ *
+ * The tiles are joined by the maximum spanning tree of the overlap votes,
+ * so the offsets follow the most consistent overlaps. Each tree is solved
+ * from its first tile, the one holding the start pixel goes first.
+ */
+void solveOffsets(std::vector<UnwrapTile>& tiles, const int nx, const int ny,
+                  const int root, const BitImage& mask)
 {
+  std::vector<TileEdge> edges;
+  for(int ty=0; ty<ny; ty++)
+    for(int tx=0; tx<nx; tx++){
+      const int k=ty*nx + tx;
+      if(tx+1<nx)
+        edges.push_back(matchOffset(tiles, k, k+1, mask));
+      if(ty+1<ny)
+        edges.push_back(matchOffset(tiles, k, k+nx, mask));
+    }
+  std::stable_sort(edges.begin(), edges.end());
+
+  // Kruskal: the edges with more votes are taken first
+  const int n=(int)tiles.size();
+  std::vector<int> parent(n);
+  std::vector<std::vector<TileEdge> > tree(n);
+  for(int k=0; k<n; k++)
+    parent[k]=k;
+  for(size_t e=0; e<edges.size() && edges[e].votes>0; e++){
+    const int ra=findSet(parent, edges[e].a), rb=findSet(parent, edges[e].b);
+    if(ra==rb)
+      continue;
+    parent[ra]=rb;
+    tree[edges[e].a].push_back(edges[e]);
+    TileEdge back=edges[e];
+    std::swap(back.a, back.b);
+    back.k=-back.k;
+    tree[edges[e].b].push_back(back);
+  }
+
+  std::vector<char> solved(n, 0);
+  for(int s=0; s<n; s++){
+    const int start= s==0? root:(s==root? 0:s);
+    if(solved[start])
+      continue;
+    tiles[start].offset=0;
+    solved[start]=1;
+    std::vector<int> queue(1, start);
+    for(size_t q=0; q<queue.size(); q++){
+      const int k=queue[q];
+      for(size_t e=0; e<tree[k].size(); e++){
+        const int b=tree[k][e].b;
+        if(solved[b])
+          continue;
+        tiles[b].offset=tiles[k].offset + tree[k][e].k;
+        solved[b]=1;
+        queue.push_back(b);
+      }
+    }
+  }
+}
+
+/**
+ * Copies the reached pixels of the region r of the tile into the output.
+ */
+template<typename T>
+void composeTile(const UnwrapTile& t, const cv::Rect& r, cv::Mat& uphase,
+                 cv::Mat& filled)
+{
+  const double offset=2*M_PI*t.offset;
+  for(int i=r.y; i<r.y+r.height; i++){
+    const double* u=t.uphase.ptr<double>(i-t.ext.y) - t.ext.x;
+    T* out=uphase.ptr<T>(i);
+    uchar* f=filled.ptr<uchar>(i);
+    for(int j=r.x; j<r.x+r.width; j++)
+      if(!f[j] && u[j]==u[j]){
+        out[j]=(T)(u[j] + offset);
+        f[j]=1;
+      }
+  }
+}
+
+bool largerComponent(const UnwrapComponent& a, const UnwrapComponent& b)
+{
+  return a.pixels>b.pixels;
+}
+
+bool lowerLabel(const UnwrapComponent& a, const UnwrapComponent& b)
+{
+  return a.label<b.label;
+}
+
+/**
+ * Sets the number of threads of OpenCV while it lives.
+ */
+class ThreadCount
+{
+public:
+  /** Zero keeps the current setting */
+  explicit ThreadCount(const int threads)
+  :m_saved(cv::getNumThreads()), m_set(threads>0)
+  {
+    if(m_set)
+      cv::setNumThreads(threads);
+  }
+  ~ThreadCount()
+  {
+    if(m_set)
+      cv::setNumThreads(m_saved);
+  }
+
+private:
+  const int m_saved;
+  const bool m_set;
+};
+
+/**
+ * Labels the 8-connected components of the mask.
+ *
+ * @param labels [output] the component of each pixel, from 1, and 0 outside
+ * the mask.
+ * @param comps [output] the pixels and the bounds of each component, the
+ * label of comps[k] is k+1.
+ */
+void labelComponents(const BitImage& mask, cv::Mat& labels,
+                     std::vector<UnwrapComponent>& comps)
+{
+  labels=cv::Mat::zeros(mask.rows(), mask.cols(), CV_32S);
+  comps.clear();
+  std::vector<cv::Point> stack;
+
+  for(int y=0; y<mask.rows(); y++)
+    for(int x=0; x<mask.cols(); x++){
+      if(!mask(y,x) || labels.at<int>(y,x))
+        continue;
+      UnwrapComponent c;
+      c.label=(int)comps.size() + 1;
+      c.pixels=0;
+      c.seconds=0;
+      int x0=x, x1=x, y0=y, y1=y;
+      labels.at<int>(y,x)=c.label;
+      stack.push_back(cv::Point(x,y));
+      while(!stack.empty()){
+        const cv::Point p=stack.back();
+        stack.pop_back();
+        c.pixels++;
+        x0=std::min(x0, p.x);
+        x1=std::max(x1, p.x);
+        y0=std::min(y0, p.y);
+        y1=std::max(y1, p.y);
+        const unsigned int nb=mask.neighbors8(p.y, p.x);
+        for(int k=0; k<8; k++){
+          if(!(nb & (1u<<k)))
+            continue;
+          const cv::Point q(p.x + NB_DX[k], p.y + NB_DY[k]);
+          int& l=labels.at<int>(q.y, q.x);
+          if(!l){
+            l=c.label;
+            stack.push_back(q);
+          }
+        }
+      }
+      c.bounds=cv::Rect(x0, y0, x1-x0+1, y1-y0+1);
+      comps.push_back(c);
+    }
+}
+
+/**
+ * Copies the pixels of the component c from its bounding box into out.
+ */
+template<typename T>
+void copyLabel(const cv::Mat& uphase, const cv::Mat& labels,
+               const UnwrapComponent& c, cv::Mat& out)
+{
+  const cv::Rect& b=c.bounds;
+  for(int i=0; i<b.height; i++){
+    const int* l=labels.ptr<int>(i+b.y) + b.x;
+    const T* u=uphase.ptr<T>(i);
+    T* o=out.ptr<T>(i+b.y) + b.x;
+    for(int j=0; j<b.width; j++)
+      if(l[j]==c.label)
+        o[j]=u[j];
+  }
+}
+
+/**
+ * Quality of the wrapped phase, the length of the mean phasor in 3x3.
+ *
+ * It is close to one where the phase is smooth and drops at the noisy
+ * pixels and at the discontinuities.
+ */
+cv::Mat phaseQuality(const cv::Mat& phase)
+{
+  cv::Mat wphase;
+  phase.convertTo(wphase, CV_64F);
+  cv::Mat ss = sin<double>(wphase);
+  cv::Mat cc = cos<double>(wphase);
+  cv::blur(ss, ss, cv::Size(3,3));
+  cv::blur(cc, cc, cv::Size(3,3));
+  cv::Mat q;
+  cv::magnitude(ss, cc, q);
+  return q;
+}
+
+}
+
+/**
+ * Unwraps a range of mask components, each one from its best pixel.
+ */
+class Unwrap::ComponentBody: public cv::ParallelLoopBody
+{
+public:
+  ComponentBody(const Unwrap& parent, std::vector<UnwrapComponent>& comps,
+                const cv::Mat& wphase, const cv::Mat& labels,
+                const cv::Mat& quality)
+  :m_parent(parent), m_comps(&comps), m_wphase(wphase), m_labels(labels),
+   m_quality(quality)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    const cv::Mat labels=m_labels, quality=m_quality;
+    cv::Mat out=m_parent._uphase;
+    for(int k=r.start; k<r.end; k++){
+      UnwrapComponent& c=(*m_comps)[k];
+      const int64 start=cv::getTickCount();
+      const cv::Rect& b=c.bounds;
+      BitImage mask(b.height, b.width);
+      double best=-1;
+      for(int i=0; i<b.height; i++){
+        const int* l=labels.ptr<int>(i+b.y) + b.x;
+        const double* q=quality.ptr<double>(i+b.y) + b.x;
+        for(int j=0; j<b.width; j++)
+          if(l[j]==c.label){
+            mask.set(i,j);
+            if(q[j]>best){
+              best=q[j];
+              c.seed=cv::Point(j+b.x, i+b.y);
+            }
+          }
+      }
+
+      cv::Mat uphase(b.height, b.width, out.type());
+      unwrap2D(m_wphase(b).clone(), mask, uphase, m_parent._tau,
+               m_parent._smooth, m_parent._N, c.seed - b.tl(), NULL,
+               m_parent._incremental);
+      if(out.type()==CV_32F)
+        copyLabel<float>(uphase, labels, c, out);
+      else
+        copyLabel<double>(uphase, labels, c, out);
+      c.seconds=(cv::getTickCount() - start)/cv::getTickFrequency();
+    }
+  }
+
+private:
+  const Unwrap& m_parent;
+  std::vector<UnwrapComponent>* m_comps;
+  /** The wrapped phase, never written by the loop */
+  const cv::Mat& m_wphase;
+  const cv::Mat& m_labels;
+  const cv::Mat& m_quality;
+};
+
+/**
+ * Unwraps a range of tiles of the parallel mode.
+ *
+ * Each tile unwraps its extended rectangle on its own, from the mask pixel
+ * nearest the center of its core, with its own 2pi multiple. The phase is
+ * kept in double precision with NaN at the pixels the tile did not reach,
+ * so solveOffsets and composeTile can tell them apart.
+ */
+class Unwrap::TileBody: public cv::ParallelLoopBody
+{
+public:
+  TileBody(const Unwrap& parent, std::vector<UnwrapTile>& tiles)
+  :m_parent(parent), m_tiles(&tiles)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    for(int k=r.start; k<r.end; k++){
+      UnwrapTile& t = (*m_tiles)[k];
+      const cv::Point center(t.core.x + t.core.width/2,
+                             t.core.y + t.core.height/2);
+      BitImage mask(t.ext.height, t.ext.width);
+      cv::Point seed(-1, -1);
+      int best=std::numeric_limits<int>::max();
+      for(int i=0; i<t.ext.height; i++)
+        for(int j=0; j<t.ext.width; j++)
+          if(m_parent._mask(i+t.ext.y, j+t.ext.x)){
+            mask.set(i,j);
+            const int dx=j+t.ext.x-center.x, dy=i+t.ext.y-center.y;
+            if(dx*dx + dy*dy<best){
+              best=dx*dx + dy*dy;
+              seed=cv::Point(j,i);
+            }
+          }
+
+      t.uphase.create(t.ext.height, t.ext.width, m_parent._wphase.type());
+      t.uphase.setTo(cv::Scalar(std::numeric_limits<double>::quiet_NaN()));
+      if(seed.x<0){
+        t.uphase.convertTo(t.uphase, CV_64F);
+        continue;
+      }
+      unwrap2D(m_parent._wphase(t.ext).clone(), mask, t.uphase,
+               m_parent._tau, m_parent._smooth, m_parent._N, seed, NULL,
+               m_parent._incremental);
+      t.uphase.convertTo(t.uphase, CV_64F);
+    }
+  }
+
+private:
+  const Unwrap& m_parent;
+  std::vector<UnwrapTile>* m_tiles;
+};
+
+void unwrap2D(cv::Mat wphase, cv::Mat mask, cv::Mat uphase, double tao,
+              double smooth_path, int N, cv::Point pixel) throw(cv::Exception)
+{
+  unwrap2D(wphase, BitImage(mask), uphase, tao, smooth_path, N, pixel);
+}
+
+Unwrap::Unwrap(cv::Mat wphase, double tau, double smooth, int N)
+{
+  CV_Assert(wphase.channels()==1);
+  if(wphase.type()==CV_32F || wphase.type()==CV_64F)
+    _wphase = wphase;
+  else
+    wphase.convertTo(_wphase, CV_64F);
   _tau = tau;
   _smooth = smooth;
   _N=N;
-  _uphase = cv::Mat_<double>::zeros(_wphase.rows, _wphase.cols);
-  _visited = cv::Mat_<char>::zeros(_wphase.rows, _wphase.cols);
-  _mask = cv::Mat_<char>::ones(_wphase.rows, _wphase.cols);
-  _dx = cv::Mat_<double>::zeros(_wphase.rows, _wphase.cols);
-  _dy = cv::Mat_<double>::zeros(_wphase.rows, _wphase.cols);
+  _uphase = cv::Mat::zeros(_wphase.rows, _wphase.cols, _wphase.type());
+  _visited.create(_wphase.rows, _wphase.cols);
+  _mask.create(_wphase.rows, _wphase.cols, true);
+  _dx = cv::Mat::zeros(_wphase.rows, _wphase.cols, _wphase.type());
+  _dy = cv::Mat::zeros(_wphase.rows, _wphase.cols, _wphase.type());
   _scanner = NULL;
+  _incremental = false;
+  _tileSize = 0;
+  _tileOverlap = 32;
+  _threads = 0;
+  _splitComponents = false;
 }
 
 Unwrap::~Unwrap()
@@ -186,7 +738,92 @@ Unwrap::~Unwrap()
 
 void Unwrap::run()
 {
-  unwrap2D(_wphase, _mask, _uphase, _tau, _smooth, _N, _pixel);
+  if(_splitComponents){
+    runComponents();
+    return;
+  }
+  if(_tileSize>0 && (_tileSize<_wphase.rows || _tileSize<_wphase.cols)){
+    runTiled();
+    return;
+  }
+  unwrap2D(_wphase, _mask, _uphase, _tau, _smooth, _N, _pixel, NULL,
+           _incremental);
+}
+
+void Unwrap::runTiled()
+{
+  const int ts=_tileSize, ov=_tileOverlap>0? _tileOverlap:0;
+  const int nx=(_wphase.cols+ts-1)/ts, ny=(_wphase.rows+ts-1)/ts;
+  const cv::Rect image(0, 0, _wphase.cols, _wphase.rows);
+  std::vector<UnwrapTile> tiles(nx*ny);
+  int root=0;
+
+  for(int ty=0; ty<ny; ty++)
+    for(int tx=0; tx<nx; tx++){
+      UnwrapTile& t = tiles[ty*nx + tx];
+      t.core = cv::Rect(tx*ts, ty*ts, ts, ts) & image;
+      t.ext = cv::Rect(t.core.x-ov, t.core.y-ov, t.core.width+2*ov,
+                       t.core.height+2*ov) & image;
+      t.offset = 0;
+      if(t.core.contains(_pixel))
+        root=ty*nx + tx;
+    }
+
+  {
+    ThreadCount threads(_threads);
+    cv::parallel_for_(cv::Range(0, (int)tiles.size()), TileBody(*this, tiles));
+  }
+
+  solveOffsets(tiles, nx, ny, root, _mask);
+
+  // The core of each tile first, then the overlaps for the pixels that
+  // its own tile did not reach
+  cv::Mat filled=cv::Mat::zeros(_wphase.rows, _wphase.cols, CV_8U);
+  cv::Mat uphase=_uphase;
+  const bool single= uphase.type()==CV_32F;
+  for(int pass=0; pass<2; pass++)
+    for(size_t k=0; k<tiles.size(); k++){
+      const cv::Rect& r= pass==0? tiles[k].core:tiles[k].ext;
+      if(single)
+        composeTile<float>(tiles[k], r, uphase, filled);
+      else
+        composeTile<double>(tiles[k], r, uphase, filled);
+    }
+}
+
+void Unwrap::runComponents()
+{
+  cv::Mat labels;
+  labelComponents(_mask, labels, _components);
+  const cv::Mat quality=phaseQuality(_wphase);
+
+  // The largest components first, so they do not start last
+  std::vector<UnwrapComponent> sorted(_components);
+  std::stable_sort(sorted.begin(), sorted.end(), largerComponent);
+  _components.swap(sorted);
+
+  // The components write the output while others still read the wrapped
+  // phase, so an output sharing its buffer unwraps a copy
+  const cv::Mat wphase= _uphase.datastart==_wphase.datastart?
+    _wphase.clone():_wphase;
+  ThreadCount threads(_threads);
+  cv::parallel_for_(cv::Range(0, (int)_components.size()),
+                    ComponentBody(*this, _components, wphase, labels,
+                                  quality));
+
+  std::sort(_components.begin(), _components.end(), lowerLabel);
+}
+
+void Unwrap::record(ScanOrder& order)
+{
+  unwrap2D(_wphase, _mask, _uphase, _tau, _smooth, _N, _pixel, &order,
+           _incremental);
+}
+
+void Unwrap::replay(const ScanOrder& order)
+{
+  CV_Assert(order.rows()==_wphase.rows && order.cols()==_wphase.cols);
+  unwrap2D_replay(_wphase, _mask, _uphase, _tau, _N, order, _incremental);
 }
 
 bool Unwrap::runInteractive(int iters)
@@ -194,15 +831,16 @@ bool Unwrap::runInteractive(int iters)
   if (_scanner==NULL) {
     _scanner = new Scanner(_dx, _dy, _pixel);
     _scanner->setMask(_mask);
+    _scanner->useStaticField(true);
   }
 
   int iter=0;
   do{
     _pixel = _scanner->getPosition();
     int i= _pixel.y, j=_pixel.x;
-    dunwrap_neighborhood(i, j, _wphase, _mask, _uphase, _visited, _tau, _N);
+    unwrap_neighborhood(i, j, _wphase, _mask, _uphase, _visited, _tau, _N);
     //takeGradient(_pixel, _N);
-    _visited(i,j)=1;
+    _visited.set(i,j);
   }while(_scanner->next() && (++iter)<iters);
 
   return iter==iters;
@@ -211,7 +849,7 @@ bool Unwrap::runInteractive(int iters)
 void Unwrap::processPixel(cv::Point pixel)
 {
   int i=pixel.y, j=pixel.x;
-  dunwrap_neighborhood(i, j, _wphase, _mask, _uphase, _visited, _tau, _N);
+  unwrap_neighborhood(i, j, _wphase, _mask, _uphase, _visited, _tau, _N);
 }
 
 
@@ -227,6 +865,7 @@ void Unwrap::setPixel(cv::Point pixel)
   }
   _scanner = new Scanner(_dx, _dy, pixel);
   _scanner->setMask(_mask);
+  _scanner->useStaticField(true);
   _pixel=pixel;
 }
 
@@ -239,57 +878,70 @@ cv::Mat Unwrap::getInput()
   return _wphase;
 }
 
+void Unwrap::setOutput(cv::Mat uphase)
+{
+  CV_Assert(uphase.rows==_wphase.rows && uphase.cols==_wphase.cols &&
+            uphase.type()==_wphase.type());
+  _uphase = uphase;
+}
+
 void Unwrap::setMask(cv::Mat mask)
 {
-  _mask = mask;
+  _mask = BitImage(mask);
 }
 
 void Unwrap::filterPhase(double sigma)
 {
-  cv::Mat ss = sin<double>(_wphase);
-  cv::Mat cc = cos<double>(_wphase);
-  cv::GaussianBlur(ss, ss, cv::Size(0,0), sigma);
-  cv::GaussianBlur(cc, cc, cv::Size(0,0), sigma);
-
-  _wphase = atan2<double>(ss, cc);
+  smoothWrappedPhase(_wphase, sigma, &_wphase);
 }
 
 cv::Mat Unwrap::genPath(double sigma)
 {
-  cv::Mat ss = sin<double>(_wphase);
-  cv::Mat cc = cos<double>(_wphase);
-  cv::GaussianBlur(ss, ss, cv::Size(0,0), sigma);
-  cv::GaussianBlur(cc, cc, cv::Size(0,0), sigma);
-
-  cv::Mat wphase = atan2<double>(ss, cc);
-  cc = cos<double>(wphase);
-
-  return cc;
+  cv::Mat path;
+  smoothWrappedPhase(_wphase, sigma, NULL, &path);
+  return path;
 }
 
 void Unwrap::takeGradient(cv::Point pixel, const int N)
 {
   const int N_2 = N/2;
-  cv::Mat_<double>& p = _uphase;
-  for(int i=pixel.y-N_2; i<=pixel.y+N_2; i++)
-    for(int j=pixel.x-N_2; j<=pixel.x+N_2; j++){
-      /*
-      if(i>=1 && i<p.rows && j>=0 && j<p.cols)
-        _dy(i,j)=(p(i,j)-p(i-1,j))*_mask(i,j);
-      if(j>=1 && j<p.cols && i>=0 && i<p.rows)
-        _dx(i,j)=(p(i,j)-p(i,j-1))*_mask(i,j);
-      if(j==0 && j<p.cols && i>=0 && i<p.rows)
-        _dx(i,j)=(p(i,j+1)-p(i,j))*_mask(i,j);
-      if(i==0 && i<p.rows && j>=0 && j<p.cols)
-        _dy(i,j)=(p(i+1,j)-p(i,j))*_mask(i,j);
-      */
-      _dy(i,j)=p(i,j);
-      _dx(i,j)=p(i,j);
-    }
-
+  const cv::Rect r = cv::Rect(pixel.x-N_2, pixel.y-N_2, 2*N_2+1, 2*N_2+1) &
+                     cv::Rect(0, 0, _uphase.cols, _uphase.rows);
+  _uphase(r).copyTo(_dy(r));
+  _uphase(r).copyTo(_dx(r));
 }
 
 void Unwrap::setTao(double tao)
 {
   _tau = tao;
 }
+
+void Unwrap::setIncremental(bool incremental)
+{
+  _incremental = incremental;
+}
+
+void Unwrap::setTileSize(int size)
+{
+  _tileSize = size;
+}
+
+void Unwrap::setTileOverlap(int overlap)
+{
+  _tileOverlap = overlap;
+}
+
+void Unwrap::setThreads(int threads)
+{
+  _threads = threads;
+}
+
+void Unwrap::setSplitComponents(bool split)
+{
+  _splitComponents = split;
+}
+
+const std::vector<UnwrapComponent>& Unwrap::getComponents() const
+{
+  return _components;
+}
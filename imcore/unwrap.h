@@ -32,6 +32,28 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef SWIG
 #include <opencv2/core/core.hpp>
 #include "scanner.h"
+#include "bitimage.h"
+#include <vector>
+#endif
+
+class ScanOrder;
+
+#ifndef SWIG
+/**
+ * A connected component of the mask and its unwrapping statistics.
+ */
+struct UnwrapComponent{
+  /** The label of the component, from 1 */
+  int label;
+  /** The number of pixels */
+  int pixels;
+  /** The bounding box */
+  cv::Rect bounds;
+  /** The seed, the pixel of highest quality */
+  cv::Point seed;
+  /** The time spent unwrapping the component in seconds */
+  double seconds;
+};
 #endif
 
 /**
@@ -63,7 +85,10 @@ public:
    * Phase unwrapping constructor.
    * 
    * Creates the phase unwrapping system with the given parameters. 
-   * @param[in] wphase, is the wrapped phase to process.
+   * The system works in the precision of the wrapped phase, single
+   * (CV_32F) or double (CV_64F); other types are converted to double.
+   * @param[in] wphase, is the wrapped phase to process, it is not
+   * copied.
    * @param[in] tau, this parameter controls the band width of the
    * system. Its value must be between 0 and 1 for stability reasons.
    * @param[in] smooth, this parameter contols the bandwidth of the
@@ -72,7 +97,7 @@ public:
    * @param[in] N, the neighborhood size around each pixel that is
    * being processid sequentially.
    */
-  Unwrap(cv::Mat_<double> wphase, double tau=0.09, double smooth=9, int N=15);
+  Unwrap(cv::Mat wphase, double tau=0.09, double smooth=9, int N=15);
 #endif
   /**
    * The destructor.
@@ -96,6 +121,23 @@ public:
    * @param[in] iters, the number of pixel to be processed.
    */
   bool runInteractive(int iters=1);
+  /**
+   * Executes the phase unwrapping system and records the pixel sequence.
+   *
+   * @param[out] order, the pixel sequence followed.
+   */
+  void record(ScanOrder& order);
+  /**
+   * Executes the phase unwrapping system following a recorded sequence.
+   *
+   * The scanning path is not computed, the pixels are unwrapped in the
+   * given order. It is useful to process many phase maps with the same
+   * mask and similar fringes.
+   *
+   * @param[in] order, the pixel sequence, recorded for phase maps of the
+   * same size.
+   */
+  void replay(const ScanOrder& order);
 
 #ifndef SWIG
   /**
@@ -115,6 +157,15 @@ public:
    * @return the reference to the wrapped phase used as input.
    */
   cv::Mat getInput();
+  /**
+   * Sets the matrix where the unwrapped phase is stored.
+   *
+   * The matrix is not copied, the system writes into it. It must have the
+   * size and the type of the wrapped phase. run, record and replay can
+   * unwrap in place, with the wrapped phase itself as output. When the
+   * mask components are split, run then copies the wrapped phase first.
+   */
+  void setOutput(cv::Mat uphase);
   /**
    * Sets the mask that determines the region of interes.
    * 
@@ -136,6 +187,75 @@ public:
    * stability.
    */
   void setTao(double tao);
+  /**
+   * Selects the incremental update of the window.
+   *
+   * The system unwraps again the whole window around each scanned pixel.
+   * In the incremental mode a window pixel is unwrapped again only when
+   * its neighbors changed by more than 5e-3 rad in total since it was
+   * processed, or when it got new ones. Unwrapping a pixel whose
+   * neighbors did not change gives the same value, so the result differs
+   * from the full update by a few thousandths of a radian. As the scanner
+   * moves one pixel at a time, most of the window is skipped. It is used by
+   * run, record and replay.
+   *
+   * @param[in] incremental, true to use the incremental mode.
+   */
+  void setIncremental(bool incremental);
+  /**
+   * Sets the tile size of the parallel mode.
+   *
+   * When the tile size is greater than zero, run splits the image into
+   * square tiles of this size. Each tile, extended by the tile overlap, is
+   * unwrapped independently from a seed near its center and the tiles are
+   * processed in parallel. The 2pi multiple between neighbor tiles is
+   * voted by the pixels of their overlap, and the tiles are joined
+   * following the maximum spanning tree of the votes. The sequential mode
+   * is used when the size is zero, the default, or when the image fits
+   * into one tile. record and replay always use the sequential mode.
+   *
+   * @param[in] size, the tile size in pixels, zero disables the parallel
+   * mode.
+   */
+  void setTileSize(int size);
+  /**
+   * Sets the number of pixels that each tile is extended by on each side.
+   *
+   * The overlap is used to match the 2pi multiples of neighbor tiles, it
+   * should be larger than the window size. The overlaps can not correct a
+   * tile that slips inside itself, which happens more often when it
+   * reaches part of the mask only around an obstacle near its border; a
+   * larger overlap leaves it more room. Default is 32.
+   *
+   * @param[in] overlap, the overlap in pixels.
+   */
+  void setTileOverlap(int overlap);
+  /**
+   * Sets the number of threads of the parallel mode.
+   *
+   * @param[in] threads, the number of threads, zero uses the OpenCV
+   * setting.
+   */
+  void setThreads(int threads);
+  /**
+   * Selects the unwrapping of each mask component on its own.
+   *
+   * When set, run labels the 8-connected components of the mask and
+   * unwraps them in parallel, each one from its pixel of highest quality.
+   * The quality is the length of the mean phasor of the wrapped phase in
+   * a 3x3 window. The components are independent, so no offsets are
+   * matched between them. This mode takes precedence over the tiles.
+   *
+   * @param[in] split, true to unwrap the components in parallel.
+   */
+  void setSplitComponents(bool split);
+#ifndef SWIG
+  /**
+   * Returns the components of the mask unwrapped by the last run, sorted
+   * by label, with their seeds and timings.
+   */
+  const std::vector<UnwrapComponent>& getComponents() const;
+#endif
   /**
    * Sets the starting pixel to process.
    * 
@@ -153,19 +273,34 @@ public:
   void filterPhase(double simga);
 
 private:
-  cv::Mat_<char> _visited;
-  cv::Mat_<char> _mask;
-  cv::Mat_<double> _wphase;
-  cv::Mat_<double> _uphase;
-  cv::Mat_<double> _dx;
-  cv::Mat_<double> _dy;
+  BitImage _visited;
+  BitImage _mask;
+  cv::Mat _wphase;
+  cv::Mat _uphase;
+  cv::Mat _dx;
+  cv::Mat _dy;
   cv::Point _pixel;
   double _tau;
   double _smooth;
   int _N;
+  bool _incremental;
+  /** The tile size of the parallel mode, zero for the sequential mode */
+  int _tileSize;
+  /** The pixels that each tile is extended by on each side */
+  int _tileOverlap;
+  /** The threads of the parallel mode, zero for the OpenCV setting */
+  int _threads;
+  /** Unwraps each mask component on its own */
+  bool _splitComponents;
+  /** The components of the last run */
+  std::vector<UnwrapComponent> _components;
 
   Scanner* _scanner;
 
+  class TileBody;
+  class ComponentBody;
+  void runTiled();
+  void runComponents();
   void takeGradient(cv::Point pixel, const int N);
 };
 
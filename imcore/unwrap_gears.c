@@ -26,24 +26,49 @@ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 **************************************************************************/
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <math.h>
 #include "unwrap_gears.h"
+#include "phase_wrap.h"
 
 float sW(float phase)
 {
-  float m= 2 * M_PI;
-  int n= (phase < 0) ? (phase - M_PI) / m : (phase + M_PI) / m;
-
-  return (phase - m * n);
+  return swrap(phase);
 }
 
 double dW(double phase)
 {
-  double m= 2 * M_PI;
-  int n= (phase < 0) ? (phase - M_PI) / m : (phase + M_PI) / m;
+  return dwrap(phase);
+}
+
+/* The neighbors of (x,y) already unwrapped and inside the region of
+   interest, as a BitNeighbor mask */
+static unsigned int neighbors(const size_t idx, const int x, const int y,
+                              const char *restrict mask,
+                              const uint8_t *restrict visited,
+                              const size_t M, const size_t N)
+{
+  unsigned int nb= 0;
+
+  if (x - 1 >= 0 && visited[idx-1] && mask[idx-1])
+    nb|= 1;
+  if (x + 1 < N && visited[idx+1] && mask[idx+1])
+    nb|= 2;
+  if (y - 1 >= 0 && visited[idx-N] && mask[idx-N])
+    nb|= 4;
+  if (y + 1 < M && visited[idx+N] && mask[idx+N])
+    nb|= 8;
+  if (x - 1 >= 0 && y - 1 >= 0 && visited[idx-N-1] && mask[idx-N-1])
+    nb|= 16;
+  if (x + 1 < N && y - 1 >= 0 && visited[idx-N+1] && mask[idx-N+1])
+    nb|= 32;
+  if (x + 1 < N && y + 1 < M && visited[idx+N+1] && mask[idx+N+1])
+    nb|= 64;
+  if (x - 1 >= 0 && y + 1 < M && visited[idx+N-1] && mask[idx+N-1])
+    nb|= 128;
 
-  return (phase - m * n);
+  return nb;
 }
 
 float sunwrap_pixel(const size_t idx, const int x, const int y,
@@ -52,62 +77,72 @@ float sunwrap_pixel(const size_t idx, const int x, const int y,
                     const float *restrict uphase,
                     const uint8_t *restrict visited, float tao,
                     const size_t M, const size_t N)
+{
+  return sunwrap_pixel_nb(idx, phase, uphase,
+                          neighbors(idx, x, y, mask, visited, M, N), tao, N);
+}
+
+double dunwrap_pixel(const size_t idx, const int x, const int y,
+                     const double *restrict phase,
+		     const char *restrict mask,
+                     const double *restrict uphase,
+                     const uint8_t *restrict visited, double tao,
+                     const size_t M, const size_t N)
+{
+  return dunwrap_pixel_nb(idx, phase, uphase,
+                          neighbors(idx, x, y, mask, visited, M, N), tao, N);
+}
+
+float sunwrap_pixel_nb(const size_t idx, const float *restrict phase,
+                       const float *restrict uphase, const unsigned int nb,
+                       float tao, const size_t N)
 {
   float val= 0;
   float grad= 0;
   int ndifs= 0;
 
-  if (y - 1 >= 0)
-    if (visited[idx-N] && mask[idx-N]) {
-      grad+= sW(phase[idx] - uphase[idx-N]);
-      val+= uphase[idx-N];
-      ndifs++;
-    }
-  if (y + 1 < M)
-    if (visited[idx+N] && mask[idx+N]) {
-      grad+= sW(phase[idx] - uphase[idx+N]);
-      val+= uphase[idx+N];
-      ndifs++;
-    }
-  if (x - 1 >= 0)
-    if (visited[idx-1] && mask[idx-1]) {
-      grad+= sW(phase[idx] - uphase[idx-1]);
-      val+= uphase[idx-1];
-      ndifs++;
-    }
-  if (x + 1 < N)
-    if (visited[idx+1] && mask[idx+1]) {
-      grad+= sW(phase[idx] - uphase[idx+1]);
-      val+= uphase[idx+1];
-      ndifs++;
-    }
-  // Diagonals
-  //static float dist= sqrt(2.0);
-  if (x + 1 < N && y + 1 < M)
-    if (visited[idx+N+1] && mask[idx+N+1]) {
-      grad+= sW(phase[idx] - uphase[idx+N+1]);
-      val+= uphase[idx+N+1];
-      ndifs++;
-    }
-  if (x + 1 < N && y - 1 >= 0)
-    if (visited[idx-N+1] && mask[idx-N+1]) {
-      grad+= sW(phase[idx] - uphase[idx-N+1]);
-      val+= uphase[idx-N+1];
-      ndifs++;
-    }
-  if (x - 1 >= 0 && y + 1 < M)
-    if (visited[idx+N-1] && mask[idx+N-1]) {
-      grad+= sW(phase[idx] - uphase[idx+N-1]);
-      val+= uphase[idx+N-1];
-      ndifs++;
-    }
-  if (x - 1 >= 0 && y - 1 >= 0)
-    if (visited[idx-N-1] && mask[idx-N-1]) {
-      grad+= sW(phase[idx] - uphase[idx-N-1]);
-      val+= uphase[idx-N-1];
-      ndifs++;
-    }
-  //grad/=float(ndifs);
+  // Up, down, left, right and the diagonals, the order of the original
+  // filter
+  if (nb & 4) {
+    grad+= swrap(phase[idx] - uphase[idx-N]);
+    val+= uphase[idx-N];
+    ndifs++;
+  }
+  if (nb & 8) {
+    grad+= swrap(phase[idx] - uphase[idx+N]);
+    val+= uphase[idx+N];
+    ndifs++;
+  }
+  if (nb & 1) {
+    grad+= swrap(phase[idx] - uphase[idx-1]);
+    val+= uphase[idx-1];
+    ndifs++;
+  }
+  if (nb & 2) {
+    grad+= swrap(phase[idx] - uphase[idx+1]);
+    val+= uphase[idx+1];
+    ndifs++;
+  }
+  if (nb & 64) {
+    grad+= swrap(phase[idx] - uphase[idx+N+1]);
+    val+= uphase[idx+N+1];
+    ndifs++;
+  }
+  if (nb & 32) {
+    grad+= swrap(phase[idx] - uphase[idx-N+1]);
+    val+= uphase[idx-N+1];
+    ndifs++;
+  }
+  if (nb & 128) {
+    grad+= swrap(phase[idx] - uphase[idx+N-1]);
+    val+= uphase[idx+N-1];
+    ndifs++;
+  }
+  if (nb & 16) {
+    grad+= swrap(phase[idx] - uphase[idx-N-1]);
+    val+= uphase[idx-N-1];
+    ndifs++;
+  }
   if (ndifs != 0) {
     val/= (float)ndifs;
     grad/= (float)ndifs;
@@ -117,68 +152,56 @@ float sunwrap_pixel(const size_t idx, const int x, const int y,
   return val + tao*grad;
 }
 
-double dunwrap_pixel(const size_t idx, const int x, const int y,
-                     const double *restrict phase,
-		     const char *restrict mask,
-                     const double *restrict uphase,
-                     const uint8_t *restrict visited, double tao,
-                     const size_t M, const size_t N)
+double dunwrap_pixel_nb(const size_t idx, const double *restrict phase,
+                        const double *restrict uphase, const unsigned int nb,
+                        double tao, const size_t N)
 {
   double val= 0;
   double grad= 0;
   int ndifs= 0;
 
-  if (y - 1 >= 0)
-    if (visited[idx-N] && mask[idx-N]) {
-      grad+= sW(phase[idx] - uphase[idx-N]);
-      val+= uphase[idx-N];
-      ndifs++;
-    }
-  if (y + 1 < M)
-    if (visited[idx+N] && mask[idx+N]) {
-      grad+= sW(phase[idx] - uphase[idx+N]);
-      val+= uphase[idx+N];
-      ndifs++;
-    }
-  if (x - 1 >= 0)
-    if (visited[idx-1] && mask[idx-1]) {
-      grad+= sW(phase[idx] - uphase[idx-1]);
-      val+= uphase[idx-1];
-      ndifs++;
-    }
-  if (x + 1 < N)
-    if (visited[idx+1] && mask[idx+1]) {
-      grad+= sW(phase[idx] - uphase[idx+1]);
-      val+= uphase[idx+1];
-      ndifs++;
-    }
-  // Diagonals
-  //static float dist= sqrt(2.0);
-  if (x + 1 < N && y + 1 < M)
-    if (visited[idx+N+1] && mask[idx+N+1]) {
-      grad+= sW(phase[idx] - uphase[idx+N+1]);
-      val+= uphase[idx+N+1];
-      ndifs++;
-    }
-  if (x + 1 < N && y - 1 >= 0)
-    if (visited[idx-N+1] && mask[idx-N+1]) {
-      grad+= sW(phase[idx] - uphase[idx-N+1]);
-      val+= uphase[idx-N+1];
-      ndifs++;
-    }
-  if (x - 1 >= 0 && y + 1 < M)
-    if (visited[idx+N-1] && mask[idx+N-1]) {
-      grad+= sW(phase[idx] - uphase[idx+N-1]);
-      val+= uphase[idx+N-1];
-      ndifs++;
-    }
-  if (x - 1 >= 0 && y - 1 >= 0)
-    if (visited[idx-N-1] && mask[idx-N-1]) {
-      grad+= sW(phase[idx] - uphase[idx-N-1]);
-      val+= uphase[idx-N-1];
-      ndifs++;
-    }
-  //grad/=float(ndifs);
+  // Up, down, left, right and the diagonals, the order of the original
+  // filter
+  if (nb & 4) {
+    grad+= dwrap(phase[idx] - uphase[idx-N]);
+    val+= uphase[idx-N];
+    ndifs++;
+  }
+  if (nb & 8) {
+    grad+= dwrap(phase[idx] - uphase[idx+N]);
+    val+= uphase[idx+N];
+    ndifs++;
+  }
+  if (nb & 1) {
+    grad+= dwrap(phase[idx] - uphase[idx-1]);
+    val+= uphase[idx-1];
+    ndifs++;
+  }
+  if (nb & 2) {
+    grad+= dwrap(phase[idx] - uphase[idx+1]);
+    val+= uphase[idx+1];
+    ndifs++;
+  }
+  if (nb & 64) {
+    grad+= dwrap(phase[idx] - uphase[idx+N+1]);
+    val+= uphase[idx+N+1];
+    ndifs++;
+  }
+  if (nb & 32) {
+    grad+= dwrap(phase[idx] - uphase[idx-N+1]);
+    val+= uphase[idx-N+1];
+    ndifs++;
+  }
+  if (nb & 128) {
+    grad+= dwrap(phase[idx] - uphase[idx+N-1]);
+    val+= uphase[idx+N-1];
+    ndifs++;
+  }
+  if (nb & 16) {
+    grad+= dwrap(phase[idx] - uphase[idx-N-1]);
+    val+= uphase[idx-N-1];
+    ndifs++;
+  }
   if (ndifs != 0) {
     val/= (float)ndifs;
     grad/= (float)ndifs;
@@ -187,3 +210,152 @@ double dunwrap_pixel(const size_t idx, const int x, const int y,
 
   return val + tao*grad;
 }
+
+#ifdef __SSE2__
+/* Lanes whose bit of the BitNeighbor mask is set */
+static inline __m128i lanes(const __m128i nb, const __m128i bits)
+{
+  return _mm_cmpeq_epi32(_mm_and_si128(nb, bits), bits);
+}
+#endif
+
+float sunwrap_pixel_pad(const float *restrict phase,
+                        const float *restrict uphase,
+                        const unsigned int nb, float tao,
+                        const size_t stride)
+{
+#ifdef __SSE2__
+  /* The rows above and below, and the own row, from x-1 to x+2. The lane of
+     x+2 and the pixel itself are never used. */
+  const __m128 u0= _mm_loadu_ps(uphase - stride - 1);
+  const __m128 u1= _mm_loadu_ps(uphase + stride - 1);
+  const __m128 u2= _mm_loadu_ps(uphase - 1);
+  const __m128 p= _mm_set1_ps(phase[0]);
+  __m128 m0, m1, m2, val, grad;
+  float sums[4], ndifs;
+
+  if (nb == 0xff) {
+    m0= _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    m1= m0;
+    m2= _mm_castsi128_ps(_mm_setr_epi32(-1, 0, -1, 0));
+    ndifs= 8;
+  } else {
+    const __m128i b= _mm_set1_epi32((int)nb);
+    const __m128 one= _mm_set1_ps(1);
+    __m128 n;
+
+    m0= _mm_castsi128_ps(lanes(b, _mm_setr_epi32(16, 4, 32, 256)));
+    m1= _mm_castsi128_ps(lanes(b, _mm_setr_epi32(128, 8, 64, 256)));
+    m2= _mm_castsi128_ps(lanes(b, _mm_setr_epi32(1, 256, 2, 256)));
+    n= _mm_add_ps(_mm_add_ps(_mm_and_ps(m0, one), _mm_and_ps(m1, one)),
+                  _mm_and_ps(m2, one));
+    _mm_storeu_ps(sums, n);
+    ndifs= sums[0] + sums[1] + sums[2] + sums[3];
+    if (ndifs == 0)
+      return phase[0];
+  }
+  val= _mm_add_ps(_mm_add_ps(_mm_and_ps(m0, u0), _mm_and_ps(m1, u1)),
+                  _mm_and_ps(m2, u2));
+  grad= _mm_add_ps(_mm_add_ps(_mm_and_ps(m0, swrap4(_mm_sub_ps(p, u0))),
+                              _mm_and_ps(m1, swrap4(_mm_sub_ps(p, u1)))),
+                   _mm_and_ps(m2, swrap4(_mm_sub_ps(p, u2))));
+  val= _mm_add_ps(val, _mm_mul_ps(_mm_set1_ps(tao), grad));
+  _mm_storeu_ps(sums, val);
+
+  return (sums[0] + sums[1] + sums[2] + sums[3])/ndifs;
+#else
+  const ptrdiff_t s= (ptrdiff_t)stride;
+  const ptrdiff_t off[8]= {-1, 1, -s, s, -s-1, -s+1, s+1, s-1};
+  float val= 0;
+  float grad= 0;
+  int ndifs= 0;
+  int k;
+
+  /* Selects instead of multiplying by zero, the unused neighbors may be
+     NaN */
+  for (k= 0; k < 8; k++) {
+    const int use= (nb >> k) & 1;
+    const float u= uphase[off[k]];
+    grad+= use? swrap(phase[0] - u):0;
+    val+= use? u:0;
+    ndifs+= use;
+  }
+  if (ndifs == 0)
+    return phase[0];
+
+  return (val + tao*grad)/(float)ndifs;
+#endif
+}
+
+double dunwrap_pixel_pad(const double *restrict phase,
+                         const double *restrict uphase,
+                         const unsigned int nb, double tao,
+                         const size_t stride)
+{
+#ifdef __SSE2__
+  const double *up= uphase - stride, *dn= uphase + stride;
+  /* The neighbors in pairs, with their bits of nb in each 64-bit lane */
+  const __m128d u0= _mm_loadu_pd(up - 1);              /* 16, 4 */
+  const __m128d u1= _mm_loadu_pd(dn - 1);              /* 128, 8 */
+  const __m128d u2= _mm_setr_pd(uphase[-1], uphase[1]); /* 1, 2 */
+  const __m128d u3= _mm_setr_pd(up[1], dn[1]);         /* 32, 64 */
+  const __m128d p= _mm_set1_pd(phase[0]);
+  __m128d val, grad;
+  double sums[2], ndifs;
+
+  if (nb == 0xff) {
+    val= _mm_add_pd(_mm_add_pd(u0, u1), _mm_add_pd(u2, u3));
+    grad= _mm_add_pd(_mm_add_pd(dwrap2(_mm_sub_pd(p, u0)),
+                                dwrap2(_mm_sub_pd(p, u1))),
+                     _mm_add_pd(dwrap2(_mm_sub_pd(p, u2)),
+                                dwrap2(_mm_sub_pd(p, u3))));
+    ndifs= 8;
+  } else {
+    const __m128i b= _mm_set1_epi32((int)nb);
+    const __m128d one= _mm_set1_pd(1);
+    __m128d m0, m1, m2, m3, n;
+
+    m0= _mm_castsi128_pd(lanes(b, _mm_setr_epi32(16, 16, 4, 4)));
+    m1= _mm_castsi128_pd(lanes(b, _mm_setr_epi32(128, 128, 8, 8)));
+    m2= _mm_castsi128_pd(lanes(b, _mm_setr_epi32(1, 1, 2, 2)));
+    m3= _mm_castsi128_pd(lanes(b, _mm_setr_epi32(32, 32, 64, 64)));
+    n= _mm_add_pd(_mm_add_pd(_mm_and_pd(m0, one), _mm_and_pd(m1, one)),
+                  _mm_add_pd(_mm_and_pd(m2, one), _mm_and_pd(m3, one)));
+    _mm_storeu_pd(sums, n);
+    ndifs= sums[0] + sums[1];
+    if (ndifs == 0)
+      return phase[0];
+    val= _mm_add_pd(_mm_add_pd(_mm_and_pd(m0, u0), _mm_and_pd(m1, u1)),
+                    _mm_add_pd(_mm_and_pd(m2, u2), _mm_and_pd(m3, u3)));
+    grad= _mm_add_pd(_mm_add_pd(_mm_and_pd(m0, dwrap2(_mm_sub_pd(p, u0))),
+                                _mm_and_pd(m1, dwrap2(_mm_sub_pd(p, u1)))),
+                     _mm_add_pd(_mm_and_pd(m2, dwrap2(_mm_sub_pd(p, u2))),
+                                _mm_and_pd(m3, dwrap2(_mm_sub_pd(p, u3)))));
+  }
+  val= _mm_add_pd(val, _mm_mul_pd(_mm_set1_pd(tao), grad));
+  _mm_storeu_pd(sums, val);
+
+  return (sums[0] + sums[1])/ndifs;
+#else
+  const ptrdiff_t s= (ptrdiff_t)stride;
+  const ptrdiff_t off[8]= {-1, 1, -s, s, -s-1, -s+1, s+1, s-1};
+  double val= 0;
+  double grad= 0;
+  int ndifs= 0;
+  int k;
+
+  /* Selects instead of multiplying by zero, the unused neighbors may be
+     NaN */
+  for (k= 0; k < 8; k++) {
+    const int use= (nb >> k) & 1;
+    const double u= uphase[off[k]];
+    grad+= use? dwrap(phase[0] - u):0;
+    val+= use? u:0;
+    ndifs+= use;
+  }
+  if (ndifs == 0)
+    return phase[0];
+
+  return (val + tao*grad)/(double)ndifs;
+#endif
+}
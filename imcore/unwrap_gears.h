@@ -136,6 +136,78 @@ double dunwrap_pixel(const size_t idx, const int x, const int y,
                      const double *uphase,
                      const uint8_t *visited, double tao,
                      const size_t M, const size_t N);
+
+/**
+  Unwraps the given pixel using an IIR filter (single precision).
+
+  It is the same filter as sunwrap_pixel, but the neighbors already
+  unwrapped and inside the region of interest are given as a bit mask, so
+  the label fields can be stored with one bit per pixel. The bits of the
+  mask are, from the lowest one, the neighbors (x-1,y), (x+1,y), (x,y-1),
+  (x,y+1), (x-1,y-1), (x+1,y-1), (x+1,y+1) and (x-1,y+1). The neighbors
+  outside the image must be zero.
+
+  @param idx index of the pixel in continuous memory
+  @param phase the wrapped phase array
+  @param uphase the unwrapped phase array
+  @param nb the bit mask of the neighbors to use
+  @param tao the parameter of the linear system. It must be less than one and
+         greater than 0
+  @param N the number of columns
+  */
+float sunwrap_pixel_nb(const size_t idx, const float *phase,
+                       const float *uphase, const unsigned int nb,
+                       float tao, const size_t N);
+
+/**
+  Unwraps the given pixel using an IIR filter (double precision).
+
+  @see sunwrap_pixel_nb
+  */
+double dunwrap_pixel_nb(const size_t idx, const double *phase,
+                        const double *uphase, const unsigned int nb,
+                        double tao, const size_t N);
+
+/**
+  Unwraps the given pixel using an IIR filter over padded buffers (single
+  precision).
+
+  It is the same filter as sunwrap_pixel_nb, but the wrapped and unwrapped
+  phases are stored with a border of one pixel around the image, so the 8
+  neighbors are always readable. They are loaded without bounds checks nor
+  branches, the neighbors not given in nb are discarded with bit masks and
+  the differences are wrapped all at once with SSE2 when it is available.
+  When all the neighbors are given, as in the interior of the region of
+  interest, the masks are skipped.
+
+  The sums are made in a different order than in sunwrap_pixel_nb, so the
+  results may differ in the last bits.
+
+  @param phase pointer to the pixel in the padded wrapped phase
+  @param uphase pointer to the pixel in the padded unwrapped phase
+  @param nb the BitNeighbor mask of the neighbors to use
+  @param tao the parameter of the linear system. It must be less than one and
+         greater than 0
+  @param stride the number of elements of a padded row, at least the number
+         of columns plus 3: the SSE2 loads read the rows from x-1 to x+2,
+         so the rows need a second column of padding on the right
+  */
+float sunwrap_pixel_pad(const float *phase, const float *uphase,
+                        const unsigned int nb, float tao,
+                        const size_t stride);
+
+/**
+  Unwraps the given pixel using an IIR filter over padded buffers (double
+  precision).
+
+  It only reads the 8 neighbors, so a border of one pixel is enough: the
+  stride must be at least the number of columns plus 2.
+
+  @see sunwrap_pixel_pad
+  */
+double dunwrap_pixel_pad(const double *phase, const double *uphase,
+                         const unsigned int nb, double tao,
+                         const size_t stride);
 #ifdef __cplusplus
 }
 #endif
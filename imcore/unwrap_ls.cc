@@ -0,0 +1,323 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include "unwrap_ls.h"
+#include "phase_wrap.h"
+#include <cmath>
+#include <vector>
+
+namespace{
+
+/**
+ * Weighted divergence of a vector field, or weighted laplacian of a scalar
+ * field, over a range of rows.
+ *
+ * The field is (gx,gy), or the forward differences of p when gx is empty.
+ * The weights ux and uy of the differences are zero at the last column and
+ * row, which gives the Neumann borders.
+ */
+class Divergence: public cv::ParallelLoopBody
+{
+public:
+  Divergence(const cv::Mat& gx, const cv::Mat& gy, const cv::Mat& p,
+             const cv::Mat& ux, const cv::Mat& uy, cv::Mat& out)
+  :m_gx(gx), m_gy(gy), m_p(p), m_ux(ux), m_uy(uy), m_out(out)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    const int N=m_out.cols;
+    std::vector<double> fx(N), fy(N), fyUp(N);
+    for(int i=r.start; i<r.end; i++){
+      flux(i, &fx[0], &fy[0]);
+      if(i>0)
+        flux(i-1, NULL, &fyUp[0]);
+      else
+        std::fill(fyUp.begin(), fyUp.end(), 0.0);
+      double* o=m_out.ptr<double>(i);
+      o[0]=fx[0] + fy[0] - fyUp[0];
+      for(int j=1; j<N; j++)
+        o[j]=fx[j] - fx[j-1] + fy[j] - fyUp[j];
+    }
+  }
+
+private:
+  const cv::Mat& m_gx;
+  const cv::Mat& m_gy;
+  const cv::Mat& m_p;
+  const cv::Mat& m_ux;
+  const cv::Mat& m_uy;
+  cv::Mat& m_out;
+
+  /** The weighted field at the row i, fx is skipped when NULL */
+  void flux(const int i, double* fx, double* fy) const
+  {
+    const int N=m_out.cols, M=m_out.rows;
+    const double* ux=m_ux.ptr<double>(i);
+    const double* uy=m_uy.ptr<double>(i);
+    if(!m_gx.empty()){
+      const double* gx=m_gx.ptr<double>(i);
+      const double* gy=m_gy.ptr<double>(i);
+      for(int j=0; j<N; j++){
+        if(fx)
+          fx[j]=ux[j]*gx[j];
+        fy[j]=uy[j]*gy[j];
+      }
+      return;
+    }
+    const double* p=m_p.ptr<double>(i);
+    const double* pd= i+1<M? m_p.ptr<double>(i+1):p;
+    for(int j=0; j<N; j++){
+      if(fx)
+        fx[j]= j+1<N? ux[j]*(p[j+1]-p[j]):0;
+      fy[j]=uy[j]*(pd[j]-p[j]);
+    }
+  }
+};
+
+/** Weighted divergence of (gx,gy) */
+void divergence(const cv::Mat& gx, const cv::Mat& gy, const cv::Mat& ux,
+                const cv::Mat& uy, cv::Mat& out)
+{
+  out.create(gx.rows, gx.cols, CV_64F);
+  cv::parallel_for_(cv::Range(0, out.rows),
+                    Divergence(gx, gy, cv::Mat(), ux, uy, out));
+}
+
+/** Weighted laplacian of p */
+void laplacian(const cv::Mat& p, const cv::Mat& ux, const cv::Mat& uy,
+               cv::Mat& out)
+{
+  out.create(p.rows, p.cols, CV_64F);
+  cv::parallel_for_(cv::Range(0, out.rows),
+                    Divergence(cv::Mat(), cv::Mat(), p, ux, uy, out));
+}
+
+/**
+ * Solves the laplacian of phi equal to rho with Neumann borders.
+ *
+ * The cosine transform diagonalizes the laplacian. cv::dct needs even
+ * sizes, so an odd dimension is extended with its mirror image: the
+ * extended problem has the same borders and its solution restricted to
+ * the original size is the solution wanted. The mean of the solution is
+ * zero.
+ */
+void poissonDCT(const cv::Mat& rho, cv::Mat& phi)
+{
+  const int M=rho.rows, N=rho.cols;
+  const int M2= M&1? 2*M:M, N2= N&1? 2*N:N;
+  cv::Mat ext(M2, N2, CV_64F), freq;
+  for(int i=0; i<M2; i++){
+    const double* r=rho.ptr<double>(i<M? i:M2-1-i);
+    double* e=ext.ptr<double>(i);
+    for(int j=0; j<N2; j++)
+      e[j]=r[j<N? j:N2-1-j];
+  }
+  cv::dct(ext, freq);
+
+  std::vector<double> cx(N2);
+  for(int j=0; j<N2; j++)
+    cx[j]=2*std::cos(M_PI*j/N2);
+  for(int i=0; i<M2; i++){
+    const double cy=2*std::cos(M_PI*i/M2) - 4;
+    double* f=freq.ptr<double>(i);
+    for(int j=0; j<N2; j++)
+      f[j]= (i==0 && j==0)? 0:f[j]/(cy + cx[j]);
+  }
+
+  cv::dct(freq, ext, cv::DCT_INVERSE);
+  ext(cv::Rect(0, 0, N, M)).copyTo(phi);
+}
+
+/** Wrapped forward differences, zero at the last column and row */
+void wrappedGradients(const cv::Mat& psi, cv::Mat& gx, cv::Mat& gy)
+{
+  const int M=psi.rows, N=psi.cols;
+  gx=cv::Mat::zeros(M, N, CV_64F);
+  gy=cv::Mat::zeros(M, N, CV_64F);
+  for(int i=0; i<M; i++){
+    const double* p=psi.ptr<double>(i);
+    double* x=gx.ptr<double>(i);
+    for(int j=0; j+1<N; j++)
+      x[j]=dwrap(p[j+1]-p[j]);
+    if(i+1<M){
+      const double* pd=psi.ptr<double>(i+1);
+      double* y=gy.ptr<double>(i);
+      for(int j=0; j<N; j++)
+        y[j]=dwrap(pd[j]-p[j]);
+    }
+  }
+}
+
+/**
+ * Weights of the differences, the smaller squared weight of the two
+ * pixels, zero at the last column and row.
+ */
+void differenceWeights(const cv::Mat& w, cv::Mat& ux, cv::Mat& uy)
+{
+  const int M=w.rows, N=w.cols;
+  ux=cv::Mat::zeros(M, N, CV_64F);
+  uy=cv::Mat::zeros(M, N, CV_64F);
+  for(int i=0; i<M; i++){
+    const double* p=w.ptr<double>(i);
+    double* x=ux.ptr<double>(i);
+    for(int j=0; j+1<N; j++)
+      x[j]=std::min(p[j]*p[j], p[j+1]*p[j+1]);
+    if(i+1<M){
+      const double* pd=w.ptr<double>(i+1);
+      double* y=uy.ptr<double>(i);
+      for(int j=0; j<N; j++)
+        y[j]=std::min(p[j]*p[j], pd[j]*pd[j]);
+    }
+  }
+}
+
+/**
+ * Preconditioned conjugate gradient for the weighted equation.
+ *
+ * Both the weighted laplacian and the DCT preconditioner are negative
+ * semidefinite, so the usual iteration applies to their negatives and the
+ * signs cancel.
+ */
+int solvePCG(const cv::Mat& rho, const cv::Mat& ux, const cv::Mat& uy,
+             cv::Mat& phi, const int maxIters, const double tol)
+{
+  cv::Mat r=rho.clone(), z, p, Ap;
+  phi=cv::Mat::zeros(rho.rows, rho.cols, CV_64F);
+  const double norm0=cv::norm(r);
+  if(norm0==0)
+    return 0;
+
+  double rz=0, rzPrev=0;
+  int k=0;
+  while(k<maxIters){
+    poissonDCT(r, z);
+    rz=r.dot(z);
+    if(k==0)
+      z.copyTo(p);
+    else
+      cv::scaleAdd(p, rz/rzPrev, z, p);
+    k++;
+    laplacian(p, ux, uy, Ap);
+    const double pAp=p.dot(Ap);
+    if(pAp==0)
+      break;
+    const double alpha=rz/pAp;
+    cv::scaleAdd(p, alpha, phi, phi);
+    cv::scaleAdd(Ap, -alpha, r, r);
+    rzPrev=rz;
+    if(cv::norm(r)<=tol*norm0)
+      break;
+  }
+  return k;
+}
+
+template<typename T>
+void storePhase(const cv::Mat& phi, const cv::Mat& mask, cv::Mat& uphase)
+{
+  for(int i=0; i<phi.rows; i++){
+    const double* p=phi.ptr<double>(i);
+    const uchar* m= mask.empty()? NULL:mask.ptr<uchar>(i);
+    T* u=uphase.ptr<T>(i);
+    for(int j=0; j<phi.cols; j++)
+      if(m==NULL || m[j])
+        u[j]=(T)p[j];
+  }
+}
+
+}
+
+bool leastSquaresSystem(const cv::Mat& wphase, const cv::Mat& mask,
+                        const cv::Mat& quality, cv::Mat& psi, cv::Mat& rho,
+                        cv::Mat& ux, cv::Mat& uy, cv::Mat& w, cv::Mat& inside)
+throw(cv::Exception)
+{
+  if(wphase.type()!=CV_32F && wphase.type()!=CV_64F){
+    cv::Exception e(1000,
+                    "Type not supported, must be single or double precision.",
+                    "leastSquaresSystem", std::string(__FILE__), __LINE__);
+    throw(e);
+  }
+  const int M=wphase.rows, N=wphase.cols;
+  CV_Assert(mask.empty() || (mask.rows==M && mask.cols==N));
+  CV_Assert(quality.empty() || (quality.rows==M && quality.cols==N));
+
+  cv::Mat gx, gy;
+  wphase.convertTo(psi, CV_64F);
+  wrappedGradients(psi, gx, gy);
+
+  inside.release();
+  if(!mask.empty())
+    cv::compare(mask, 0, inside, cv::CMP_NE);
+  const bool weighted= !quality.empty() ||
+                       (!inside.empty() && cv::countNonZero(inside)<M*N);
+
+  if(quality.empty())
+    w=cv::Mat::ones(M, N, CV_64F);
+  else
+    quality.convertTo(w, CV_64F);
+  if(!inside.empty())
+    w.setTo(0, inside==0);
+  differenceWeights(w, ux, uy);
+  divergence(gx, gy, ux, uy, rho);
+  return weighted;
+}
+
+void leastSquaresStore(cv::Mat& phi, const cv::Mat& psi, const cv::Mat& inside,
+                       const cv::Point pixel, cv::Mat uphase)
+{
+  // The constant that makes the solution equal the wrapped phase at pixel
+  phi+=psi.at<double>(pixel.y, pixel.x) - phi.at<double>(pixel.y, pixel.x);
+
+  if(uphase.type()==CV_32F)
+    storePhase<float>(phi, inside, uphase);
+  else
+    storePhase<double>(phi, inside, uphase);
+}
+
+int unwrap2D_ls(cv::Mat wphase, cv::Mat mask, cv::Mat uphase,
+                cv::Point pixel, cv::Mat quality, int maxIters, double tol)
+throw(cv::Exception)
+{
+  const int M=wphase.rows, N=wphase.cols;
+  CV_Assert(uphase.rows==M && uphase.cols==N &&
+            uphase.type()==wphase.type());
+  CV_Assert(pixel.x>=0 && pixel.x<N && pixel.y>=0 && pixel.y<M);
+
+  cv::Mat psi, rho, ux, uy, w, inside, phi;
+  const bool weighted=leastSquaresSystem(wphase, mask, quality, psi, rho,
+                                         ux, uy, w, inside);
+  int iters=0;
+  if(!weighted)
+    poissonDCT(rho, phi);
+  else
+    iters=solvePCG(rho, ux, uy, phi, maxIters, tol);
+
+  leastSquaresStore(phi, psi, inside, pixel, uphase);
+  return iters;
+}
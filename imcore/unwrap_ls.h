@@ -0,0 +1,115 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#ifndef UNWRAP_LS_H
+#define UNWRAP_LS_H
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Least squares phase unwrapping.
+ *
+ * It finds the phase whose differences between neighbor pixels are closest,
+ * in the least squares sense, to the wrapped differences of the wrapped
+ * phase. This leads to a Poisson equation with Neumann borders
+ * \f[
+ * \nabla^2 \phi = \nabla \cdot W(\nabla \psi),
+ * \f]
+ * where \f$ W \f$ wraps to \f$ [-\pi,\pi] \f$. Without weights it is solved
+ * directly with the discrete cosine transform. With weights, from the mask
+ * and an optional quality map, each difference is weighted by the smaller
+ * of the squared weights of its two pixels, and the weighted equation is
+ * solved by conjugate gradient preconditioned with the unweighted DCT
+ * solution [1].
+ *
+ * Unlike unwrap2D, there is no scanning path: the cost depends only on the
+ * image size and, in the weighted case, on the number of iterations. The
+ * solution does not follow the wrapped phase exactly, it is a smooth
+ * least squares fit, and it is shifted so that it equals the wrapped phase
+ * at the given pixel. The pixels outside the mask are not written.
+ *
+ * References:
+ * [1] D. C. Ghiglia and L. A. Romero, "Robust two-dimensional weighted and
+ *     unweighted phase unwrapping that uses fast transforms and iterative
+ *     methods," J. Opt. Soc. Am. A 11, 107-117 (1994).
+ *
+ * @param wphase the wrapped phase, single or double precision.
+ * @param mask the region of interest, 8-bit with non zero values inside,
+ * empty for the whole image.
+ * @param uphase [output] the unwrapped phase, it must have the size and
+ * the type of wphase.
+ * @param pixel the pixel where the unwrapped phase equals the wrapped one.
+ * @param quality optional weights of the pixels in [0,1], of the size of
+ * wphase, empty to weight only by the mask.
+ * @param maxIters the maximum number of conjugate gradient iterations.
+ * @param tol the conjugate gradient stops when the norm of the residual is
+ * below tol times the norm of the initial one.
+ * @return the number of conjugate gradient iterations, zero for the direct
+ * solution.
+ */
+int unwrap2D_ls(cv::Mat wphase, cv::Mat mask, cv::Mat uphase,
+                cv::Point pixel, cv::Mat quality=cv::Mat(),
+                int maxIters=100, double tol=1e-6) throw(cv::Exception);
+
+#ifndef SWIG
+/**
+ * Builds the least squares equation shared by the unwrapping solvers.
+ *
+ * @param wphase the wrapped phase, single or double precision.
+ * @param mask the region of interest, empty for the whole image.
+ * @param quality optional weights of the pixels, empty for none.
+ * @param psi [output] the wrapped phase in double precision.
+ * @param rho [output] the weighted divergence of the wrapped differences.
+ * @param ux [output] the weights of the horizontal differences, the one
+ * at (i,j) joins the pixel with (i,j+1), zero at the last column.
+ * @param uy [output] the weights of the vertical differences, the one at
+ * (i,j) joins the pixel with (i+1,j), zero at the last row.
+ * @param w [output] the weights of the pixels, zero outside the mask.
+ * @param inside [output] the mask as 0 and 255, empty for the whole image.
+ * @return false when all the weights are one, so that the unweighted
+ * solution applies.
+ */
+bool leastSquaresSystem(const cv::Mat& wphase, const cv::Mat& mask,
+                        const cv::Mat& quality, cv::Mat& psi, cv::Mat& rho,
+                        cv::Mat& ux, cv::Mat& uy, cv::Mat& w, cv::Mat& inside)
+throw(cv::Exception);
+/**
+ * Shifts a least squares solution to equal the wrapped phase at pixel and
+ * writes it to the pixels of uphase inside the mask.
+ *
+ * @param phi the solution in double precision, it is shifted in place.
+ * @param psi the wrapped phase in double precision.
+ * @param inside the mask from leastSquaresSystem.
+ * @param pixel the reference pixel.
+ * @param uphase [output] the unwrapped phase, single or double precision.
+ */
+void leastSquaresStore(cv::Mat& phi, const cv::Mat& psi, const cv::Mat& inside,
+                       const cv::Point pixel, cv::Mat uphase);
+#endif
+
+#endif // UNWRAP_LS_H
@@ -0,0 +1,417 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include "unwrap_mg.h"
+#include "unwrap_ls.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+namespace{
+
+/** Smoothing sweeps before and after the coarse correction */
+const int PRE_SWEEPS=2, POST_SWEEPS=2;
+/** Sweeps at the coarsest level */
+const int COARSE_SWEEPS=50;
+/**
+ * The coarsening stops when both sides are at most this size, a side of one
+ * pixel is not halved.
+ */
+const int COARSE_SIZE=4;
+
+/**
+ * A level of the hierarchy: the solution, the right hand side, the
+ * weights of the differences as given by leastSquaresSystem and the
+ * weights of the pixels. Each pixel of the level covers fy rows and fx
+ * columns of the finer level, 2 along the directions coarsened and 1
+ * otherwise. The weights of the differences are those of the pixels
+ * scaled by sx and sy.
+ */
+struct Level
+{
+  cv::Mat phi, rho, ux, uy, w;
+  int fx, fy;
+  double sx, sy;
+};
+
+/** The residual rho - A phi at the row i */
+void residualRow(const Level& l, const int i, double* r)
+{
+  const int M=l.phi.rows, N=l.phi.cols;
+  const double* p=l.phi.ptr<double>(i);
+  const double* pu= i>0? l.phi.ptr<double>(i-1):p;
+  const double* pd= i+1<M? l.phi.ptr<double>(i+1):p;
+  const double* rho=l.rho.ptr<double>(i);
+  const double* ux=l.ux.ptr<double>(i);
+  const double* uy=l.uy.ptr<double>(i);
+  const double* uyUp= i>0? l.uy.ptr<double>(i-1):NULL;
+  for(int j=0; j<N; j++){
+    double a=uy[j]*(pd[j]-p[j]);
+    if(j+1<N)
+      a+=ux[j]*(p[j+1]-p[j]);
+    if(j>0)
+      a+=ux[j-1]*(p[j-1]-p[j]);
+    if(uyUp)
+      a+=uyUp[j]*(pu[j]-p[j]);
+    r[j]=rho[j] - a;
+  }
+}
+
+/**
+ * Relaxes the pixels of one color, (i+j)%2==color. They only depend on the
+ * pixels of the other color, so the rows are independent.
+ */
+class Relax: public cv::ParallelLoopBody
+{
+public:
+  Relax(Level& l, const int color)
+  :m_l(l), m_color(color)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    const int M=m_l.phi.rows, N=m_l.phi.cols;
+    for(int i=r.start; i<r.end; i++){
+      double* p=m_l.phi.ptr<double>(i);
+      const double* pu= i>0? m_l.phi.ptr<double>(i-1):p;
+      const double* pd= i+1<M? m_l.phi.ptr<double>(i+1):p;
+      const double* rho=m_l.rho.ptr<double>(i);
+      const double* ux=m_l.ux.ptr<double>(i);
+      const double* uy=m_l.uy.ptr<double>(i);
+      const double* uyUp= i>0? m_l.uy.ptr<double>(i-1):NULL;
+      for(int j=(i+m_color)&1; j<N; j+=2){
+        double s=uy[j], a=uy[j]*pd[j];
+        if(j+1<N){
+          s+=ux[j];
+          a+=ux[j]*p[j+1];
+        }
+        if(j>0){
+          s+=ux[j-1];
+          a+=ux[j-1]*p[j-1];
+        }
+        if(uyUp){
+          s+=uyUp[j];
+          a+=uyUp[j]*pu[j];
+        }
+        if(s>0)
+          p[j]=(a - rho[j])/s;
+      }
+    }
+  }
+
+private:
+  Level& m_l;
+  const int m_color;
+};
+
+/** One red-black Gauss-Seidel sweep */
+void relax(Level& l)
+{
+  cv::parallel_for_(cv::Range(0, l.phi.rows), Relax(l, 0));
+  cv::parallel_for_(cv::Range(0, l.phi.rows), Relax(l, 1));
+}
+
+/**
+ * Sums the residual of the fine level over the blocks of the coarse pixels
+ * into the right hand side of the coarse level, and clears its solution.
+ */
+class Restrict: public cv::ParallelLoopBody
+{
+public:
+  Restrict(const Level& fine, Level& coarse)
+  :m_fine(fine), m_coarse(coarse)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    const int M=m_fine.phi.rows, N=m_fine.phi.cols;
+    const int fx=m_coarse.fx, fy=m_coarse.fy;
+    std::vector<double> r0(N), r1(N, 0.0);
+    for(int I=r.start; I<r.end; I++){
+      residualRow(m_fine, fy*I, &r0[0]);
+      if(fy==2 && 2*I+1<M)
+        residualRow(m_fine, 2*I+1, &r1[0]);
+      else
+        std::fill(r1.begin(), r1.end(), 0.0);
+      double* rho=m_coarse.rho.ptr<double>(I);
+      for(int J=0; J<m_coarse.rho.cols; J++){
+        double s=r0[fx*J] + r1[fx*J];
+        if(fx==2 && 2*J+1<N)
+          s+=r0[2*J+1] + r1[2*J+1];
+        rho[J]=s;
+      }
+      m_coarse.phi.row(I).setTo(0);
+    }
+  }
+
+private:
+  const Level& m_fine;
+  Level& m_coarse;
+};
+
+/**
+ * The coarse pixels around a fine one and their bilinear weights. The
+ * centre of the fine pixel i is at i/2-1/4 in the coarse grid, the
+ * neighbor is clamped at the borders.
+ */
+inline void interpolation(const int i, const int f, const int n, int* k,
+                          double* c)
+{
+  if(f==1){
+    k[0]=k[1]=i;
+    c[0]=1;
+    c[1]=0;
+    return;
+  }
+  k[0]=i/2;
+  k[1]= i&1? std::min(i/2+1, n-1):std::max(i/2-1, 0);
+  c[0]=0.75;
+  c[1]=0.25;
+}
+
+/**
+ * Adds the coarse correction bilinearly interpolated. Only the coarse
+ * pixels with positive weight contribute, so that the correction does not
+ * leak from outside the mask.
+ */
+class Prolong: public cv::ParallelLoopBody
+{
+public:
+  Prolong(const Level& coarse, Level& fine)
+  :m_coarse(coarse), m_fine(fine)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    const cv::Mat& e=m_coarse.phi;
+    const cv::Mat& w=m_coarse.w;
+    int ki[2], kj[2];
+    double ci[2], cj[2];
+    for(int i=r.start; i<r.end; i++){
+      interpolation(i, m_coarse.fy, e.rows, ki, ci);
+      double* p=m_fine.phi.ptr<double>(i);
+      for(int j=0; j<m_fine.phi.cols; j++){
+        interpolation(j, m_coarse.fx, e.cols, kj, cj);
+        double s=0, sw=0;
+        for(int a=0; a<2; a++)
+          for(int b=0; b<2; b++){
+            const double c=ci[a]*cj[b]*w.at<double>(ki[a], kj[b]);
+            s+=c*e.at<double>(ki[a], kj[b]);
+            sw+=c;
+          }
+        if(sw>0)
+          p[j]+=s/sw;
+      }
+    }
+  }
+
+private:
+  const Level& m_coarse;
+  Level& m_fine;
+};
+
+/**
+ * The weights of the coarse pixels, the root mean square over their
+ * blocks since the differences are weighted by the squared weights.
+ */
+class CoarsePixelWeights: public cv::ParallelLoopBody
+{
+public:
+  CoarsePixelWeights(const Level& fine, Level& coarse)
+  :m_fine(fine), m_coarse(coarse)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    const int M=m_fine.w.rows, N=m_fine.w.cols;
+    const int fx=m_coarse.fx, fy=m_coarse.fy;
+    for(int I=r.start; I<r.end; I++){
+      const int i1=std::min(fy*I+fy, M);
+      double* wc=m_coarse.w.ptr<double>(I);
+      for(int J=0; J<m_coarse.w.cols; J++){
+        const int j1=std::min(fx*J+fx, N);
+        double s=0;
+        for(int i=fy*I; i<i1; i++)
+          for(int j=fx*J; j<j1; j++)
+            s+=m_fine.w.at<double>(i,j)*m_fine.w.at<double>(i,j);
+        wc[J]=std::sqrt(s/((i1-fy*I)*(j1-fx*J)));
+      }
+    }
+  }
+
+private:
+  const Level& m_fine;
+  Level& m_coarse;
+};
+
+/**
+ * The weights of the differences of the coarse level, from its pixel
+ * weights with the rule of the finest level and the scales of the level.
+ */
+class CoarseWeights: public cv::ParallelLoopBody
+{
+public:
+  CoarseWeights(Level& coarse)
+  :m_coarse(coarse)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    const int M=m_coarse.w.rows, N=m_coarse.w.cols;
+    const double sx=m_coarse.sx, sy=m_coarse.sy;
+    for(int i=r.start; i<r.end; i++){
+      const double* p=m_coarse.w.ptr<double>(i);
+      const double* pd= i+1<M? m_coarse.w.ptr<double>(i+1):NULL;
+      double* ux=m_coarse.ux.ptr<double>(i);
+      double* uy=m_coarse.uy.ptr<double>(i);
+      for(int j=0; j<N; j++){
+        ux[j]= j+1<N? sx*std::min(p[j]*p[j], p[j+1]*p[j+1]):0;
+        uy[j]= pd? sy*std::min(p[j]*p[j], pd[j]*pd[j]):0;
+      }
+    }
+  }
+
+private:
+  Level& m_coarse;
+};
+
+/** Squared norms of the residual of a level, one per row */
+class ResidualNorm: public cv::ParallelLoopBody
+{
+public:
+  ResidualNorm(const Level& l, std::vector<double>& norms)
+  :m_l(l), m_norms(norms)
+  {}
+
+  void operator()(const cv::Range& r) const
+  {
+    std::vector<double> res(m_l.phi.cols);
+    for(int i=r.start; i<r.end; i++){
+      residualRow(m_l, i, &res[0]);
+      double s=0;
+      for(int j=0; j<m_l.phi.cols; j++)
+        s+=res[j]*res[j];
+      m_norms[i]=s;
+    }
+  }
+
+private:
+  const Level& m_l;
+  std::vector<double>& m_norms;
+};
+
+/** Norm of the residual of a level */
+double residualNorm(const Level& l)
+{
+  std::vector<double> norms(l.phi.rows);
+  cv::parallel_for_(cv::Range(0, l.phi.rows), ResidualNorm(l, norms));
+  double s=0;
+  for(size_t i=0; i<norms.size(); i++)
+    s+=norms[i];
+  return std::sqrt(s);
+}
+
+/**
+ * A V-cycle from the level k: smoothing, correction from the coarser
+ * levels and smoothing again. The coarsest level is only relaxed.
+ */
+void vcycle(std::vector<Level>& levels, const size_t k)
+{
+  Level& l=levels[k];
+  if(k+1==levels.size()){
+    for(int s=0; s<COARSE_SWEEPS; s++)
+      relax(l);
+    return;
+  }
+  Level& c=levels[k+1];
+  for(int s=0; s<PRE_SWEEPS; s++)
+    relax(l);
+  cv::parallel_for_(cv::Range(0, c.phi.rows), Restrict(l, c));
+  vcycle(levels, k+1);
+  cv::parallel_for_(cv::Range(0, l.phi.rows), Prolong(c, l));
+  for(int s=0; s<POST_SWEEPS; s++)
+    relax(l);
+}
+
+}
+
+int unwrap2D_mg(cv::Mat wphase, cv::Mat mask, cv::Mat uphase,
+                cv::Point pixel, cv::Mat quality, int maxCycles, double tol)
+throw(cv::Exception)
+{
+  const int M=wphase.rows, N=wphase.cols;
+  CV_Assert(uphase.rows==M && uphase.cols==N &&
+            uphase.type()==wphase.type());
+  CV_Assert(pixel.x>=0 && pixel.x<N && pixel.y>=0 && pixel.y<M);
+
+  std::vector<Level> levels(1);
+  cv::Mat psi, inside;
+  Level& fine=levels[0];
+  leastSquaresSystem(wphase, mask, quality, psi, fine.rho, fine.ux, fine.uy,
+                     fine.w, inside);
+  fine.phi=cv::Mat::zeros(M, N, CV_64F);
+  fine.fx=fine.fy=1;
+  fine.sx=fine.sy=1;
+  const double norm0=cv::norm(fine.rho);
+
+  while(levels.back().phi.rows>COARSE_SIZE ||
+        levels.back().phi.cols>COARSE_SIZE){
+    const Level& f=levels.back();
+    Level c;
+    c.fy= f.phi.rows>1? 2:1;
+    c.fx= f.phi.cols>1? 2:1;
+    const int Mc=(f.phi.rows+c.fy-1)/c.fy, Nc=(f.phi.cols+c.fx-1)/c.fx;
+    // A coarse difference stands for fy (fx) fine ones across the border
+    // of the blocks and, along a coarsened direction, the spacing doubles,
+    // which keeps the scale of the summed residual
+    c.sx=f.sx*c.fy/c.fx;
+    c.sy=f.sy*c.fx/c.fy;
+    c.phi.create(Mc, Nc, CV_64F);
+    c.rho.create(Mc, Nc, CV_64F);
+    c.ux.create(Mc, Nc, CV_64F);
+    c.uy.create(Mc, Nc, CV_64F);
+    c.w.create(Mc, Nc, CV_64F);
+    cv::parallel_for_(cv::Range(0, Mc), CoarsePixelWeights(f, c));
+    cv::parallel_for_(cv::Range(0, Mc), CoarseWeights(c));
+    levels.push_back(c);
+  }
+  // The pixel weights of the finest level are not needed anymore
+  levels[0].w.release();
+
+  int cycles=0;
+  if(norm0>0)
+    while(cycles<maxCycles){
+      vcycle(levels, 0);
+      cycles++;
+      if(residualNorm(levels[0])<=tol*norm0)
+        break;
+    }
+
+  leastSquaresStore(levels[0].phi, psi, inside, pixel, uphase);
+  return cycles;
+}
@@ -0,0 +1,67 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#ifndef UNWRAP_MG_H
+#define UNWRAP_MG_H
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Multigrid least squares phase unwrapping.
+ *
+ * It solves the same weighted least squares problem as unwrap2D_ls, but
+ * with multigrid V-cycles instead of transforms, so it scales to very large
+ * phase maps. Each level halves the sides of the previous one: the
+ * residual is restricted by summing blocks of 2x2 pixels, the weights of
+ * the pixels are averaged over the blocks and the coarse correction is
+ * bilinearly interpolated from the coarse pixels with positive weight. The
+ * smoother is a red-black Gauss-Seidel, whose rows of the same color are
+ * relaxed in parallel, as are the transfers between levels.
+ *
+ * The memory used is linear in the size of the phase, about seven double
+ * precision images, and there is no scanning state. The pixels outside the
+ * mask have zero weight, they are not written.
+ *
+ * @param wphase the wrapped phase, single or double precision.
+ * @param mask the region of interest, 8-bit with non zero values inside,
+ * empty for the whole image.
+ * @param uphase [output] the unwrapped phase, it must have the size and
+ * the type of wphase.
+ * @param pixel the pixel where the unwrapped phase equals the wrapped one.
+ * @param quality optional weights of the pixels in [0,1], of the size of
+ * wphase, empty to weight only by the mask.
+ * @param maxCycles the maximum number of V-cycles.
+ * @param tol the iteration stops when the norm of the residual is below tol
+ * times the norm of the initial one.
+ * @return the number of V-cycles.
+ */
+int unwrap2D_mg(cv::Mat wphase, cv::Mat mask, cv::Mat uphase,
+                cv::Point pixel, cv::Mat quality=cv::Mat(),
+                int maxCycles=30, double tol=1e-6) throw(cv::Exception);
+
+#endif // UNWRAP_MG_H
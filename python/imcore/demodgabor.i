@@ -9,7 +9,7 @@
 %include "scanner.i"
 %include "numpy.i"
 
-%ignore DemodGabor(const cv::Mat I);
+%ignore DemodGabor(const cv::Mat I, const int type);
 %ignore getFr();
 %ignore getFi();
 %ignore getWx();
@@ -0,0 +1,10 @@
+/* -*- C -*-  (not really, but good for syntax highlighting) */
+#ifndef SCANORDER
+#define SCANORDER
+%{
+#include "scanorder.h"
+%}
+%include "std_string.i"
+%include "cvmaps.i"
+%include "scanorder.h"
+#endif
@@ -8,6 +8,7 @@
 
 %include "numpy.i"
 %include "cvmaps.i"
+%include "scanorder.i"
 %include "unwrap.h"
 
 %extend Unwrap{
@@ -0,0 +1,285 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/convolution.h>
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+
+using namespace std;
+
+const char* pathName(int path)
+{
+  switch(path){
+  case CONV_SCALAR: return "scalar";
+  case CONV_SSE2: return "sse2";
+  case CONV_AVX2: return "avx2";
+  case CONV_AVX512: return "avx512";
+  }
+  return "unknown";
+}
+
+template<typename T>
+void fill(vector<T>& v)
+{
+  for(size_t i=0; i<v.size(); i++)
+    v[i] = 2.0*rand()/RAND_MAX - 1.0;
+}
+
+/**
+ * Compares the given path against the scalar path for a data set of MxN
+ * and kernels of size (2kM+1)x(2kN+1). Returns the number of failures.
+ */
+template<typename T>
+int compare(int path, const int M, const int N, const int kM, const int kN,
+            const double tol)
+{
+  vector<T> data(M*N), kx(2*kN+1), ky(2*kM+1);
+  vector<T> ref(M*N), out(M*N), refXY(M*N), outXY(M*N);
+  fill(data); fill(kx); fill(ky);
+
+  setConvolutionPath(CONV_SCALAR);
+  if(sizeof(T)==sizeof(double)){
+    dconvolution((double*)&data[0], (double*)&kx[0], (double*)&ky[0],
+                 (double*)&ref[0], M, N, 2*kM+1, 2*kN+1);
+    for(int y=0; y<M; y++)
+      for(int x=0; x<N; x++)
+        refXY[y*N+x]=dconvolutionAtXY((double*)&data[0], (double*)&kx[0],
+                                      (double*)&ky[0], x, y, M, N, kM, kN);
+  }
+  else{
+    sconvolution((float*)&data[0], (float*)&kx[0], (float*)&ky[0],
+                 (float*)&ref[0], M, N, 2*kM+1, 2*kN+1);
+    for(int y=0; y<M; y++)
+      for(int x=0; x<N; x++)
+        refXY[y*N+x]=sconvolutionAtXY((float*)&data[0], (float*)&kx[0],
+                                      (float*)&ky[0], x, y, M, N, kM, kN);
+  }
+
+  setConvolutionPath(path);
+  if(sizeof(T)==sizeof(double)){
+    dconvolution((double*)&data[0], (double*)&kx[0], (double*)&ky[0],
+                 (double*)&out[0], M, N, 2*kM+1, 2*kN+1);
+    for(int y=0; y<M; y++)
+      for(int x=0; x<N; x++)
+        outXY[y*N+x]=dconvolutionAtXY((double*)&data[0], (double*)&kx[0],
+                                      (double*)&ky[0], x, y, M, N, kM, kN);
+  }
+  else{
+    sconvolution((float*)&data[0], (float*)&kx[0], (float*)&ky[0],
+                 (float*)&out[0], M, N, 2*kM+1, 2*kN+1);
+    for(int y=0; y<M; y++)
+      for(int x=0; x<N; x++)
+        outXY[y*N+x]=sconvolutionAtXY((float*)&data[0], (float*)&kx[0],
+                                      (float*)&ky[0], x, y, M, N, kM, kN);
+  }
+
+  // The error bound grows with the number of terms of the sum.
+  const double bound = tol*(2*kM+1)*(2*kN+1);
+  double err=0, errXY=0;
+  for(int i=0; i<M*N; i++){
+    err = max(err, fabs((double)out[i]-ref[i]));
+    errXY = max(errXY, fabs((double)outXY[i]-refXY[i]));
+  }
+  cout<<"  "<<pathName(path)<<(sizeof(T)==sizeof(double)? " double":" float")
+      <<" "<<M<<"x"<<N<<", kernel "<<2*kM+1<<"x"<<2*kN+1
+      <<": error "<<err<<", at (x,y) "<<errXY<<endl;
+  return (err<=bound && errXY<=bound)? 0:1;
+}
+
+double convAtXY(const double* d, const double* kx, const double* ky,
+                int x, int y, int M, int N, int kM, int kN)
+{
+  return dconvolutionAtXY(d, kx, ky, x, y, M, N, kM, kN);
+}
+
+float convAtXY(const float* d, const float* kx, const float* ky,
+               int x, int y, int M, int N, int kM, int kN)
+{
+  return sconvolutionAtXY(d, kx, ky, x, y, M, N, kM, kN);
+}
+
+void gaborAtXY(const double* d, const double* kxr, const double* kxi,
+               const double* kyr, const double* kyi, int x, int y, int M,
+               int N, int kM, int kN, double* re, double* im)
+{
+  dgaborAtXY(d, kxr, kxi, kyr, kyi, x, y, M, N, kM, kN, re, im);
+}
+
+void gaborAtXY(const float* d, const float* kxr, const float* kxi,
+               const float* kyr, const float* kyi, int x, int y, int M,
+               int N, int kM, int kN, float* re, float* im)
+{
+  sgaborAtXY(d, kxr, kxi, kyr, kyi, x, y, M, N, kM, kN, re, im);
+}
+
+/**
+ * Compares the fused complex filter of the given path against the four
+ * real convolutions of the scalar path. Returns the number of failures.
+ */
+template<typename T>
+int compareGabor(int path, const int M, const int N, const int kM,
+                 const int kN, const double tol)
+{
+  vector<T> data(M*N), kxr(2*kN+1), kxi(2*kN+1), kyr(2*kM+1), kyi(2*kM+1);
+  fill(data); fill(kxr); fill(kxi); fill(kyr); fill(kyi);
+
+  double err=0;
+  for(int y=0; y<M; y++)
+    for(int x=0; x<N; x++){
+      setConvolutionPath(CONV_SCALAR);
+      const T* d=&data[0];
+      double re = convAtXY(d, &kxr[0], &kyr[0], x, y, M, N, kM, kN) -
+          convAtXY(d, &kxi[0], &kyi[0], x, y, M, N, kM, kN);
+      double im = convAtXY(d, &kxr[0], &kyi[0], x, y, M, N, kM, kN) +
+          convAtXY(d, &kxi[0], &kyr[0], x, y, M, N, kM, kN);
+      setConvolutionPath(path);
+      T fre, fim;
+      gaborAtXY(d, &kxr[0], &kxi[0], &kyr[0], &kyi[0], x, y, M, N, kM, kN,
+                &fre, &fim);
+      err = max(err, max(fabs(fre-re), fabs(fim-im)));
+    }
+
+  const double bound = tol*(2*kM+1)*(2*kN+1);
+  cout<<"  "<<pathName(path)<<(sizeof(T)==sizeof(double)? " double":" float")
+      <<" gabor "<<M<<"x"<<N<<", kernel "<<2*kM+1<<"x"<<2*kN+1
+      <<": error "<<err<<endl;
+  return err<=bound? 0:1;
+}
+
+void gaborRows(const double* d, const double* kxr, const double* kxi,
+               double* rr, double* ri, int M, int N, int kN)
+{
+  dgaborRows(d, kxr, kxi, rr, ri, 0, M, N, kN);
+}
+
+void gaborRows(const float* d, const float* kxr, const float* kxi,
+               float* rr, float* ri, int M, int N, int kN)
+{
+  sgaborRows(d, kxr, kxi, rr, ri, 0, M, N, kN);
+}
+
+void gaborCols(const double* rr, const double* ri, const double* kyr,
+               const double* kyi, double* fr, double* fi, int M, int N,
+               int kM)
+{
+  // Two row ranges, as if they were computed by two threads
+  dgaborCols(rr, ri, kyr, kyi, fr, fi, 0, M/2, M, N, kM);
+  dgaborCols(rr, ri, kyr, kyi, fr, fi, M/2, M, M, N, kM);
+}
+
+void gaborCols(const float* rr, const float* ri, const float* kyr,
+               const float* kyi, float* fr, float* fi, int M, int N, int kM)
+{
+  sgaborCols(rr, ri, kyr, kyi, fr, fi, 0, M/2, M, N, kM);
+  sgaborCols(rr, ri, kyr, kyi, fr, fi, M/2, M, M, N, kM);
+}
+
+/**
+ * Compares the two-pass complex filter of the given path against the
+ * fused filter at every pixel. Returns the number of failures.
+ */
+template<typename T>
+int compareSeparable(int path, const int M, const int N, const int kM,
+                     const int kN, const double tol)
+{
+  vector<T> data(M*N), kxr(2*kN+1), kxi(2*kN+1), kyr(2*kM+1), kyi(2*kM+1);
+  vector<T> rr(M*N), ri(M*N), fr(M*N), fi(M*N);
+  fill(data); fill(kxr); fill(kxi); fill(kyr); fill(kyi);
+
+  setConvolutionPath(path);
+  gaborRows(&data[0], &kxr[0], &kxi[0], &rr[0], &ri[0], M, N, kN);
+  gaborCols(&rr[0], &ri[0], &kyr[0], &kyi[0], &fr[0], &fi[0], M, N, kM);
+
+  setConvolutionPath(CONV_SCALAR);
+  double err=0;
+  for(int y=0; y<M; y++)
+    for(int x=0; x<N; x++){
+      T re, im;
+      gaborAtXY(&data[0], &kxr[0], &kxi[0], &kyr[0], &kyi[0], x, y, M, N,
+                kM, kN, &re, &im);
+      err = max(err, (double)max(fabs(fr[y*N+x]-re), fabs(fi[y*N+x]-im)));
+    }
+
+  const double bound = tol*(2*kM+1)*(2*kN+1);
+  cout<<"  "<<pathName(path)<<(sizeof(T)==sizeof(double)? " double":" float")
+      <<" two-pass "<<M<<"x"<<N<<", kernel "<<2*kM+1<<"x"<<2*kN+1
+      <<": error "<<err<<endl;
+  return err<=bound? 0:1;
+}
+
+int main(int argc, char* argv[])
+{
+  const int sizes[][4]={{64, 64, 3, 3}, {37, 53, 7, 7}, {50, 41, 21, 3},
+                        {15, 15, 21, 21}, {140, 150, 22, 40}};
+  int failures=0;
+
+  cout<<"Checking the fused complex filter"<<endl;
+  for(int path=CONV_SCALAR; path<=CONV_AVX512; path++){
+    if(!convolutionPathSupported(path))
+      continue;
+    for(int k=0; k<4; k++){
+      failures+= compareGabor<double>(path, sizes[k][0], sizes[k][1],
+                                      sizes[k][2], sizes[k][3], 1e-15);
+      failures+= compareGabor<float>(path, sizes[k][0], sizes[k][1],
+                                     sizes[k][2], sizes[k][3], 1e-6);
+    }
+  }
+
+  cout<<"Checking the two-pass complex filter"<<endl;
+  for(int path=CONV_SCALAR; path<=CONV_AVX512; path++){
+    if(!convolutionPathSupported(path))
+      continue;
+    for(int k=0; k<5; k++){
+      failures+= compareSeparable<double>(path, sizes[k][0], sizes[k][1],
+                                          sizes[k][2], sizes[k][3], 1e-15);
+      failures+= compareSeparable<float>(path, sizes[k][0], sizes[k][1],
+                                         sizes[k][2], sizes[k][3], 1e-6);
+    }
+  }
+
+  for(int path=CONV_SSE2; path<=CONV_AVX512; path++){
+    if(!convolutionPathSupported(path)){
+      cout<<pathName(path)<<" not supported, skipped"<<endl;
+      continue;
+    }
+    cout<<"Checking "<<pathName(path)<<" against the scalar path"<<endl;
+    for(int k=0; k<5; k++){
+      failures+= compare<double>(path, sizes[k][0], sizes[k][1],
+                                 sizes[k][2], sizes[k][3], 1e-15);
+      failures+= compare<float>(path, sizes[k][0], sizes[k][1],
+                                sizes[k][2], sizes[k][3], 1e-6);
+    }
+  }
+  setConvolutionPath(CONV_AUTO);
+
+  if(failures)
+    cerr<<failures<<" comparisons failed"<<endl;
+  return failures? 1:0;
+}
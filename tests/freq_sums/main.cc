@@ -0,0 +1,129 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/gabor_gears.h>
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+/** Uniform random number in [a,b) */
+double uniform(const double a, const double b)
+{
+  return a + (b-a)*rand()/((double)RAND_MAX + 1);
+}
+
+/** Uniform random integer in [a,b) */
+int uniform(const int a, const int b)
+{
+  return a + rand()%(b-a);
+}
+
+/**
+ * Sums the frequencies of the visited pixels in the window of NxN pixels
+ * centered at (i,j), scanning the window.
+ */
+int windowSum(const cv::Mat& fx, const cv::Mat& fy, const BitImage& visited,
+              const int i, const int j, const int N, cv::Vec2d& sums)
+{
+  int count=0;
+  sums=cv::Vec2d(0, 0);
+  for(int y=max(i-N/2, 0); y<=min(i+N/2, fx.rows-1); y++)
+    for(int x=max(j-N/2, 0); x<=min(j+N/2, fx.cols-1); x++)
+      if(visited(y,x)){
+        sums[0]+=fx.at<double>(y,x);
+        sums[1]+=fy.at<double>(y,x);
+        count++;
+      }
+  return count;
+}
+
+/**
+ * Checks the running sums against a scan of the windows while pixels are
+ * visited and their frequencies changed. Returns the number of failures.
+ */
+int checkSums(const int M, const int N)
+{
+  // The sums are stored in single precision
+  const double tol=1e-4;
+  const int sizes[]={1, 3, 5, 7, 9, 15, 31};
+  cv::Mat fx(M, N, CV_64F), fy(M, N, CV_64F);
+  BitImage visited(M, N);
+  for(int i=0; i<M; i++)
+    for(int j=0; j<N; j++){
+      fx.at<double>(i,j)=uniform(-M_PI, M_PI);
+      fy.at<double>(i,j)=uniform(-M_PI, M_PI);
+      if(uniform(0, 3)==0)
+        visited.set(i,j);
+    }
+
+  gabor::FreqSums sums(fx, fy, visited);
+  int failures=0;
+  double err=0;
+  for(int k=0; k<4*M*N; k++){
+    const int i=uniform(0, M), j=uniform(0, N);
+    if(!visited(i,j)){
+      visited.set(i,j);
+      sums.insert(i, j, fx.at<double>(i,j), fy.at<double>(i,j));
+    }
+    else{
+      const double dx=uniform(-0.5, 0.5), dy=uniform(-0.5, 0.5);
+      fx.at<double>(i,j)+=dx;
+      fy.at<double>(i,j)+=dy;
+      sums.update(i, j, dx, dy);
+    }
+
+    const int y=uniform(0, M), x=uniform(0, N);
+    for(size_t s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++){
+      cv::Vec2d fast, direct;
+      const int cfast=sums.sum(y, x, sizes[s], fast);
+      const int cdirect=windowSum(fx, fy, visited, y, x, sizes[s], direct);
+      const double e=max(fabs(fast[0]-direct[0]), fabs(fast[1]-direct[1]));
+      err=max(err, e);
+      if(cfast!=cdirect || e>tol*max(cdirect, 1))
+        failures++;
+    }
+  }
+  cout<<M<<"x"<<N<<": largest difference "<<err<<endl;
+  return failures;
+}
+
+int main(int argc, char* argv[])
+{
+  srand(12345);
+  int failures=0;
+  failures+=checkSums(37, 29);
+  failures+=checkSums(16, 16);
+  failures+=checkSums(1, 50);
+  failures+=checkSums(50, 1);
+
+  if(failures)
+    cout<<failures<<" windows failed"<<endl;
+  return failures? 1:0;
+}
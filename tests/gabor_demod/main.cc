@@ -82,7 +82,7 @@ int main(int argc, char* argv[])
   std::cout<<"Frecuencia teorica local en el punto: ("<<fx.at<double>(p.y,p.x)
            <<", "<<fy.at<double>(p.y,p.x) <<")"<<std::endl;
 
-  int i=p.y, j=p.x, cont=0;
+  int i=p.y, j=p.x;
 
   DemodGabor gabor(I);
   gabor.setIters(1).setKernelSize(7).
@@ -102,30 +102,28 @@ int main(int argc, char* argv[])
   //gabor.run();
 
   do{
-    // Codigo para mostrar resultados en tiempo real
-    if((cont++)%5000==0){
-      // Genera kerneles del filtro de gabor
-      wx = ffx.at<double>(i,j);
-      wy = ffy.at<double>(i,j);
-      double sx = fabs(1.5708/wx), sy = fabs(1.5708/wy);
-      sx = sx>7? 7:(sx<1? 1:sx);
-      sy = sy>7? 7:(sy<1? 1:sy);
-      gen_gaborKernel(hxr, hxi, wx, sx, CV_64F);
-      gen_gaborKernel(hyr, hyi, wy, sy, CV_64F);
-      // Genera la parte imaginaria del filtro de gabor para desplegarlo
-      h=cv::Mat::zeros(64,64, CV_64F)-1;
-      for(int i=0; i<hyr.cols; i++)
-        for(int j=0; j<hxr.cols; j++)
-          h.at<double>(i,j)=hxr.at<double>(0,j)*hyi.at<double>(0,i) +
-              hxi.at<double>(0,j)*hyr.at<double>(0,i);
-
-      cv::normalize(fr,tmp,1,0,cv::NORM_MINMAX);
-      cv::imshow("real", tmp);
-      cv::normalize(h,tmp,1,0,cv::NORM_MINMAX);
-      cv::imshow("cos(fase)", tmp);
-      cv::waitKey(32);
-    }
-  }while(gabor.runInteractive(scan));
+    // Codigo para mostrar resultados en tiempo real, cada 5000 pixeles
+    // Genera kerneles del filtro de gabor
+    wx = ffx.at<double>(i,j);
+    wy = ffy.at<double>(i,j);
+    double sx = fabs(1.5708/wx), sy = fabs(1.5708/wy);
+    sx = sx>7? 7:(sx<1? 1:sx);
+    sy = sy>7? 7:(sy<1? 1:sy);
+    gen_gaborKernel(hxr, hxi, wx, sx, CV_64F);
+    gen_gaborKernel(hyr, hyi, wy, sy, CV_64F);
+    // Genera la parte imaginaria del filtro de gabor para desplegarlo
+    h=cv::Mat::zeros(64,64, CV_64F)-1;
+    for(int i=0; i<hyr.cols; i++)
+      for(int j=0; j<hxr.cols; j++)
+        h.at<double>(i,j)=hxr.at<double>(0,j)*hyi.at<double>(0,i) +
+            hxi.at<double>(0,j)*hyr.at<double>(0,i);
+
+    cv::normalize(fr,tmp,1,0,cv::NORM_MINMAX);
+    cv::imshow("real", tmp);
+    cv::normalize(h,tmp,1,0,cv::NORM_MINMAX);
+    cv::imshow("cos(fase)", tmp);
+    cv::waitKey(32);
+  }while(gabor.runInteractive(scan, 5000));
 
   // Calculo de la fase de salida
   fase = atan2<double>(fi,fr);
@@ -0,0 +1,99 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/gabor_gears.h>
+#include <utils/utils.h>
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+
+/**
+ * Filters fringes with the direct method, the FFT method and a filter
+ * bank reusing the spectrum, and compares the results relative to the
+ * largest magnitude. Returns the number of failures.
+ */
+template<typename T>
+int compare(const int M, const int N, const double tol)
+{
+  const int type= sizeof(T)==sizeof(float)? CV_32F:CV_64F;
+  cv::Mat I=cos<float>(peaks(M, N)*20);
+  I.convertTo(I, type);
+
+  // From large kernels at low frequencies to the smallest ones
+  const double freqs[][2]={{0.05, 0.08}, {0.3, -0.2}, {-0.9, 0.6},
+                           {1.4, 1.5}};
+  gabor::FilterBank bank(I);
+  bank.setMethod(GABOR_FFT);
+  int failures=0;
+  for(int k=0; k<4; k++){
+    const double wx=freqs[k][0], wy=freqs[k][1];
+    cv::Mat dr(M, N, type), di(M, N, type), fr(M, N, type), fi(M, N, type);
+    cv::Mat br(M, N, type), bi(M, N, type);
+
+    int64 start=cv::getTickCount();
+    gabor_filter(I, dr, di, wx, wy, GABOR_DIRECT);
+    const double tDirect=(cv::getTickCount()-start)/cv::getTickFrequency();
+    start=cv::getTickCount();
+    gabor_filter(I, fr, fi, wx, wy, GABOR_FFT);
+    const double tFFT=(cv::getTickCount()-start)/cv::getTickFrequency();
+    start=cv::getTickCount();
+    bank(br, bi, wx, wy);
+    const double tBank=(cv::getTickCount()-start)/cv::getTickFrequency();
+
+    cv::Mat magn;
+    cv::magnitude(dr, di, magn);
+    double scale=0;
+    cv::minMaxLoc(magn, NULL, &scale);
+    const double err=max(cv::norm(dr, fr, cv::NORM_INF),
+                         cv::norm(di, fi, cv::NORM_INF))/scale;
+    const double errBank=max(cv::norm(dr, br, cv::NORM_INF),
+                             cv::norm(di, bi, cv::NORM_INF))/scale;
+
+    cout<<(type==CV_32F? "float ":"double ")<<M<<"x"<<N<<" ("<<wx<<", "
+        <<wy<<"): FFT error "<<err<<", bank error "<<errBank
+        <<", direct "<<tDirect<<" s, FFT "<<tFFT<<" s, bank "<<tBank
+        <<" s"<<endl;
+    if(err>tol || errBank>tol)
+      failures++;
+  }
+  return failures;
+}
+
+int main(int argc, char* argv[])
+{
+  int failures=0;
+  failures+=compare<double>(128, 160, 1e-9);
+  failures+=compare<float>(127, 93, 1e-4);
+  failures+=compare<double>(512, 512, 1e-9);
+  failures+=compare<float>(300, 421, 1e-4);
+
+  if(failures)
+    cout<<failures<<" comparisons failed"<<endl;
+  return failures? 1:0;
+}
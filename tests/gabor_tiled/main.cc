@@ -0,0 +1,112 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/demodgabor.h>
+#include <imcore/phase_wrap.h>
+#include <utils/utils.h>
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+
+/**
+ * Demodulates fringes with and without tiles and compares the phases.
+ *
+ * Each demodulation has a global sign ambiguity, so the tiled phase is
+ * compared with the sequential one after matching the global sign. A sign
+ * flip at a tile seam would leave whole tiles with the opposite sign, more
+ * than a tenth of the image with the sizes used here.
+ * Returns 1 on failure.
+ */
+int compare(const int M, const int N, const int tileSize, const int overlap,
+            const double minAgreement)
+{
+  cv::Mat I=cos<float>(peaks(M, N)*23);
+  I.convertTo(I, CV_64F);
+
+  DemodGabor seq(I);
+  seq.setMinfq(0.1).setMaxfq(M_PI/2).setTau(0.97).setSeedIters(11);
+  int64 start=cv::getTickCount();
+  seq.run();
+  const double tSeq=(cv::getTickCount()-start)/cv::getTickFrequency();
+
+  DemodGabor tiled(I);
+  tiled.setMinfq(0.1).setMaxfq(M_PI/2).setTau(0.97).setSeedIters(11);
+  tiled.setTileSize(tileSize).setTileOverlap(overlap);
+  start=cv::getTickCount();
+  tiled.run();
+  const double tTiled=(cv::getTickCount()-start)/cv::getTickFrequency();
+
+  cv::Mat ps=atan2<double>(seq.getFi(), seq.getFr());
+  cv::Mat pt=atan2<double>(tiled.getFi(), tiled.getFr());
+
+  // Pixels where the phases agree with the same and the opposite sign
+  int same=0, opposite=0;
+  for(int i=0; i<M; i++)
+    for(int j=0; j<N; j++){
+      const double a=ps.at<double>(i,j), b=pt.at<double>(i,j);
+      if(fabs(dwrap(a-b))<0.3)
+        same++;
+      if(fabs(dwrap(a+b))<0.3)
+        opposite++;
+    }
+  const double agreement=(double)max(same, opposite)/(M*N);
+
+  cout<<M<<"x"<<N<<" tiles "<<tileSize<<" overlap "<<overlap
+      <<": phase agreement "<<agreement<<", sequential "<<tSeq
+      <<" s, tiled "<<tTiled<<" s"<<endl;
+  return agreement>=minAgreement? 0:1;
+}
+
+/** The tiled mode must reject a zero overlap. Returns 1 on failure. */
+int checkZeroOverlap()
+{
+  cv::Mat I=cos<float>(peaks(64, 64)*10);
+  DemodGabor demod(I);
+  demod.setTileSize(32).setTileOverlap(0);
+  try{
+    demod.run();
+  }
+  catch(cv::Exception& e){
+    return 0;
+  }
+  cout<<"a zero tile overlap was accepted"<<endl;
+  return 1;
+}
+
+int main(int argc, char* argv[])
+{
+  int failures=0;
+  failures+=compare(256, 256, 96, 16, 0.9);
+  failures+=compare(240, 211, 80, 24, 0.9);
+  failures+=checkZeroOverlap();
+
+  if(failures)
+    cout<<failures<<" comparisons failed"<<endl;
+  return failures? 1:0;
+}
@@ -0,0 +1,126 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/gabor_gears.h>
+#include <utils/utils.h>
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+
+/** Largest absolute difference between two kernels of the same size */
+double kernelDifference(const cv::Mat& a, const cv::Mat& b)
+{
+  if(a.cols!=b.cols)
+    return HUGE_VAL;
+  return cv::norm(a, b, cv::NORM_INF);
+}
+
+/**
+ * Compares the cached kernels with the generated ones. The cache rounds f
+ * and sigma to its step, which moves each coefficient at most by the step
+ * times the kernel half size. Returns the number of failures.
+ */
+int compareKernels(const double step)
+{
+  gabor::KernelCache cache(step);
+  cv::Mat gr, gi, cr, ci;
+  double err=0;
+  int failures=0;
+  for(int k=0; k<200; k++){
+    const double f=-M_PI/2 + M_PI*k/199;
+    // Sigmas away from the integers, where the kernel size changes
+    const double sigma=1.25 + (k%23)*0.25 + 0.123456;
+    gen_gaborKernel(gr, gi, f, sigma, CV_64F);
+    cache.get(cr, ci, f, sigma, CV_64F);
+    const double e=max(kernelDifference(gr, cr), kernelDifference(gi, ci));
+    const double bound= step>0? step*(gr.cols/2 + 1):0;
+    err=max(err, e);
+    if(e>bound)
+      failures++;
+
+    // Kernels at multiples of the step are not rounded
+    if(step>0){
+      const double fq=cvRound(f/step)*step, sq=cvRound(sigma/step)*step;
+      gen_gaborKernel(gr, gi, fq, sq, CV_64F);
+      cache.get(cr, ci, fq, sq, CV_64F);
+      if(kernelDifference(gr, cr)!=0 || kernelDifference(gi, ci)!=0)
+        failures++;
+    }
+  }
+  cout<<"step "<<step<<": "<<cache.size()<<" kernels stored, largest"
+      <<" difference "<<err<<endl;
+  return failures;
+}
+
+/**
+ * Filters an image with and without the cache and returns 1 if the
+ * results differ by more than tol times the largest magnitude.
+ */
+int compareFilter(const double step, const double tol)
+{
+  const int M=96, N=96;
+  // peaks is single precision
+  cv::Mat phase;
+  cv::Mat(peaks(M, N)*20).convertTo(phase, CV_64F);
+  cv::Mat I=cos<double>(phase);
+  cv::Mat fr0=cv::Mat::zeros(M, N, CV_64F), fi0=fr0.clone();
+  cv::Mat fr1=fr0.clone(), fi1=fr0.clone();
+  gabor::KernelCache cache(step);
+  gabor::FilterXY exact(I, fr0, fi0), cached(I, fr1, fi1);
+  cached.setKernelCache(&cache);
+
+  for(int y=0; y<M; y++)
+    for(int x=0; x<N; x++){
+      const double wx=0.1 + 1.4*x/N, wy=-0.7 + 1.4*y/M;
+      exact(wx, wy, x, y);
+      cached(wx, wy, x, y);
+    }
+
+  cv::Mat m0, m1;
+  cv::magnitude(fr0, fi0, m0);
+  double scale=0, err=0;
+  cv::minMaxLoc(m0, NULL, &scale);
+  err=max(cv::norm(fr0, fr1, cv::NORM_INF), cv::norm(fi0, fi1, cv::NORM_INF));
+  cout<<"filter with step "<<step<<": relative difference "<<err/scale
+      <<endl;
+  return err<=tol*scale? 0:1;
+}
+
+int main(int argc, char* argv[])
+{
+  int failures=0;
+  failures+=compareKernels(0);
+  failures+=compareKernels(0.001);
+  failures+=compareKernels(0.01);
+  failures+=compareFilter(0.001, 1e-2);
+
+  if(failures)
+    cout<<failures<<" comparisons failed"<<endl;
+  return failures? 1:0;
+}
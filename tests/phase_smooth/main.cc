@@ -0,0 +1,142 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/phase_smooth.h>
+#include <imcore/phase_wrap.h>
+#include <utils/utils.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+
+/**
+ * Compares the fused smoother against the sine and cosine images blurred
+ * with cv::GaussianBlur. Returns the number of failures.
+ */
+template<typename T>
+int compare(const int M, const int N, const double sigma, const double tol)
+{
+  const int type= sizeof(T)==sizeof(float)? CV_32F:CV_64F;
+  // Fringes slow enough that the blurred phasor does not vanish, where its
+  // angle would be ill-conditioned
+  cv::Mat p=ramp(0.05, 0.03, M, N);
+  cv::Mat noise(M, N, CV_32F);
+  cv::randn(noise, 0, 0.1);
+  cv::Mat wp=wphase(p + noise);
+  wp.convertTo(wp, type);
+
+  int64 start=cv::getTickCount();
+  cv::Mat ss=sin<T>(wp), cc=cos<T>(wp);
+  cv::GaussianBlur(ss, ss, cv::Size(0,0), sigma);
+  cv::GaussianBlur(cc, cc, cv::Size(0,0), sigma);
+  cv::Mat ref=atan2<T>(ss, cc);
+  cv::Mat refPath=cos<T>(ref);
+  const double tRef=(cv::getTickCount()-start)/cv::getTickFrequency();
+
+  cv::Mat out, path;
+  start=cv::getTickCount();
+  smoothWrappedPhase(wp, sigma, &out, &path);
+  const double tFused=(cv::getTickCount()-start)/cv::getTickFrequency();
+
+  double err=0, errPath=0;
+  for(int i=0; i<M; i++)
+    for(int j=0; j<N; j++){
+      err=max(err, fabs(dwrap((double)out.at<T>(i,j) - ref.at<T>(i,j))));
+      errPath=max(errPath, fabs((double)path.at<T>(i,j) -
+                                refPath.at<T>(i,j)));
+    }
+
+  cout<<(type==CV_32F? "float ":"double ")<<M<<"x"<<N<<" sigma "<<sigma
+      <<": error "<<err<<", path error "<<errPath
+      <<", GaussianBlur "<<tRef<<" s, fused "<<tFused<<" s"<<endl;
+  return (err<=tol && errPath<=tol)? 0:1;
+}
+
+/**
+ * Compares the fused smoother against the direct 2D sum of the phasors
+ * over the gaussian kernel, in double precision and with the reflect-101
+ * borders of cv::GaussianBlur. Returns the number of failures.
+ */
+template<typename T>
+int compareDirect(const int M, const int N, const double sigma,
+                  const double tol)
+{
+  const int type= sizeof(T)==sizeof(float)? CV_32F:CV_64F;
+  cv::Mat p=ramp(0.05, 0.03, M, N);
+  cv::Mat noise(M, N, CV_32F);
+  cv::randn(noise, 0, 0.1);
+  cv::Mat wp=wphase(p + noise);
+  wp.convertTo(wp, type);
+
+  const int ksize=cvRound(sigma*4*2 + 1)|1, rad=ksize/2;
+  const cv::Mat k=cv::getGaussianKernel(ksize, sigma, CV_64F);
+  cv::Mat out;
+  smoothWrappedPhase(wp, sigma, &out);
+
+  double err=0;
+  for(int i=0; i<M; i++)
+    for(int j=0; j<N; j++){
+      double s=0, c=0;
+      for(int u=-rad; u<=rad; u++){
+        const int y=cv::borderInterpolate(i+u, M, cv::BORDER_REFLECT_101);
+        for(int v=-rad; v<=rad; v++){
+          const int x=cv::borderInterpolate(j+v, N, cv::BORDER_REFLECT_101);
+          const double w=k.at<double>(u+rad, 0)*k.at<double>(v+rad, 0);
+          s+=w*sin((double)wp.at<T>(y,x));
+          c+=w*cos((double)wp.at<T>(y,x));
+        }
+      }
+      err=max(err, fabs(dwrap((double)out.at<T>(i,j) - atan2(s, c))));
+    }
+
+  cout<<(type==CV_32F? "float ":"double ")<<M<<"x"<<N<<" sigma "<<sigma
+      <<": error to the direct sum "<<err<<endl;
+  return err<=tol? 0:1;
+}
+
+int main(int argc, char* argv[])
+{
+  int failures=0;
+  failures+=compare<float>(37, 53, 1.5, 1e-4);
+  failures+=compare<double>(64, 31, 3, 1e-4);
+  failures+=compare<float>(512, 512, 9, 1e-4);
+  failures+=compare<double>(480, 641, 5, 1e-4);
+  // Single rows and columns, and images smaller than the kernel, where
+  // the borders reflect more than once
+  failures+=compareDirect<float>(1, 97, 2, 1.2e-5);
+  failures+=compareDirect<double>(1, 40, 5, 1.2e-5);
+  failures+=compareDirect<float>(61, 1, 3, 1.2e-5);
+  failures+=compareDirect<double>(5, 7, 4, 1.2e-5);
+  failures+=compareDirect<float>(37, 53, 1.5, 1.2e-5);
+  failures+=compareDirect<double>(64, 31, 3, 1.2e-5);
+
+  if(failures)
+    cout<<failures<<" comparisons failed"<<endl;
+  return failures? 1:0;
+}
@@ -0,0 +1,159 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/scanner.h>
+#include <imcore/scanorder.h>
+#include <imcore/unwrap.h>
+#include <utils/utils.h>
+#include <tests/unwrap_fixture.h>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+
+using namespace std;
+
+/** The file where the sequences are saved */
+const char* FILENAME="scan_order_test.bin";
+
+/**
+ * Records the sequence of a scanner, saves it and loads it back. Returns
+ * the number of failures.
+ */
+int checkScanner()
+{
+  const int M=48, N=64;
+  const cv::Mat p=makePhase(M, N);
+  cv::Mat dx, dy;
+  gradient(p, dx, dy);
+  cv::Mat mask=cv::Mat::ones(M, N, CV_8U);
+  mask(cv::Rect(10, 20, 30, 3)).setTo(cv::Scalar(0));
+
+  ScanOrder order;
+  std::vector<cv::Point> visited;
+  Scanner scan(dx, dy, cv::Point(N/2, M/2));
+  scan.setMask(mask);
+  scan.recordTo(&order);
+  visited.push_back(scan.getPosition());
+  while(scan.next())
+    visited.push_back(scan.getPosition());
+  order.save(FILENAME);
+
+  ScanOrder loaded;
+  loaded.load(FILENAME);
+  int failures=0;
+  if(loaded.rows()!=M || loaded.cols()!=N ||
+     loaded.size()!=(int)visited.size())
+    failures++;
+  else
+    for(int k=0; k<loaded.size(); k++)
+      if(loaded.point(k)!=visited[k] || order.point(k)!=visited[k])
+        failures++;
+  cout<<"scanner: "<<visited.size()<<" pixels recorded, "<<failures
+      <<" differ after loading"<<endl;
+  return failures? 1:0;
+}
+
+/**
+ * Unwraps a phase while recording the sequence, then unwraps it again
+ * following the saved sequence. Returns the number of failures.
+ */
+int checkUnwrap(const int type, const bool incremental)
+{
+  const int M=64, N=80;
+  cv::Mat wp=wphase(makePhase(M, N));
+  wp.convertTo(wp, type);
+  cv::Mat mask=cv::Mat::ones(M, N, CV_8U);
+  mask(cv::Rect(0, 20, 50, 4)).setTo(cv::Scalar(0));
+
+  ScanOrder order;
+  Unwrap recorded(wp, TAU, SMOOTH, WINDOW);
+  recorded.setMask(mask);
+  recorded.setPixel(cv::Point(N/2, M/2));
+  recorded.setIncremental(incremental);
+  recorded.record(order);
+  order.save(FILENAME);
+
+  ScanOrder loaded;
+  loaded.load(FILENAME);
+  Unwrap replayed(wp, TAU, SMOOTH, WINDOW);
+  replayed.setMask(mask);
+  replayed.setIncremental(incremental);
+  replayed.replay(loaded);
+
+  // The same pixels are unwrapped in the same order
+  const double err=cv::norm(recorded.getOutput(), replayed.getOutput(),
+                            cv::NORM_INF);
+  cout<<(type==CV_32F? "single":"double")
+      <<(incremental? " incremental":"")<<" unwrap: "<<loaded.size()
+      <<" pixels replayed, largest difference "<<err<<endl;
+  return err==0? 0:1;
+}
+
+/**
+ * Loads files that are not sequences, returns the number of failures.
+ */
+int checkErrors()
+{
+  int failures=0;
+  ScanOrder order;
+  std::remove(FILENAME);
+  try{
+    order.load(FILENAME);
+    failures++;
+  }
+  catch(cv::Exception&){
+  }
+
+  std::ofstream file(FILENAME, std::ios::binary);
+  file<<"not a sequence";
+  file.close();
+  try{
+    order.load(FILENAME);
+    failures++;
+  }
+  catch(cv::Exception&){
+  }
+  cout<<"invalid files: "<<failures<<" loaded without error"<<endl;
+  return failures;
+}
+
+int main(int argc, char* argv[])
+{
+  int failures=0;
+  failures+=checkScanner();
+  failures+=checkUnwrap(CV_64F, false);
+  failures+=checkUnwrap(CV_32F, false);
+  failures+=checkUnwrap(CV_64F, true);
+  failures+=checkErrors();
+  std::remove(FILENAME);
+
+  if(failures)
+    cout<<failures<<" checks failed"<<endl;
+  return failures? 1:0;
+}
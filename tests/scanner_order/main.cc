@@ -0,0 +1,302 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/scanner.h>
+#include <utils/utils.h>
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+using namespace std;
+
+/**
+ * The traversal of the scanner without the frontier, written with plain
+ * matrices: the path goes to the unvisited neighbor of largest magnitude
+ * and, at a dead end, the image is scanned from the last pixel for the
+ * first unvisited pixel next to a visited one.
+ */
+class ReferenceScanner
+{
+public:
+  ReferenceScanner(const cv::Mat_<double>& u, const cv::Mat_<double>& v,
+                   const cv::Mat_<uchar>& mask, const cv::Point pixel)
+  :m_u(u), m_v(v), m_mask(mask), m_pixel(pixel), m_freqmin(0.6)
+  {
+    m_visited=cv::Mat_<uchar>::zeros(u.rows, u.cols);
+    insert(m_pixel);
+  }
+
+  void setFreqMin(const double freq) {m_freqmin=freq;}
+  cv::Point getPosition() const {return m_pixel;}
+
+  bool next()
+  {
+    if(step(m_freqmin*m_freqmin))
+      return true;
+    m_pixel=findPixel();
+    if(m_pixel.x<0)
+      return false;
+    m_freqmin=sqrt(magn(m_pixel.y, m_pixel.x));
+    insert(m_pixel);
+    return true;
+  }
+
+private:
+  cv::Mat_<double> m_u, m_v;
+  cv::Mat_<uchar> m_mask, m_visited;
+  std::vector<cv::Point> m_path;
+  cv::Point m_pixel;
+  double m_freqmin;
+
+  double magn(const int y, const int x) const
+  {
+    return m_u(y,x)*m_u(y,x) + m_v(y,x)*m_v(y,x);
+  }
+
+  bool inside(const int y, const int x) const
+  {
+    return y>=0 && y<m_u.rows && x>=0 && x<m_u.cols;
+  }
+
+  void insert(const cv::Point& p)
+  {
+    if(m_mask(p.y, p.x)){
+      m_visited(p.y, p.x)=1;
+      m_path.push_back(p);
+    }
+  }
+
+  bool step(const double fpow)
+  {
+    while(!m_path.empty()){
+      m_pixel=m_path.back();
+      int idx=-1;
+      double mayor=-1;
+      for(int i=0; i<8; i++){
+        const int y=m_pixel.y+NB_DY[i], x=m_pixel.x+NB_DX[i];
+        if(!inside(y,x) || m_visited(y,x) || !m_mask(y,x))
+          continue;
+        // The last neighbor wins the ties
+        if(magn(y,x)>=fpow && magn(y,x)>=mayor){
+          mayor=magn(y,x);
+          idx=i;
+        }
+      }
+      if(idx>=0){
+        m_pixel=cv::Point(m_pixel.x+NB_DX[idx], m_pixel.y+NB_DY[idx]);
+        insert(m_pixel);
+        return true;
+      }
+      m_path.pop_back();
+    }
+    return false;
+  }
+
+  bool border(const int y, const int x) const
+  {
+    if(m_visited(y,x) || !m_mask(y,x))
+      return false;
+    for(int i=0; i<8; i++){
+      const int ny=y+NB_DY[i], nx=x+NB_DX[i];
+      if(inside(ny,nx) && m_visited(ny,nx) && m_mask(ny,nx))
+        return true;
+    }
+    return false;
+  }
+
+  cv::Point findPixel()
+  {
+    const int x0=m_pixel.x>=0 && m_pixel.x<m_u.cols? m_pixel.x:0;
+    const int y0=m_pixel.y>=0 && m_pixel.y<m_u.rows? m_pixel.y:0;
+    for(int y=y0; y<m_u.rows; y++)
+      for(int x=x0; x<m_u.cols; x++)
+        if(border(y,x))
+          return cv::Point(x, y);
+    for(int y=y0; y>=0; y--)
+      for(int x=x0; x<m_u.cols; x++)
+        if(border(y,x))
+          return cv::Point(x, y);
+    for(int y=y0; y>=0; y--)
+      for(int x=x0; x>=0; x--)
+        if(border(y,x))
+          return cv::Point(x, y);
+    for(int y=y0; y<m_u.rows; y++)
+      for(int x=x0; x>=0; x--)
+        if(border(y,x))
+          return cv::Point(x, y);
+    return cv::Point(-1,-1);
+  }
+};
+
+/** Fringe frequencies with several dead ends and a masked band */
+void makeFields(const int M, const int N, cv::Mat& u, cv::Mat& v,
+                cv::Mat& mask)
+{
+  cv::Mat phase;
+  cv::Mat(peaks(M, N)*12).convertTo(phase, CV_64F);
+  u.create(M, N, CV_64F);
+  v.create(M, N, CV_64F);
+  mask=cv::Mat::ones(M, N, CV_8U);
+  for(int y=0; y<M; y++)
+    for(int x=0; x<N; x++){
+      const int x0=max(x-1, 0), x1=min(x+1, N-1);
+      const int y0=max(y-1, 0), y1=min(y+1, M-1);
+      u.at<double>(y,x)=(phase.at<double>(y,x1)-phase.at<double>(y,x0))/
+        max(x1-x0, 1);
+      v.at<double>(y,x)=(phase.at<double>(y1,x)-phase.at<double>(y0,x))/
+        max(y1-y0, 1);
+      if(abs(y-M/3)<2 && x>N/4)
+        mask.at<uchar>(y,x)=0;
+    }
+}
+
+/**
+ * Compares the visit sequence of the scanner with the reference, returns
+ * the number of failures.
+ */
+int compareOrder(const int M, const int N, const bool staticField)
+{
+  cv::Mat u, v, mask;
+  makeFields(M, N, u, v, mask);
+  const cv::Point start(N/2, M/2);
+  const double minf=0.3;
+
+  Scanner scan(u, v, start);
+  scan.setMask(mask);
+  scan.setFreqMin(minf);
+  scan.useStaticField(staticField);
+  ReferenceScanner ref(u, v, mask, start);
+  ref.setFreqMin(minf);
+
+  int steps=0;
+  for(;;){
+    const bool a=scan.next(), b=ref.next();
+    if(a!=b || (a && scan.getPosition()!=ref.getPosition())){
+      cout<<M<<"x"<<N<<(staticField? " static":"")<<": the sequences"
+          <<" differ at step "<<steps<<endl;
+      return 1;
+    }
+    if(!a)
+      break;
+    steps++;
+  }
+  cout<<M<<"x"<<N<<(staticField? " static":"")<<": "<<steps
+      <<" pixels in the same order"<<endl;
+  return 0;
+}
+
+/**
+ * Compares the scanners with and without the map of magnitudes on single
+ * precision fields, returns the number of failures.
+ */
+int compareStatic(const int M, const int N)
+{
+  cv::Mat u, v, mask;
+  makeFields(M, N, u, v, mask);
+  u.convertTo(u, CV_32F);
+  v.convertTo(v, CV_32F);
+  const cv::Point start(N/2, M/2);
+
+  Scanner dynamic(u, v, start), fixed(u, v, start);
+  dynamic.setMask(mask);
+  fixed.setMask(mask);
+  dynamic.setFreqMin(0.3);
+  fixed.setFreqMin(0.3);
+  fixed.useStaticField(true);
+
+  int steps=0;
+  for(;;){
+    const bool a=dynamic.next(), b=fixed.next();
+    if(a!=b || (a && dynamic.getPosition()!=fixed.getPosition())){
+      cout<<M<<"x"<<N<<" single: the sequences differ at step "<<steps
+          <<endl;
+      return 1;
+    }
+    if(!a)
+      break;
+    steps++;
+  }
+  cout<<M<<"x"<<N<<" single: "<<steps<<" pixels in the same order"<<endl;
+  return 0;
+}
+
+/**
+ * Compares the scanners with and without the frontier, returns the number
+ * of failures. The frontier is enabled after the given number of steps, so
+ * it is also built from a partial scan.
+ */
+int compareFrontier(const int M, const int N, const bool staticField,
+                    const int enableAt)
+{
+  cv::Mat u, v, mask;
+  makeFields(M, N, u, v, mask);
+  const cv::Point start(N/2, M/2);
+
+  Scanner rescan(u, v, start), frontier(u, v, start);
+  rescan.setMask(mask);
+  frontier.setMask(mask);
+  rescan.setFreqMin(0.3);
+  frontier.setFreqMin(0.3);
+  rescan.useStaticField(staticField);
+  frontier.useStaticField(staticField);
+
+  int steps=0;
+  for(;;){
+    if(steps==enableAt)
+      frontier.useFrontier(true);
+    const bool a=rescan.next(), b=frontier.next();
+    if(a!=b || (a && rescan.getPosition()!=frontier.getPosition())){
+      cout<<M<<"x"<<N<<(staticField? " static":"")<<" frontier: the"
+          <<" sequences differ at step "<<steps<<endl;
+      return 1;
+    }
+    if(!a)
+      break;
+    steps++;
+  }
+  cout<<M<<"x"<<N<<(staticField? " static":"")<<" frontier: "<<steps
+      <<" pixels in the same order"<<endl;
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  int failures=0;
+  failures+=compareOrder(64, 80, false);
+  failures+=compareOrder(64, 80, true);
+  failures+=compareOrder(33, 17, false);
+  failures+=compareStatic(64, 80);
+  failures+=compareFrontier(64, 80, false, 0);
+  failures+=compareFrontier(64, 80, true, 0);
+  failures+=compareFrontier(33, 17, false, 0);
+  failures+=compareFrontier(47, 150, true, 500);
+
+  if(failures)
+    cout<<failures<<" checks failed"<<endl;
+  return failures? 1:0;
+}
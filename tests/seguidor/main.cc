@@ -0,0 +1,372 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+#include <imcore/seguidor.h>
+#include <iostream>
+#include <vector>
+#include <list>
+#include <queue>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+/**
+ * The traversal of Seguidor by levels written with one std::list per
+ * level: the next point is taken from the lowest non empty level above
+ * the level of the current point or, if there is none, from the highest
+ * non empty level at or below it.
+ */
+class ReferenceSeguidor
+{
+public:
+  ReferenceSeguidor(const cv::Mat& qmap, const int r, const int c,
+                    const int levels)
+  :m_qmap(qmap), m_colas(levels), m_r(r), m_c(c)
+  {
+    m_caminado=cv::Mat::zeros(qmap.rows, qmap.cols, CV_8U);
+    m_colas[m_qmap.at<uchar>(r,c)].push_back(cv::Point(c, r));
+    m_caminado.at<uchar>(r,c)=1;
+    cargaVecinos();
+  }
+
+  int get_r() const {return m_r;}
+  int get_c() const {return m_c;}
+
+  bool siguiente()
+  {
+    const int nivel=m_qmap.at<uchar>(m_r, m_c), n=(int)m_colas.size();
+    int l=-1;
+    for(int i=nivel; i>=0 && l<0; i--)
+      if(!m_colas[i].empty())
+        l=i;
+    for(int i=nivel+1; i<n; i++)
+      if(!m_colas[i].empty()){
+        l=i;
+        break;
+      }
+    if(l<0)
+      return false;
+    m_r=m_colas[l].front().y;
+    m_c=m_colas[l].front().x;
+    m_colas[l].pop_front();
+    cargaVecinos();
+    return true;
+  }
+
+private:
+  cv::Mat m_qmap, m_caminado;
+  std::vector<std::list<cv::Point> > m_colas;
+  int m_r, m_c;
+
+  void cargaVecinos()
+  {
+    // The order of Seguidor::ordenaVecinos
+    static const int dr[8]={-1, -1, 0, 1, 1, 1, 0, -1};
+    static const int dc[8]={0, -1, -1, -1, 0, 1, 1, 1};
+    for(int k=0; k<8; k++){
+      const int r=m_r+dr[k], c=m_c+dc[k];
+      if(r<0 || r>=m_qmap.rows || c<0 || c>=m_qmap.cols ||
+         m_caminado.at<uchar>(r,c))
+        continue;
+      m_caminado.at<uchar>(r,c)=1;
+      m_colas[m_qmap.at<uchar>(r,c)].push_back(cv::Point(c, r));
+    }
+  }
+};
+
+/** Fringes with noise, so the points are spread over all the levels */
+cv::Mat makeFringes(const int M, const int N)
+{
+  cv::Mat I(M, N, CV_32F);
+  for(int y=0; y<M; y++)
+    for(int x=0; x<N; x++)
+      I.at<float>(y,x)=(float)(cos(0.002*(x*x + 2*y*y)) +
+                               0.3*rand()/RAND_MAX);
+  return I;
+}
+
+/**
+ * Compares the sequences of Seguidor and the reference, returns the
+ * number of failures.
+ */
+int compareSequence(Seguidor& seg, ReferenceSeguidor& ref, const char* name)
+{
+  int steps=0;
+  for(;;){
+    const bool a=seg.siguiente(), b=ref.siguiente();
+    if(a!=b || (a && (seg.get_r()!=ref.get_r() ||
+                      seg.get_c()!=ref.get_c()))){
+      cout<<name<<": the sequences differ at step "<<steps<<endl;
+      return 1;
+    }
+    if(!a)
+      break;
+    steps++;
+  }
+  cout<<name<<": "<<steps<<" points in the same order"<<endl;
+  return 0;
+}
+
+/**
+ * Checks the level queues against the reference, from the automatic start
+ * point and from a given one.
+ */
+int checkLevels(const int M, const int N, const int levels)
+{
+  const cv::Mat I=makeFringes(M, N);
+  int failures=0;
+
+  Seguidor automatico(I, levels);
+  ReferenceSeguidor ref(automatico.get_qmap().clone(), automatico.get_r(),
+                        automatico.get_c(), levels);
+  failures+=compareSequence(automatico, ref, "levels, automatic start");
+
+  Seguidor dado(I, M/3, N/2, levels);
+  ReferenceSeguidor ref2(dado.get_qmap().clone(), M/3, N/2, levels);
+  failures+=compareSequence(dado, ref2, "levels, given start");
+  return failures;
+}
+
+/**
+ * The level of a value in the original scalar loop: every level is tested
+ * and the last one that contains the value wins.
+ */
+int referenceLevel(const double p, const double a, const double b,
+                   const int levels)
+{
+  const double step=(b-a)/levels;
+  int q=-1;
+  for(int l=0; l<levels; l++)
+    if(p>=a+l*step && p<=a+(l+1)*step)
+      q=l;
+  return q;
+}
+
+/**
+ * Compares a quantized map with the scalar loop, returns the number of
+ * failures. When the comparison is not exact, the values that round to a
+ * level boundary differently in single and double precision are skipped.
+ */
+int compareLevels(const cv::Mat& qmap, const cv::Mat& values, const double a,
+                  const double b, const int levels, const bool exact,
+                  const char* name)
+{
+  const double step=(b-a)/levels;
+  int wrong=0, skipped=0;
+  for(int y=0; y<qmap.rows; y++)
+    for(int x=0; x<qmap.cols; x++){
+      const double p=values.at<double>(y,x);
+      if(qmap.at<uchar>(y,x)==referenceLevel(p, a, b, levels))
+        continue;
+      const double k=step>0? floor((p-a)/step + 0.5):0;
+      if(!exact && fabs(p-(a+k*step))<=1e-5*(b-a))
+        skipped++;
+      else
+        wrong++;
+    }
+  cout<<name<<": "<<wrong<<" wrong levels, "<<skipped
+      <<" on a boundary"<<endl;
+  return wrong? 1:0;
+}
+
+/** The squared gradient magnitude that calcQualityMap quantizes */
+cv::Mat gradientMagnitude(const cv::Mat& I)
+{
+  const int M=I.rows, N=I.cols;
+  cv::Mat m(M, N, CV_64F);
+  for(int y=0; y<M; y++)
+    for(int x=0; x<N; x++){
+      const int yp= y>0? y-1:min(1, M-1), xp= x>0? x-1:min(1, N-1);
+      const double dx=I.at<float>(y,x)-I.at<float>(yp,x);
+      const double dy=I.at<float>(y,x)-I.at<float>(y,xp);
+      m.at<double>(y,x)=dx*dx + dy*dy;
+    }
+  return m;
+}
+
+/**
+ * Checks Seguidor::cuantiza against the scalar loop through
+ * calcQualityMap, that quantizes from zero, and through setQMap, that
+ * quantizes from the minimum of the map.
+ */
+int checkQuantization(const int M, const int N, const int levels)
+{
+  int failures=0;
+
+  // Quality map of a fringe pattern, the maximum falls on the last level
+  const cv::Mat I=makeFringes(M, N);
+  Seguidor seg(I, levels);
+  const cv::Mat magn=gradientMagnitude(I);
+  double b;
+  cv::minMaxLoc(magn, NULL, &b, NULL, NULL);
+  failures+=compareLevels(seg.get_qmap(), magn, 0, b, levels, false,
+                          "quality map");
+
+  // Integer map in 8 levels whose boundaries are exact in single
+  // precision, with values on every boundary and on the maximum
+  Seguidor ocho(I, 8);
+  cv::Mat entero(M, N, CV_8U), valores(M, N, CV_64F);
+  for(int y=0; y<M; y++)
+    for(int x=0; x<N; x++){
+      entero.at<uchar>(y,x)=(uchar)(20 + (y*N + x)%129);
+      valores.at<double>(y,x)=entero.at<uchar>(y,x);
+    }
+  ocho.setQMap(entero);
+  failures+=compareLevels(ocho.get_qmap(), valores, 20, 148, 8, true,
+                          "integer map");
+
+  // Floating point map with negative values
+  cv::Mat real(M, N, CV_32F);
+  for(int y=0; y<M; y++)
+    for(int x=0; x<N; x++){
+      real.at<float>(y,x)=(float)(10.0*rand()/RAND_MAX - 3.0);
+      valores.at<double>(y,x)=real.at<float>(y,x);
+    }
+  double a;
+  cv::minMaxLoc(valores, &a, &b, NULL, NULL);
+  seg.setQMap(real);
+  failures+=compareLevels(seg.get_qmap(), valores, a, b, levels, false,
+                          "float map");
+
+  // A constant map and a constant image put every point on the last level
+  seg.setQMap(cv::Mat(M, N, CV_32F, cv::Scalar(2.5)));
+  valores.setTo(cv::Scalar(2.5));
+  failures+=compareLevels(seg.get_qmap(), valores, 2.5, 2.5, levels, true,
+                          "constant map");
+  Seguidor plano(cv::Mat(M, N, CV_32F, cv::Scalar(1)), levels);
+  valores.setTo(cv::Scalar(0));
+  failures+=compareLevels(plano.get_qmap(), valores, 0, 0, levels, true,
+                          "constant image");
+  return failures;
+}
+
+/**
+ * The key of a quality in the continuous mode of Seguidor: the highest
+ * quality has the lowest key and NaN has the highest.
+ */
+uint32_t qualityKey(const float q)
+{
+  if(q!=q)
+    return 0xffffffffu;
+  uint32_t u;
+  std::memcpy(&u, &q, sizeof(u));
+  u= (u&0x80000000u)? ~u:(u|0x80000000u);
+  return ~u;
+}
+
+/**
+ * A random quality around the given value, with some NaN, infinities and
+ * zeros of both signs.
+ */
+float randomQuality(const double centro)
+{
+  const int k=rand()%100;
+  if(k<5)
+    return std::numeric_limits<float>::quiet_NaN();
+  if(k==5)
+    return -std::numeric_limits<float>::infinity();
+  if(k==6)
+    return std::numeric_limits<float>::infinity();
+  if(k==7)
+    return rand()%2? 0.f:-0.f;
+  return (float)(centro + 20.0*rand()/RAND_MAX - 10.0);
+}
+
+/**
+ * Compares ColaRadix with a std::priority_queue on random operations,
+ * returns the number of failures.
+ *
+ * The qualities decrease with the operations, as when the fringes are
+ * followed, and the keys below the last one taken out are raised to it,
+ * as in the queue. The ties may leave in a different order, so the key of each
+ * element is checked instead of the element.
+ */
+int checkRadix(const int operaciones)
+{
+  typedef std::pair<uint32_t, uint32_t> Par;
+  std::priority_queue<Par, std::vector<Par>, std::greater<Par> > ref;
+  ColaRadix cola;
+  std::vector<uint32_t> claves;
+  std::vector<bool> sacado;
+  uint32_t ultima=0;
+  int wrong=0, subidas=0;
+
+  for(int ronda=0; ronda<2; ronda++){
+    for(int k=0; k<operaciones; k++){
+      if(ref.empty() || rand()%100<55){
+        const double centro=100.0 - 200.0*k/operaciones;
+        uint32_t clave=qualityKey(randomQuality(centro));
+        const uint32_t valor=(uint32_t)claves.size();
+        cola.mete(clave, valor);
+        if(clave<ultima){
+          clave=ultima;
+          subidas++;
+        }
+        claves.push_back(clave);
+        sacado.push_back(false);
+        ref.push(Par(clave, valor));
+      }
+      else{
+        const uint32_t valor=cola.saca();
+        if(valor>=claves.size() || sacado[valor] ||
+           claves[valor]!=ref.top().first)
+          wrong++;
+        else
+          sacado[valor]=true;
+        ultima=ref.top().first;
+        ref.pop();
+      }
+      if(cola.vacia()!=ref.empty())
+        wrong++;
+    }
+    // The queue is reused after it is cleared
+    cola.limpia();
+    ref=std::priority_queue<Par, std::vector<Par>, std::greater<Par> >();
+    ultima=0;
+  }
+  cout<<"radix queue: "<<wrong<<" wrong elements, "<<subidas
+      <<" keys below the last one"<<endl;
+  return wrong? 1:0;
+}
+
+int main(int argc, char* argv[])
+{
+  int failures=0;
+  srand(12345);
+  failures+=checkLevels(61, 70, 7);
+  failures+=checkLevels(80, 45, 150);
+  failures+=checkQuantization(37, 83, 8);
+  failures+=checkQuantization(64, 64, 200);
+  failures+=checkRadix(20000);
+
+  if(failures)
+    cout<<failures<<" checks failed"<<endl;
+  return failures? 1:0;
+}
@@ -0,0 +1,121 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/unwrap_ls.h>
+#include <imcore/unwrap_mg.h>
+#include <imcore/phase_wrap.h>
+#include <utils/utils.h>
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+
+/** The least squares solvers checked */
+enum Solver{ DCT_PCG, MULTIGRID };
+
+/**
+ * Unwraps a smooth phase without residues, where the least squares
+ * solution is exact up to a constant. The multigrid solution is also
+ * compared with the DCT/PCG one. Returns 1 on failure.
+ */
+template<typename T>
+int check(const Solver solver, const int M, const int N, const bool masked,
+          const bool weighted, const double tol)
+{
+  const int type= sizeof(T)==sizeof(float)? CV_32F:CV_64F;
+  cv::Mat p=peaks(M, N)*10;
+  cv::Mat wp=wphase(p);
+  wp.convertTo(wp, type);
+
+  cv::Mat mask, quality;
+  if(masked){
+    mask=cv::Mat::zeros(M, N, CV_8U);
+    cv::circle(mask, cv::Point(N/2, M/2), min(M, N)*2/5, cv::Scalar(1), -1);
+  }
+  if(weighted && solver==MULTIGRID){
+    // Smooth weights, as the quality maps of the fringe patterns
+    quality=mapRange(peaks(M, N), 0.2, 1);
+  }
+  else if(weighted){
+    quality.create(M, N, CV_32F);
+    cv::randu(quality, 0.5, 1);
+  }
+
+  const cv::Point pixel(N/2, M/2);
+  cv::Mat up=cv::Mat::zeros(M, N, type), ls=cv::Mat::zeros(M, N, type);
+  int64 start=cv::getTickCount();
+  const int iters= solver==MULTIGRID?
+    unwrap2D_mg(wp, mask, up, pixel, quality, 50, 1e-8):
+    unwrap2D_ls(wp, mask, up, pixel, quality, 200, 1e-8);
+  const double t=(cv::getTickCount()-start)/cv::getTickFrequency();
+  if(solver==MULTIGRID)
+    unwrap2D_ls(wp, mask, ls, pixel, quality, 200, 1e-8);
+
+  const double offset=up.at<T>(pixel.y, pixel.x) - p.at<float>(pixel.y,
+                                                                pixel.x);
+  double err=0, errLs=0;
+  for(int i=0; i<M; i++)
+    for(int j=0; j<N; j++)
+      if(mask.empty() || mask.at<uchar>(i,j)){
+        err=max(err, fabs(up.at<T>(i,j) - p.at<float>(i,j) - offset));
+        if(solver==MULTIGRID)
+          errLs=max(errLs, fabs((double)up.at<T>(i,j) - ls.at<T>(i,j)));
+      }
+
+  cout<<(solver==MULTIGRID? "multigrid ":"DCT/PCG ")
+      <<(type==CV_32F? "float ":"double ")<<M<<"x"<<N
+      <<(masked? " masked":"")<<(weighted? " weighted":"")
+      <<": error "<<err<<", offset/2pi "<<offset/(2*M_PI);
+  if(solver==MULTIGRID)
+    cout<<", difference with unwrap2D_ls "<<errLs;
+  cout<<", "<<iters<<(solver==MULTIGRID? " cycles, ":" iterations, ")<<t
+      <<" s"<<endl;
+  return (err<=tol && errLs<=tol && fabs(dwrap(offset))<=tol)? 0:1;
+}
+
+int main(int argc, char* argv[])
+{
+  int failures=0;
+  failures+=check<double>(DCT_PCG, 256, 256, false, false, 1e-4);
+  failures+=check<float>(DCT_PCG, 255, 317, false, false, 1e-3);
+  failures+=check<double>(DCT_PCG, 200, 241, true, false, 1e-4);
+  failures+=check<double>(DCT_PCG, 128, 160, false, true, 1e-4);
+  failures+=check<float>(DCT_PCG, 301, 257, true, true, 1e-3);
+
+  failures+=check<double>(MULTIGRID, 256, 256, false, false, 1e-4);
+  failures+=check<float>(MULTIGRID, 255, 317, false, false, 1e-3);
+  failures+=check<double>(MULTIGRID, 200, 241, true, false, 1e-4);
+  failures+=check<double>(MULTIGRID, 128, 160, false, true, 1e-4);
+  failures+=check<float>(MULTIGRID, 301, 257, true, true, 1e-3);
+  failures+=check<double>(MULTIGRID, 1500, 130, false, false, 1e-4);
+  failures+=check<float>(MULTIGRID, 2048, 2048, true, false, 1e-3);
+
+  if(failures)
+    cout<<failures<<" checks failed"<<endl;
+  return failures? 1:0;
+}
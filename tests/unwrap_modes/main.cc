@@ -0,0 +1,132 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/unwrap.h>
+#include <utils/utils.h>
+#include <tests/unwrap_fixture.h>
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+
+/**
+ * Compares an unwrapped phase with the true one.
+ *
+ * The unwrapped phase may differ from the true one by a global 2pi
+ * multiple, which is taken at the start pixel.
+ *
+ * @return the largest difference, or HUGE_VAL if a pixel of the mask is
+ * unwrapped to another 2pi multiple.
+ */
+double unwrapError(const cv::Mat& uphase, const cv::Mat& p,
+                   const cv::Mat& mask, const cv::Point start)
+{
+  cv::Mat u;
+  uphase.convertTo(u, CV_64F);
+  const double k=cvRound((u.at<double>(start.y, start.x) -
+                          p.at<double>(start.y, start.x))/(2*M_PI));
+  double err=0;
+  for(int i=0; i<p.rows; i++)
+    for(int j=0; j<p.cols; j++){
+      if(!mask.empty() && !mask.at<uchar>(i,j))
+        continue;
+      const double d=u.at<double>(i,j) - p.at<double>(i,j) - 2*M_PI*k;
+      if(!(fabs(d)<M_PI))
+        return HUGE_VAL;
+      err=max(err, fabs(d));
+    }
+  return err;
+}
+
+/**
+ * Unwraps the phase in the given precision, returns the number of
+ * failures.
+ */
+int checkPrecision(const int type)
+{
+  const int M=96, N=112;
+  const cv::Point start(N/2, M/2);
+  const cv::Mat p=makePhase(M, N);
+  cv::Mat wp=wphase(p);
+  wp.convertTo(wp, type);
+
+  Unwrap unwrap(wp, TAU, SMOOTH, WINDOW);
+  unwrap.setPixel(start);
+  unwrap.run();
+  const double err=unwrapError(unwrap.getOutput(), p, cv::Mat(), start);
+  cout<<(type==CV_32F? "single":"double")<<" precision: largest"
+      <<" difference "<<err<<endl;
+  return err<1? 0:1;
+}
+
+/**
+ * Compares the incremental mode with the full recomputation of the window
+ * in the given precision, returns the number of failures.
+ *
+ * Both must follow the true phase without 2pi jumps, and the incremental
+ * result must stay within 1e-2 rad of the full one.
+ */
+int checkIncremental(const int type)
+{
+  const int M=96, N=112;
+  const cv::Point start(N/2, M/2);
+  const cv::Mat p=makePhase(M, N);
+  cv::Mat wp=wphase(p);
+  wp.convertTo(wp, type);
+
+  cv::Mat out[2];
+  for(int k=0; k<2; k++){
+    Unwrap unwrap(wp, TAU, SMOOTH, WINDOW);
+    unwrap.setPixel(start);
+    unwrap.setIncremental(k==1);
+    unwrap.run();
+    unwrap.getOutput().convertTo(out[k], CV_64F);
+  }
+  const double errFull=unwrapError(out[0], p, cv::Mat(), start);
+  const double errIncr=unwrapError(out[1], p, cv::Mat(), start);
+  cv::Mat diff;
+  cv::absdiff(out[0], out[1], diff);
+  const double largest=cv::norm(diff, cv::NORM_INF);
+  cout<<(type==CV_32F? "single":"double")<<" precision incremental:"
+      <<" errors "<<errFull<<" and "<<errIncr<<", difference to the"
+      <<" full update "<<largest<<endl;
+  return (errFull<1 && errIncr<1 && largest<1e-2)? 0:1;
+}
+
+int main(int argc, char* argv[])
+{
+  int failures=0;
+  failures+=checkPrecision(CV_64F);
+  failures+=checkPrecision(CV_32F);
+  failures+=checkIncremental(CV_64F);
+  failures+=checkIncremental(CV_32F);
+
+  if(failures)
+    cout<<failures<<" checks failed"<<endl;
+  return failures? 1:0;
+}
@@ -0,0 +1,208 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/unwrap.h>
+#include <utils/utils.h>
+#include <tests/unwrap_fixture.h>
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+
+/**
+ * Returns the largest difference between two phases over the mask, with
+ * the phases in any precision.
+ */
+double maskDiff(const cv::Mat& a, const cv::Mat& b, const cv::Mat& mask)
+{
+  cv::Mat da, db;
+  a.convertTo(da, CV_64F);
+  b.convertTo(db, CV_64F);
+  double err=0;
+  for(int i=0; i<mask.rows; i++)
+    for(int j=0; j<mask.cols; j++)
+      if(mask.at<uchar>(i,j))
+        err=max(err, fabs(da.at<double>(i,j) - db.at<double>(i,j)));
+  return err;
+}
+
+/**
+ * Builds the components of the checks: a frame along the image border and
+ * a 3x3 grid of squares inside it. The bounding box of the frame is the
+ * whole image, so it covers the squares.
+ */
+vector<cv::Mat> makeComponents(const int M, const int N)
+{
+  vector<cv::Mat> comps;
+  cv::Mat frame=cv::Mat::ones(M, N, CV_8U);
+  frame(cv::Rect(10, 10, N-20, M-20)).setTo(cv::Scalar(0));
+  comps.push_back(frame);
+  for(int y=0; y<3; y++)
+    for(int x=0; x<3; x++){
+      cv::Mat square=cv::Mat::zeros(M, N, CV_8U);
+      square(cv::Rect(14 + 30*x, 14 + 26*y, 16, 16)).setTo(cv::Scalar(1));
+      comps.push_back(square);
+    }
+  return comps;
+}
+
+/**
+ * Unwraps the components in parallel, returns the number of failures.
+ *
+ * Each component must be equal to the sequential unwrapping of its
+ * bounding box from the same seed, and unwrapping in place, with the
+ * wrapped phase as output, must give the same result.
+ */
+int checkComponents(const int type)
+{
+  const int M=96, N=112;
+  const cv::Mat p=makePhase(M, N);
+  cv::Mat wp=wphase(p);
+  wp.convertTo(wp, type);
+  const vector<cv::Mat> masks=makeComponents(M, N);
+  cv::Mat mask=cv::Mat::zeros(M, N, CV_8U);
+  for(size_t k=0; k<masks.size(); k++)
+    mask.setTo(cv::Scalar(1), masks[k]);
+  const char* name= type==CV_32F? "single":"double";
+  int failures=0;
+
+  Unwrap split(wp, TAU, SMOOTH, WINDOW);
+  split.setMask(mask);
+  split.setSplitComponents(true);
+  split.setThreads(4);
+  split.run();
+  const vector<UnwrapComponent> comps=split.getComponents();
+  if(comps.size()!=masks.size()){
+    cout<<name<<" precision: "<<comps.size()<<" components, "
+        <<masks.size()<<" expected"<<endl;
+    return 1;
+  }
+
+  for(size_t k=0; k<comps.size(); k++){
+    const UnwrapComponent& c=comps[k];
+    const cv::Rect& b=c.bounds;
+    size_t m=0;
+    while(m<masks.size() && !masks[m].at<uchar>(c.seed.y, c.seed.x))
+      m++;
+    Unwrap seq(wp(b).clone(), TAU, SMOOTH, WINDOW);
+    seq.setMask(masks[m](b).clone());
+    seq.setPixel(c.seed - b.tl());
+    seq.run();
+    const double err=maskDiff(seq.getOutput(), split.getOutput()(b),
+                              masks[m](b));
+    if(err!=0){
+      cout<<name<<" precision: component "<<c.label<<" of "<<c.pixels
+          <<" pixels differs from the sequential unwrapping by "<<err<<endl;
+      failures++;
+    }
+  }
+  cout<<name<<" precision: "<<comps.size()<<" components, "<<failures
+      <<" differ from the sequential unwrapping"<<endl;
+
+  cv::Mat inplace=wp.clone();
+  Unwrap same(inplace, TAU, SMOOTH, WINDOW);
+  same.setOutput(inplace);
+  same.setMask(mask);
+  same.setSplitComponents(true);
+  same.setThreads(4);
+  same.run();
+  const double err=maskDiff(inplace, split.getOutput(), mask);
+  cout<<name<<" precision: in place difference "<<err<<endl;
+  if(err!=0)
+    failures++;
+  return failures;
+}
+
+/**
+ * Unwraps the phase in tiles, returns the number of failures.
+ *
+ * Each tile starts from its own seed, so the tiles are unwrapped to
+ * different 2pi multiples that the overlaps must reconcile. The result
+ * must match the sequential unwrapping up to a global 2pi multiple,
+ * without any pixel slipping to another multiple, and within 0.1 rad.
+ */
+int checkTiles(const int type, const int size, const int overlap)
+{
+  const int M=96, N=112;
+  const cv::Point start(N/2, M/2);
+  const cv::Mat p=makePhase(M, N);
+  cv::Mat wp=wphase(p);
+  wp.convertTo(wp, type);
+  // A band that the tiles below it go around
+  cv::Mat mask=cv::Mat::ones(M, N, CV_8U);
+  mask(cv::Rect(20, 70, 60, 4)).setTo(cv::Scalar(0));
+
+  Unwrap seq(wp, TAU, SMOOTH, WINDOW);
+  seq.setMask(mask);
+  seq.setPixel(start);
+  seq.run();
+  Unwrap tiled(wp, TAU, SMOOTH, WINDOW);
+  tiled.setMask(mask);
+  tiled.setPixel(start);
+  tiled.setTileSize(size);
+  tiled.setTileOverlap(overlap);
+  tiled.setThreads(4);
+  tiled.run();
+
+  cv::Mat a, b;
+  seq.getOutput().convertTo(a, CV_64F);
+  tiled.getOutput().convertTo(b, CV_64F);
+  const double k=cvRound((b.at<double>(start.y, start.x) -
+                          a.at<double>(start.y, start.x))/(2*M_PI));
+  double err=0;
+  int slips=0;
+  for(int i=0; i<M; i++)
+    for(int j=0; j<N; j++)
+      if(mask.at<uchar>(i,j)){
+        const double d=fabs(b.at<double>(i,j) - a.at<double>(i,j) -
+                            2*M_PI*k);
+        if(!(d<M_PI))
+          slips++;
+        else
+          err=max(err, d);
+      }
+  cout<<(type==CV_32F? "single":"double")<<" precision: tiles of "<<size
+      <<" with overlap "<<overlap<<", "<<slips<<" pixels slipped, largest"
+      <<" difference to the sequential unwrapping "<<err<<endl;
+  return (slips==0 && err<0.1)? 0:1;
+}
+
+int main(int argc, char* argv[])
+{
+  int failures=0;
+  failures+=checkComponents(CV_64F);
+  failures+=checkComponents(CV_32F);
+  failures+=checkTiles(CV_64F, 24, 12);
+  failures+=checkTiles(CV_32F, 32, 16);
+  failures+=checkTiles(CV_64F, 40, 24);
+  failures+=checkTiles(CV_64F, 48, 16);
+
+  if(failures)
+    cout<<failures<<" checks failed"<<endl;
+  return failures? 1:0;
+}
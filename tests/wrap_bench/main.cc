@@ -0,0 +1,121 @@
+/**************************************************************************
+Copyright (c) 2012, Julio C. Estrada
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
++ Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+
++ Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**************************************************************************/
+
+#include <imcore/phase_wrap.h>
+#include <opencv2/core/core.hpp>
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+
+using namespace std;
+
+/** The wrap of unwrap_gears before phase_wrap.h */
+float oldW(float phase)
+{
+  float m= 2 * M_PI;
+  int n= (phase < 0) ? (phase - M_PI) / m : (phase + M_PI) / m;
+
+  return (phase - m * n);
+}
+
+/** The wrap of utils wphase before phase_wrap.h */
+float atanW(float phase)
+{
+  return atan2(sin(phase), cos(phase));
+}
+
+/** Distance between two wrapped phases on the circle */
+double circleDistance(double a, double b)
+{
+  return fabs(dwrap(a - b));
+}
+
+template<typename F>
+double timeScalar(F f, const vector<float>& in, vector<float>& out,
+                  const int reps)
+{
+  const int64 start=cv::getTickCount();
+  for(int r=0; r<reps; r++)
+    for(size_t i=0; i<in.size(); i++)
+      out[i]=f(in[i]);
+  return (cv::getTickCount()-start)/cv::getTickFrequency();
+}
+
+int main(int argc, char* argv[])
+{
+  const int n= argc>1? atoi(argv[1]):1<<20;
+  const int reps= argc>2? atoi(argv[2]):10;
+  vector<float> in(n), ref(n), out(n);
+  vector<double> din(n), dout(n);
+  for(int i=0; i<n; i++){
+    in[i]=(float)(100.0*rand()/RAND_MAX - 50.0);
+    din[i]=in[i];
+  }
+
+  const double tAtan=timeScalar(atanW, in, ref, reps);
+  const double tOld=timeScalar(oldW, in, out, reps);
+  double errOld=0;
+  for(int i=0; i<n; i++)
+    errOld=max(errOld, circleDistance(out[i], ref[i]));
+
+  const double tScalar=timeScalar(swrap, in, out, reps);
+  double err=0;
+  for(int i=0; i<n; i++)
+    err=max(err, circleDistance(out[i], ref[i]));
+
+  int64 start=cv::getTickCount();
+  for(int r=0; r<reps; r++)
+    swrap_array(&in[0], &out[0], n);
+  const double tArray=(cv::getTickCount()-start)/cv::getTickFrequency();
+  double errArray=0;
+  for(int i=0; i<n; i++)
+    errArray=max(errArray, circleDistance(out[i], ref[i]));
+
+  start=cv::getTickCount();
+  for(int r=0; r<reps; r++)
+    dwrap_array(&din[0], &dout[0], n);
+  const double tDouble=(cv::getTickCount()-start)/cv::getTickFrequency();
+  double errDouble=0;
+  for(int i=0; i<n; i++){
+    errDouble=max(errDouble, circleDistance(dout[i], atan2(sin(din[i]),
+                                                     cos(din[i]))));
+    if(fabs(dout[i])>M_PI*(1+1e-12))
+      errDouble=1;
+  }
+
+  cout<<n<<" phases, "<<reps<<" repetitions"<<endl;
+  cout<<"  atan2(sin,cos): "<<tAtan<<" s"<<endl;
+  cout<<"  sW (old):       "<<tOld<<" s, error "<<errOld<<endl;
+  cout<<"  swrap:          "<<tScalar<<" s, error "<<err<<endl;
+  cout<<"  swrap_array:    "<<tArray<<" s, error "<<errArray<<endl;
+  cout<<"  dwrap_array:    "<<tDouble<<" s, error "<<errDouble<<endl;
+
+  const double bound=1e-4;
+  return (err<=bound && errArray<=bound && errDouble<=1e-9)? 0:1;
+}
@@ -29,6 +29,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "utils.h"
 #include <cmath>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <imcore/phase_wrap.h>
 
 void gradient(const cv::Mat I, cv::Mat& dx, cv::Mat& dy)
 {
@@ -158,6 +159,15 @@ cv::Mat ramp(float wx, float wy, const int M, const int N)
   return res;
 }
 
+/**
+ * Wraps a single precision phase in place.
+ */
+static void wrapRows(cv::Mat& p)
+{
+  for(int i=0; i<p.rows; i++)
+    swrap_array(p.ptr<float>(i), p.ptr<float>(i), p.cols);
+}
+
 cv::Mat speckle_peaks(const int M, const int N, const float magn,
                const int speckle_size)
 {
@@ -177,24 +187,31 @@ cv::Mat speckle_peaks(const int M, const int N, const float magn,
   noise0 = mapRange(noise0, -pi, pi);
   noise1 = mapRange(noise1, -pi, pi);
 
-  Ic0 = wphase(noise0);
-  Ic1 = wphase(noise1 + p + pi/2.);
+  // The phases are wrapped in place, without temporaries
+  Ic0 = noise0;
+  wrapRows(Ic0);
+  Ic1 = noise1 + p + pi/2.;
+  wrapRows(Ic1);
+  Ic0-= Ic1;
+  wrapRows(Ic0);
 
-  return wphase(Ic0-Ic1);
+  return Ic0;
 }
 
 cv::Mat wphase(const cv::Mat p)
 {
-  cv::Mat wp(p.rows, p.cols, CV_32F);
-  float *const __restrict__ pt_wp = (float*)wp.data;
-  float *const __restrict__ pt_p = (float*)p.data;
-  size_t idx;
-
-  for(int i=0; i<p.rows; i++){
-    idx=i*p.cols;
-    for(int j=0; j<p.cols; j++)
-      pt_wp[idx+j] = atan2(sin(pt_p[idx+j]), cos(pt_p[idx+j]));
+  if(p.type()!=CV_32F && p.type()!=CV_64F){
+    cv::Exception e(1000, "Type not supported", "wphase",
+                    std::string(__FILE__), __LINE__);
+    throw(e);
   }
+  cv::Mat wp(p.rows, p.cols, p.type());
+
+  for(int i=0; i<p.rows; i++)
+    if(p.type()==CV_32F)
+      swrap_array(p.ptr<float>(i), wp.ptr<float>(i), p.cols);
+    else
+      dwrap_array(p.ptr<double>(i), wp.ptr<double>(i), p.cols);
 
   return wp;
 }
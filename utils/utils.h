@@ -111,6 +111,12 @@ cv::Mat speckle_peaks(const int M, const int N, const float magn,
  */
 void gradient(const cv::Mat I, cv::Mat& dx, cv::Mat& dy);
 
+/**
+ * Wraps the phase to [-pi,pi].
+ *
+ * @param p the phase, single or double precision.
+ * @return the wrapped phase, of the same type of p.
+ */
 cv::Mat wphase(const cv::Mat p);
 cv::Mat mapRange(const cv::Mat mat, float a, float b);
 